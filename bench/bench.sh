@@ -0,0 +1,98 @@
+#!/usr/bin/env bash
+#set -euo pipefail
+
+# fix relative paths
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR/.." || exit 1
+
+ASM_BIN="$SCRIPT_DIR/../build/u2asm"
+VM_BIN="$SCRIPT_DIR/../build/u2vm"
+WORK_DIR="$SCRIPT_DIR/../build/bench"
+
+# every kernel is assembled and run this many times, mean and stddev are over
+# the runs. extra vm flags (--tiered, --regalloc=graph, ...) go in BENCH_VMFLAGS
+runs=${BENCH_RUNS:-10}
+vm_flags=${BENCH_VMFLAGS:-}
+out=${BENCH_OUT:-build/bench.json}
+
+mkdir -p "$WORK_DIR"
+samples="$WORK_DIR/samples"
+: > "$samples"
+
+# too long to keep in the tree, one block of 20000 instructions that never
+# trap so the compiler phases are all there is to time
+awk 'BEGIN {
+    split("add sub xor and or mul", ops, " ")
+    for (r = 1; r <= 16; r++)
+        printf "li r%d %d\n", r, r * 2654435761 % 8191
+    for (i = 0; i < 20000; i++) {
+        rd = i % 16 + 1; rs1 = (i * 7 + 3) % 16 + 1; rs2 = (i * 11 + 5) % 16 + 1
+        if (i % 9 == 0)
+            printf "shl r%d r%d %d\n", rd, rs1, i % 5 + 1
+        else if (i % 13 == 0)
+            printf "mov r%d r%d\n", rd, rs1
+        else
+            printf "%s r%d r%d r%d\n", ops[i % 6 + 1], rd, rs1, rs2
+    }
+}' > "$WORK_DIR/straight.u2a"
+
+now() {
+    date +%s%N
+}
+
+echo "=== Running benchmarks, $runs runs each ==="
+
+for src in "$SCRIPT_DIR"/*.u2a "$WORK_DIR/straight.u2a"; do
+    base=$(basename "$src" .u2a)
+    u2b_file="$WORK_DIR/$base.u2b"
+    # "kernel phase ns" from each phase line of --stats
+    phase_ns='s/.*"name": "\([a-z0-9_]*\)", "ns": \([0-9]*\).*/'"$base"' \1 \2/p'
+    echo "--- $base ---"
+
+    for ((run = 0; run < runs; run++)); do
+        start=$(now)
+        $ASM_BIN --stats "$src" "$u2b_file" 2> "$WORK_DIR/stats.json" || exit 1
+        echo "$base assemble $(($(now) - start))" >> "$samples"
+        sed -n "$phase_ns" "$WORK_DIR/stats.json" >> "$samples"
+
+        if ! $VM_BIN --stats $vm_flags "$u2b_file" 2> "$WORK_DIR/stats.json" > /dev/null; then
+            echo "!!! $base failed !!!"
+            cat "$WORK_DIR/stats.json"
+            exit 1
+        fi
+        sed -n "$phase_ns" "$WORK_DIR/stats.json" >> "$samples"
+    done
+done
+
+# kernels and phases keep the order they first showed up in
+awk -v runs="$runs" -v vm_flags="$vm_flags" '
+{
+    key = $1 " " $2
+    if (!(key in n))
+        order[count++] = key
+    n[key]++
+    sum[key] += $3
+    sq[key] += $3 * $3
+    if (!(key in lo) || $3 < lo[key])
+        lo[key] = $3
+    if ($3 > hi[key])
+        hi[key] = $3
+}
+END {
+    printf "{\n  \"runs\": %d,\n  \"vmflags\": \"%s\",\n  \"results\": [", runs, vm_flags
+    for (i = 0; i < count; i++) {
+        key = order[i]
+        split(key, part, " ")
+        mean = sum[key] / n[key]
+        var = (n[key] > 1 ? (sq[key] - n[key] * mean * mean) / (n[key] - 1) : 0)
+        printf "%s\n    {\"kernel\": \"%s\", \"phase\": \"%s\", \"mean_ns\": %.0f, \"stddev_ns\": %.0f, \"min_ns\": %d, \"max_ns\": %d}",
+               i ? "," : "", part[1], part[2], mean, (var > 0 ? sqrt(var) : 0), lo[key], hi[key]
+    }
+    printf "\n  ]\n}\n"
+}' "$samples" > "$out"
+
+# the same numbers for people
+echo "=== Results (us, mean +- stddev) ==="
+sed -n 's/.*"kernel": "\([^"]*\)", "phase": "\([^"]*\)", "mean_ns": \([0-9]*\), "stddev_ns": \([0-9]*\).*/\1 \2 \3 \4/p' "$out" |
+    awk '{ printf "%-10s %-10s %12.1f +- %.1f\n", $1, $2, $3 / 1000, $4 / 1000 }'
+echo "=== Written to $out ==="
@@ -0,0 +1,113 @@
+#!/usr/bin/env bash
+#set -euo pipefail
+
+# fix relative paths
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR/.." || exit 1
+
+ASM_BIN="$SCRIPT_DIR/../build/u2asm"
+VM_BIN="$SCRIPT_DIR/../build/u2vm"
+GEN_BIN="$SCRIPT_DIR/../build/u2gen"
+WORK_DIR="$SCRIPT_DIR/../build/scale"
+
+# one u2gen program per size, all from the same seed and shape. the shape
+# (--branches, --depth, --labels, ...) goes in SCALE_GENFLAGS, extra vm flags
+# in SCALE_VMFLAGS
+sizes=${SCALE_SIZES:-1000 4000 16000 64000}
+gen_flags=${SCALE_GENFLAGS:---seed=1}
+vm_flags=${SCALE_VMFLAGS:-}
+out=${SCALE_OUT:-build/scale.json}
+
+mkdir -p "$WORK_DIR"
+samples="$WORK_DIR/samples"
+: > "$samples"
+
+echo "=== Scaling over $sizes ==="
+
+for size in $sizes; do
+    src="$WORK_DIR/$size.u2a"
+    u2b_file="$WORK_DIR/$size.u2b"
+    # "size phase ns" from each phase line of --stats
+    phase_ns='s/.*"name": "\([a-z0-9_]*\)", "ns": \([0-9]*\).*/'"$size"' \1 \2/p'
+    echo "--- $size ---"
+
+    $GEN_BIN $gen_flags --size="$size" "$src" || exit 1
+    $ASM_BIN --stats "$src" "$u2b_file" 2> "$WORK_DIR/stats.json" || exit 1
+    sed -n "$phase_ns" "$WORK_DIR/stats.json" >> "$samples"
+    if ! $VM_BIN --stats $vm_flags "$u2b_file" 2> "$WORK_DIR/stats.json" > /dev/null; then
+        echo "!!! $size failed !!!"
+        cat "$WORK_DIR/stats.json"
+        exit 1
+    fi
+    sed -n "$phase_ns" "$WORK_DIR/stats.json" >> "$samples"
+done
+
+# a row per phase. slope is how the time grows between the two biggest sizes
+# on a log-log plot: 1 is linear, 2 quadratic
+awk -v gen_flags="$gen_flags" -v vm_flags="$vm_flags" -v json="$out" -v dat="$WORK_DIR/scale.dat" '
+{
+    if (!($1 in seen_size)) {
+        seen_size[$1] = 1
+        size[size_count++] = $1
+    }
+    if (!($2 in seen_phase)) {
+        seen_phase[$2] = 1
+        phase[phase_count++] = $2
+    }
+    ns[$1, $2] = $3
+}
+END {
+    printf "{\n  \"genflags\": \"%s\",\n  \"vmflags\": \"%s\",\n  \"results\": [", gen_flags, vm_flags > json
+    first = 1
+    for (s = 0; s < size_count; s++)
+        for (p = 0; p < phase_count; p++)
+            if ((size[s], phase[p]) in ns) {
+                printf "%s\n    {\"size\": %d, \"phase\": \"%s\", \"ns\": %d}", first ? "" : ",", size[s], phase[p],
+                       ns[size[s], phase[p]] > json
+                first = 0
+            }
+    printf "\n  ]\n}\n" > json
+
+    # the same as columns for gnuplot, a phase per column
+    printf "size" > dat
+    for (p = 0; p < phase_count; p++)
+        printf " %s", phase[p] > dat
+    printf "\n" > dat
+    for (s = 0; s < size_count; s++) {
+        printf "%d", size[s] > dat
+        for (p = 0; p < phase_count; p++)
+            printf " %d", ns[size[s], phase[p]] > dat
+        printf "\n" > dat
+    }
+
+    printf "%-12s", "us"
+    for (s = 0; s < size_count; s++)
+        printf " %12d", size[s]
+    printf "  slope\n"
+    for (p = 0; p < phase_count; p++) {
+        printf "%-12s", phase[p]
+        for (s = 0; s < size_count; s++)
+            printf " %12.1f", ns[size[s], phase[p]] / 1000
+        a = ns[size[size_count - 2], phase[p]]
+        b = ns[size[size_count - 1], phase[p]]
+        if (size_count > 1 && a > 0 && b > 0)
+            printf "  %5.2f", log(b / a) / log(size[size_count - 1] / size[size_count - 2])
+        printf "\n"
+    }
+}' "$samples"
+
+# a log-log plot of every phase when gnuplot is around
+if command -v gnuplot > /dev/null; then
+    columns=$(head -n 1 "$WORK_DIR/scale.dat" | wc -w)
+    gnuplot <<EOF
+set terminal svg size 900,600
+set output "build/scale.svg"
+set logscale xy
+set xlabel "instructions"
+set ylabel "ns"
+set key left top
+plot for [i=2:$columns] "$WORK_DIR/scale.dat" using 1:i with linespoints title columnheader(i)
+EOF
+    echo "=== Plotted to build/scale.svg ==="
+fi
+echo "=== Written to $out and build/scale/scale.dat ==="
@@ -0,0 +1,401 @@
+// generated by stencilgen from build/stencils.o, do not edit
+
+static const uint8_t stencil_mov_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0x89, 0x87, 0x00, 0x00,
+    0x00, 0x00
+};
+static const StencilHole stencil_mov_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {10, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_mov = {stencil_mov_code, 14, stencil_mov_holes, 2};
+
+static const uint8_t stencil_li32_code[] = {
+    0xB8, 0x00, 0x00, 0x00, 0x00, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_li32_holes[] = {
+    {1, HOLE_IMM_LO, 0, 0},
+    {8, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_li32 = {stencil_li32_code, 12, stencil_li32_holes, 2};
+
+static const uint8_t stencil_li64_code[] = {
+    0xB8, 0x00, 0x00, 0x00, 0x00, 0x48, 0xC1, 0xE0, 0x20, 0xBA, 0x00, 0x00,
+    0x00, 0x00, 0x48, 0x09, 0xD0, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_li64_holes[] = {
+    {1, HOLE_IMM_HI, 0, 0},
+    {10, HOLE_IMM_LO, 0, 0},
+    {20, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_li64 = {stencil_li64_code, 24, stencil_li64_holes, 3};
+
+static const uint8_t stencil_ld_code[] = {
+    0x8B, 0x97, 0x00, 0x00, 0x00, 0x00, 0xB8, 0x00, 0x00, 0x00, 0x00, 0x48,
+    0x01, 0xF2, 0x48, 0x98, 0x48, 0x8B, 0x04, 0x02, 0x48, 0x89, 0x87, 0x00,
+    0x00, 0x00, 0x00
+};
+static const StencilHole stencil_ld_holes[] = {
+    {2, HOLE_RS1, 0, 0},
+    {7, HOLE_IMM_LO, 0, 0},
+    {23, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_ld = {stencil_ld_code, 27, stencil_ld_holes, 3};
+
+static const uint8_t stencil_st_code[] = {
+    0x8B, 0x97, 0x00, 0x00, 0x00, 0x00, 0x48, 0x8B, 0x8F, 0x00, 0x00, 0x00,
+    0x00, 0xB8, 0x00, 0x00, 0x00, 0x00, 0x48, 0x01, 0xF2, 0x48, 0x98, 0x48,
+    0x89, 0x0C, 0x02
+};
+static const StencilHole stencil_st_holes[] = {
+    {2, HOLE_RS2, 0, 0},
+    {9, HOLE_RS1, 0, 0},
+    {14, HOLE_IMM_LO, 0, 0},
+};
+static const Stencil stencil_st = {stencil_st_code, 27, stencil_st_holes, 3};
+
+static const uint8_t stencil_add_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0x03, 0x87, 0x00, 0x00,
+    0x00, 0x00, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_add_holes[] = {
+    {3, HOLE_RS2, 0, 0},
+    {10, HOLE_RS1, 0, 0},
+    {17, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_add = {stencil_add_code, 21, stencil_add_holes, 3};
+
+static const uint8_t stencil_sub_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0x2B, 0x87, 0x00, 0x00,
+    0x00, 0x00, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_sub_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {10, HOLE_RS2, 0, 0},
+    {17, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_sub = {stencil_sub_code, 21, stencil_sub_holes, 3};
+
+static const uint8_t stencil_mul_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0x0F, 0xAF, 0x87, 0x00,
+    0x00, 0x00, 0x00, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_mul_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {11, HOLE_RS2, 0, 0},
+    {18, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_mul = {stencil_mul_code, 22, stencil_mul_holes, 3};
+
+static const uint8_t stencil_div_code[] = {
+    0x48, 0x8B, 0x8F, 0x00, 0x00, 0x00, 0x00, 0x48, 0x8B, 0x87, 0x00, 0x00,
+    0x00, 0x00, 0x48, 0x99, 0x48, 0xF7, 0xF9, 0x48, 0x89, 0x87, 0x00, 0x00,
+    0x00, 0x00
+};
+static const StencilHole stencil_div_holes[] = {
+    {3, HOLE_RS2, 0, 0},
+    {10, HOLE_RS1, 0, 0},
+    {22, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_div = {stencil_div_code, 26, stencil_div_holes, 3};
+
+static const uint8_t stencil_and_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0x23, 0x87, 0x00, 0x00,
+    0x00, 0x00, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_and_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {10, HOLE_RS2, 0, 0},
+    {17, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_and = {stencil_and_code, 21, stencil_and_holes, 3};
+
+static const uint8_t stencil_or_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0x0B, 0x87, 0x00, 0x00,
+    0x00, 0x00, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_or_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {10, HOLE_RS2, 0, 0},
+    {17, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_or = {stencil_or_code, 21, stencil_or_holes, 3};
+
+static const uint8_t stencil_xor_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0x33, 0x87, 0x00, 0x00,
+    0x00, 0x00, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_xor_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {10, HOLE_RS2, 0, 0},
+    {17, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_xor = {stencil_xor_code, 21, stencil_xor_holes, 3};
+
+static const uint8_t stencil_not_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0xF7, 0xD0, 0x48, 0x89,
+    0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_not_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {13, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_not = {stencil_not_code, 17, stencil_not_holes, 2};
+
+static const uint8_t stencil_shl_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0xB9, 0x00, 0x00, 0x00, 0x00,
+    0x48, 0xD3, 0xE0, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_shl_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {8, HOLE_IMM_LO, 0, 0},
+    {18, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_shl = {stencil_shl_code, 22, stencil_shl_holes, 3};
+
+static const uint8_t stencil_shr_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0xB9, 0x00, 0x00, 0x00, 0x00,
+    0x48, 0xD3, 0xE8, 0x48, 0x89, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_shr_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {8, HOLE_IMM_LO, 0, 0},
+    {18, HOLE_RD, 0, 0},
+};
+static const Stencil stencil_shr = {stencil_shr_code, 22, stencil_shr_holes, 3};
+
+static const uint8_t stencil_cmp_code[] = {
+    0x48, 0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0x48, 0x8B, 0x97, 0x00, 0x00,
+    0x00, 0x00, 0x48, 0x39, 0xD0, 0x9C, 0x58, 0x25, 0xC1, 0x08, 0x00, 0x00,
+    0x48, 0x89, 0x87, 0x80, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_cmp_holes[] = {
+    {3, HOLE_RS1, 0, 0},
+    {10, HOLE_RS2, 0, 0},
+};
+static const Stencil stencil_cmp = {stencil_cmp_code, 31, stencil_cmp_holes, 2};
+
+static const uint8_t stencil_jmp_code[] = {
+    0xE9, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_jmp_holes[] = {
+    {1, HOLE_TARGET, 1, -4},
+};
+static const Stencil stencil_jmp = {stencil_jmp_code, 5, stencil_jmp_holes, 1};
+
+static const uint8_t stencil_je_code[] = {
+    0xF6, 0x87, 0x80, 0x00, 0x00, 0x00, 0x40, 0x74, 0x07, 0xE9, 0x00, 0x00,
+    0x00, 0x00, 0x66, 0x90
+};
+static const StencilHole stencil_je_holes[] = {
+    {10, HOLE_TARGET, 1, -4},
+};
+static const Stencil stencil_je = {stencil_je_code, 16, stencil_je_holes, 1};
+
+static const uint8_t stencil_jne_code[] = {
+    0xF6, 0x87, 0x80, 0x00, 0x00, 0x00, 0x40, 0x75, 0x07, 0xE9, 0x00, 0x00,
+    0x00, 0x00, 0x66, 0x90
+};
+static const StencilHole stencil_jne_holes[] = {
+    {10, HOLE_TARGET, 1, -4},
+};
+static const Stencil stencil_jne = {stencil_jne_code, 16, stencil_jne_holes, 1};
+
+static const uint8_t stencil_jl_code[] = {
+    0x48, 0x8B, 0x87, 0x80, 0x00, 0x00, 0x00, 0x48, 0x89, 0xC2, 0x48, 0xC1,
+    0xE8, 0x0B, 0x48, 0xC1, 0xEA, 0x07, 0x48, 0x83, 0xF0, 0x01, 0x48, 0x83,
+    0xF2, 0x01, 0x83, 0xE0, 0x01, 0x83, 0xE2, 0x01, 0x38, 0xC2, 0x74, 0x0C,
+    0xE9, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_jl_holes[] = {
+    {37, HOLE_TARGET, 1, -4},
+};
+static const Stencil stencil_jl = {stencil_jl_code, 48, stencil_jl_holes, 1};
+
+static const uint8_t stencil_jg_code[] = {
+    0x48, 0x8B, 0x87, 0x80, 0x00, 0x00, 0x00, 0xA8, 0x40, 0x75, 0x14, 0x89,
+    0xC2, 0x48, 0xC1, 0xE8, 0x0B, 0x48, 0x83, 0xF0, 0x01, 0xC0, 0xEA, 0x07,
+    0x83, 0xE0, 0x01, 0x38, 0xC2, 0x75, 0x09, 0xE9, 0x00, 0x00, 0x00, 0x00,
+    0x0F, 0x1F, 0x40, 0x00, 0xE9, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_jg_holes[] = {
+    {32, HOLE_NEXT, 1, -4},
+    {41, HOLE_TARGET, 1, -4},
+};
+static const Stencil stencil_jg = {stencil_jg_code, 45, stencil_jg_holes, 2};
+
+static const uint8_t stencil_vld_code[] = {
+    0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0xBA, 0x00, 0x00, 0x00, 0x00, 0x48,
+    0x63, 0xD2, 0x48, 0x01, 0xD0, 0x48, 0x01, 0xF0, 0xF3, 0x0F, 0x6F, 0x00,
+    0x0F, 0x11, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x48, 0x10,
+    0x0F, 0x11, 0x8F, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vld_holes[] = {
+    {2, HOLE_RS1, 0, 0},
+    {7, HOLE_IMM_LO, 0, 0},
+    {27, HOLE_RD, 0, 0},
+    {39, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vld = {stencil_vld_code, 43, stencil_vld_holes, 4};
+
+static const uint8_t stencil_vst_code[] = {
+    0x8B, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00,
+    0x00, 0x00, 0xBA, 0x00, 0x00, 0x00, 0x00, 0x48, 0x63, 0xD2, 0x48, 0x01,
+    0xD0, 0x48, 0x01, 0xF0, 0x0F, 0x11, 0x00, 0xF3, 0x0F, 0x6F, 0x8F, 0x00,
+    0x00, 0x00, 0x00, 0x0F, 0x11, 0x48, 0x10
+};
+static const StencilHole stencil_vst_holes[] = {
+    {2, HOLE_RS2, 0, 0},
+    {10, HOLE_RS1, 0, 0},
+    {15, HOLE_IMM_LO, 0, 0},
+    {35, HOLE_RS1, 0, 16},
+};
+static const Stencil stencil_vst = {stencil_vst_code, 43, stencil_vst_holes, 4};
+
+static const uint8_t stencil_vadd_code[] = {
+    0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x97, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x0F, 0xFE, 0xC1, 0x0F, 0x11, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3,
+    0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0xFE, 0xC2, 0x0F,
+    0x11, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vadd_holes[] = {
+    {4, HOLE_RS1, 0, 0},
+    {12, HOLE_RS2, 0, 0},
+    {20, HOLE_RS2, 0, 16},
+    {31, HOLE_RD, 0, 0},
+    {39, HOLE_RS1, 0, 16},
+    {50, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vadd = {stencil_vadd_code, 54, stencil_vadd_holes, 6};
+
+static const uint8_t stencil_vsub_code[] = {
+    0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x97, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x0F, 0xFA, 0xC1, 0x0F, 0x11, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3,
+    0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0xFA, 0xC2, 0x0F,
+    0x11, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vsub_holes[] = {
+    {4, HOLE_RS1, 0, 0},
+    {12, HOLE_RS2, 0, 0},
+    {20, HOLE_RS2, 0, 16},
+    {31, HOLE_RD, 0, 0},
+    {39, HOLE_RS1, 0, 16},
+    {50, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vsub = {stencil_vsub_code, 54, stencil_vsub_holes, 6};
+
+static const uint8_t stencil_vmul_code[] = {
+    0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x97,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F, 0x00, 0x00, 0x00, 0x00,
+    0xF3, 0x0F, 0x6F, 0x9F, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0x73, 0xD2,
+    0x20, 0x66, 0x0F, 0x73, 0xD0, 0x20, 0xF3, 0x0F, 0x6F, 0xA7, 0x00, 0x00,
+    0x00, 0x00, 0x66, 0x0F, 0xF4, 0xC2, 0x66, 0x0F, 0xF4, 0xCB, 0xF3, 0x0F,
+    0x6F, 0x97, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0x73, 0xD2, 0x20, 0x66,
+    0x0F, 0x70, 0xC0, 0x08, 0x66, 0x0F, 0x70, 0xC9, 0x08, 0x66, 0x0F, 0x62,
+    0xC8, 0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0x0F, 0x11, 0x8F,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x0F, 0x73, 0xD0, 0x20, 0x66, 0x0F, 0xF4, 0xCC, 0x66, 0x0F, 0xF4,
+    0xC2, 0x66, 0x0F, 0x70, 0xC9, 0x08, 0x66, 0x0F, 0x70, 0xC0, 0x08, 0x66,
+    0x0F, 0x62, 0xC8, 0x0F, 0x11, 0x8F, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vmul_holes[] = {
+    {4, HOLE_RS1, 0, 0},
+    {12, HOLE_RS2, 0, 0},
+    {20, HOLE_RS1, 0, 0},
+    {28, HOLE_RS2, 0, 0},
+    {46, HOLE_RS2, 0, 16},
+    {62, HOLE_RS2, 0, 16},
+    {89, HOLE_RS1, 0, 16},
+    {96, HOLE_RD, 0, 0},
+    {104, HOLE_RS1, 0, 16},
+    {138, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vmul = {stencil_vmul_code, 142, stencil_vmul_holes, 10};
+
+static const uint8_t stencil_vand_code[] = {
+    0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x97, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x0F, 0xDB, 0xC1, 0x0F, 0x11, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3,
+    0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0xDB, 0xC2, 0x0F,
+    0x11, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vand_holes[] = {
+    {4, HOLE_RS1, 0, 0},
+    {12, HOLE_RS2, 0, 0},
+    {20, HOLE_RS2, 0, 16},
+    {31, HOLE_RD, 0, 0},
+    {39, HOLE_RS1, 0, 16},
+    {50, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vand = {stencil_vand_code, 54, stencil_vand_holes, 6};
+
+static const uint8_t stencil_vor_code[] = {
+    0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x97, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x0F, 0xEB, 0xC1, 0x0F, 0x11, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3,
+    0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0xEB, 0xC2, 0x0F,
+    0x11, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vor_holes[] = {
+    {4, HOLE_RS1, 0, 0},
+    {12, HOLE_RS2, 0, 0},
+    {20, HOLE_RS2, 0, 16},
+    {31, HOLE_RD, 0, 0},
+    {39, HOLE_RS1, 0, 16},
+    {50, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vor = {stencil_vor_code, 54, stencil_vor_holes, 6};
+
+static const uint8_t stencil_vxor_code[] = {
+    0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x97, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x0F, 0xEF, 0xC1, 0x0F, 0x11, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3,
+    0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0xEF, 0xC2, 0x0F,
+    0x11, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vxor_holes[] = {
+    {4, HOLE_RS1, 0, 0},
+    {12, HOLE_RS2, 0, 0},
+    {20, HOLE_RS2, 0, 16},
+    {31, HOLE_RD, 0, 0},
+    {39, HOLE_RS1, 0, 16},
+    {50, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vxor = {stencil_vxor_code, 54, stencil_vxor_holes, 6};
+
+static const uint8_t stencil_vcmpeq_code[] = {
+    0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x97, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x0F, 0x76, 0xC1, 0x0F, 0x11, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3,
+    0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0x76, 0xC2, 0x0F,
+    0x11, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vcmpeq_holes[] = {
+    {4, HOLE_RS1, 0, 0},
+    {12, HOLE_RS2, 0, 0},
+    {20, HOLE_RS2, 0, 16},
+    {31, HOLE_RD, 0, 0},
+    {39, HOLE_RS1, 0, 16},
+    {50, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vcmpeq = {stencil_vcmpeq_code, 54, stencil_vcmpeq_holes, 6};
+
+static const uint8_t stencil_vcmpgt_code[] = {
+    0xF3, 0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x8F,
+    0x00, 0x00, 0x00, 0x00, 0xF3, 0x0F, 0x6F, 0x97, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x0F, 0x66, 0xC1, 0x0F, 0x11, 0x87, 0x00, 0x00, 0x00, 0x00, 0xF3,
+    0x0F, 0x6F, 0x87, 0x00, 0x00, 0x00, 0x00, 0x66, 0x0F, 0x66, 0xC2, 0x0F,
+    0x11, 0x87, 0x00, 0x00, 0x00, 0x00
+};
+static const StencilHole stencil_vcmpgt_holes[] = {
+    {4, HOLE_RS1, 0, 0},
+    {12, HOLE_RS2, 0, 0},
+    {20, HOLE_RS2, 0, 16},
+    {31, HOLE_RD, 0, 0},
+    {39, HOLE_RS1, 0, 16},
+    {50, HOLE_RD, 0, 16},
+};
+static const Stencil stencil_vcmpgt = {stencil_vcmpgt_code, 54, stencil_vcmpgt_holes, 6};
+
@@ -1,5 +1,6 @@
 #include "../common/config.h"
 #include "../common/instruction.h"
+#include "../common/stats.h"
 #include "label.h"     // LabelTable for resolving label addresses
 #include <ctype.h>     // tolower
 #include <inttypes.h>  // PRIX64
@@ -19,13 +20,31 @@
 
 extern int errno;
 
+static int DEV_DEBUG = 0;
+
 /**
     U2 ASSEMBLER
 
     This is the main file for the u2 assembler
     u2 assembly (*.u2a) -> u2 bytecode (*.u2b)
 
-    Usage = u2asm asm.u2a bytecode.u2b
+    Usage = u2asm [--dev] [--sym] [--stats] [--target=full|minimal]
+                  [--caps=LIST] asm.u2a bytecode.u2b
+
+    --sym also writes bytecode.u2b.sym, one "pc label"
+    line per label, which the vm uses to name compiled
+    code for profilers and debuggers
+
+    --stats prints time and peak heap for each pass
+    as JSON on stderr, see common/stats.h
+
+    --target and --caps say which instructions the vm
+    the bytecode is for implements, anything else is
+    replaced by its expansion (see Capabilities in
+    common/instruction.h). full is everything and the
+    default, minimal only the base instructions. --caps
+    takes a comma separated list of capabilities like
+    the one u2vm --caps prints for the host it runs on
  */
 
 // helper function to count the number of args in a line
@@ -74,20 +93,171 @@ void emit_inst(uint32_t inst, FILE* fptr, uint32_t* pc) {
     // important to note is pc is relative to each 32bit segment, it would be
     // silly to give pc byte-level precision since all instructions are 4bytes
     (*pc)++;
-    fwrite(&inst, sizeof(uint32_t), 1, fptr);
+    if (fptr)
+        fwrite(&inst, sizeof(uint32_t), 1, fptr);
+}
+
+// where instructions go. out is NULL to only count the words they take
+typedef struct {
+    FILE* out;
+    uint32_t pc;
+    uint32_t caps;    // of the target, instructions it doesn't have are expanded
+    int temp_needed;  // some expansion used MACRO_TEMP_REG
+    int expanded;     // instructions replaced by their expansion
+} Emitter;
+
+// encode one instruction, with the words extending its imm if it needs them
+void emit_encoded(Emitter* e, uint32_t opcode, uint32_t rd, uint32_t rs1, uint32_t rs2, int64_t imm) {
+    Instruction instruction = Instructions[opcode];
+
+    // do we need to extend immediate?
+    int32_t max_14imm = (1LL << 13) - 1;
+    int32_t min_14imm = -(1LL << 13);
+    int imm_size = 0;  // 0 = 14b, 1 = 32b, 2 = 64b
+    if (imm <= max_14imm && imm >= min_14imm) {
+        imm_size = 0;
+    } else if (imm <= INT32_MAX && imm >= INT32_MIN) {
+        imm_size = 1;
+    } else {
+        imm_size = 2;
+    }
+    if (!(instruction.format & 0b0100)) {
+        rs2 = imm_size;  // imm size is safe to store in rs2 because no
+                         // instruction uses both imm and rs2 that would require
+                         // imm extension, for more info see InstructionFormat
+                         // at common/instruction.h
+    }
+
+    uint32_t instBC = 0;
+    set_op(&instBC, opcode);
+    set_rd(&instBC, rd);
+    set_rs1(&instBC, rs1);
+    set_rs2(&instBC, rs2);
+    set_imm(&instBC, imm & 0x3FFF);
+
+    // check for long immediates
+    if (imm_size) {
+        set_imm(&instBC, 0);  // set immediate to 0 for clarity (extended
+                              // imm means imm will not be read from this
+                              // instruction)
+        // check imm extension is supported
+        if (instruction.format & 0b0100 || !(instruction.format & 0b1000)) {
+            printf("Invalid Immediate extension format!\n");
+            exit(EXIT_FAILURE);
+        }
+        if (e->out)
+            printf_DEBUG("Instruction: %X (%dbit ext)\n", instBC, 32 * imm_size);
+        emit_inst(instBC, e->out, &e->pc);
+        int32_t imm_ext = (int32_t)(imm & 0xFFFFFFFF);
+        if (e->out)
+            printf_DEBUG("Imm extension: %X\n", imm_ext);
+        emit_inst((uint32_t)imm_ext, e->out, &e->pc);
+        if (imm_size == 2) {
+            imm_ext = (int32_t)((imm >> 32) & 0xFFFFFFFF);
+            if (e->out)
+                printf_DEBUG("Imm extension: %X\n", imm_ext);
+            emit_inst((uint32_t)imm_ext, e->out, &e->pc);  // 64bit extension
+        }
+    } else {
+        if (e->out)
+            printf_DEBUG("Instruction: %X\n", instBC);
+        emit_inst(instBC, e->out, &e->pc);
+    }
+}
+
+static uint32_t macro_register(MacroRegister from, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    switch (from) {
+    case MACRO_RD:
+        return rd;
+    case MACRO_RS1:
+        return rs1;
+    case MACRO_RS2:
+        return rs2;
+    case MACRO_TEMP:
+        return MACRO_TEMP_REG;
+    default:
+        return 0;
+    }
+}
+
+// emit the instruction if the target has it and its expansion otherwise, which
+// is lowered the same way in turn. imm of a jump is relative to where it starts
+void emit_lowered(Emitter* e, uint32_t opcode, uint32_t rd, uint32_t rs1, uint32_t rs2, int64_t imm, int line) {
+    InstructionCaps* caps = &InstructionCapabilities[opcode];
+    if ((e->caps & caps->cap) == caps->cap) {
+        emit_encoded(e, opcode, rd, rs1, rs2, imm);
+        return;
+    }
+    if (caps->expansion == NULL) {
+        fprintf(stderr, "Instruction %s needs the %s capability, which the target doesn't have (line %d)\n",
+                Instructions[opcode].name, capability_name(caps->cap), line);
+        exit(EXIT_FAILURE);
+    }
+
+    // steps jumping past the end need to know where that is, a dry run finds
+    // out. those jumps are short whatever the end is so the size comes out the
+    // same either way
+    uint32_t start = e->pc;
+    uint32_t end = start;
+    if (e->out) {
+        Emitter dry = *e;
+        dry.out = NULL;
+        emit_lowered(&dry, opcode, rd, rs1, rs2, imm, line);
+        end = dry.pc;
+        printf_DEBUG("Expanding %s (no %s on the target)\n", Instructions[opcode].name, capability_name(caps->cap));
+        e->expanded++;
+    }
+
+    for (int i = 0; i < caps->steps; i++) {
+        const MacroStep* step = &caps->expansion[i];
+        int64_t step_imm = step->imm;
+        if (step->imm_kind == MACRO_IMM)
+            step_imm = imm;
+        else if (step->imm_kind == MACRO_TARGET)
+            step_imm = (int64_t)start + imm - e->pc;
+        else if (step->imm_kind == MACRO_END)
+            step_imm = (int64_t)end - e->pc;
+        if (step->rd == MACRO_TEMP || step->rs1 == MACRO_TEMP || step->rs2 == MACRO_TEMP)
+            e->temp_needed = 1;
+        emit_lowered(e, step->opcode, macro_register(step->rd, rd, rs1, rs2), macro_register(step->rs1, rd, rs1, rs2),
+                     macro_register(step->rs2, rd, rs1, rs2), step_imm, line);
+    }
+}
+
+// the synopsis at the top of this file, for every error about the command line
+static void usage(void) {
+    fprintf(stderr, "Usage: u2asm [--dev] [--sym] [--stats] [--target=full|minimal]\n"
+                    "             [--caps=LIST] asm.u2a bytecode.u2b\n");
+}
+
+// --caps=mov,not,... into a set of capabilities
+static uint32_t parse_caps(char* list) {
+    uint32_t caps = 0;
+    char* copy = strdup(list);
+    for (char* name = strtok(copy, ","); name; name = strtok(NULL, ",")) {
+        Capability cap = capability_from_name(name);
+        if (cap == (Capability)-1) {
+            fprintf(stderr, "Unknown capability '%s'\n", name);
+            exit(EXIT_FAILURE);
+        }
+        caps |= cap;
+    }
+    free(copy);
+    return caps;
 }
 
 // expect_register is responsible for returning a uint32_t from a register
 // name. registers can be named r1-r16 but the actual number of a register is
-// only 0-15. as such registers are just stripped of 'r' and decremented
-uint32_t expect_register(char* reg) {
+// only 0-15. as such registers are just stripped of 'r' and decremented.
+// vector registers v1-v16 work the same with a 'v', kind says which one
+uint32_t expect_register_kind(char* reg, char kind) {
     char* regc = reg;
     if (reg == NULL) {
         fprintf(stderr, "Internal Error: Invalid Register\n");
         exit(EXIT_FAILURE);
     }
-    if (tolower(*regc) != 'r') {
-        fprintf(stderr, "Invalid Register '%s', expected [r1-r16]\n", reg);
+    if (tolower(*regc) != kind) {
+        fprintf(stderr, "Invalid Register '%s', expected [%c1-%c16]\n", reg, kind, kind);
         exit(EXIT_FAILURE);
     }
     regc++;
@@ -101,7 +271,7 @@ uint32_t expect_register(char* reg) {
 
     // atoi fail or invalid reg range
     if (ret > 16 || ret <= 0) {
-        fprintf(stderr, "Invalid Register '%s', expected [r1-r16]\n", reg);
+        fprintf(stderr, "Invalid Register '%s', expected [%c1-%c16]\n", reg, kind, kind);
         exit(EXIT_FAILURE);
     }
     return (uint32_t)ret;
@@ -180,9 +350,10 @@ int get_first_char(char* str, char ch) {
 }
 
 int main(int argc, char** argv) {
-    int DEV_DEBUG = 0;
     char* asmPath = NULL;
     char* bcPath = NULL;
+    int symbols = 0;
+    uint32_t caps = CAP_ALL;
 
     for (int i = 1; i < argc; i++) {
         char* arg = argv[i];
@@ -191,9 +362,19 @@ int main(int argc, char** argv) {
             // flags
             if (strcmp(arg, "--dev") == 0) {
                 DEV_DEBUG = 1;
+            } else if (strcmp(arg, "--sym") == 0) {
+                symbols = 1;
+            } else if (strcmp(arg, "--stats") == 0) {
+                stats.enabled = 1;
+            } else if (strcmp(arg, "--target=full") == 0) {
+                caps = CAP_ALL;
+            } else if (strcmp(arg, "--target=minimal") == 0) {
+                caps = CAP_BASE;
+            } else if (strncmp(arg, "--caps=", 7) == 0) {
+                caps = parse_caps(arg + 7);
             } else {
                 fprintf(stderr, "Unknown flag: %s\n", arg);
-                fprintf(stderr, "Usage: u2asm [flags] assembly.u2a bytecode.u2b\n");
+                usage();
                 exit(EXIT_FAILURE);
             }
         } else {
@@ -204,7 +385,7 @@ int main(int argc, char** argv) {
                 bcPath = arg;
             else {
                 fprintf(stderr, "Too many arguments.\n");
-                fprintf(stderr, "Usage: u2asm [flags] assembly.u2a bytecode.u2b\n");
+                usage();
                 exit(EXIT_FAILURE);
             }
         }
@@ -212,7 +393,7 @@ int main(int argc, char** argv) {
 
     if (asmPath == NULL || bcPath == NULL) {
         fprintf(stderr, "Missing input/output files.\n");
-        fprintf(stderr, "Usage: u2asm [--dev] assembly.u2a bytecode.u2b\n");
+        usage();
         exit(EXIT_FAILURE);
     }
 
@@ -245,8 +426,13 @@ int main(int argc, char** argv) {
      * This system is necessary to resolve forward declared labels
      */
     int pass = 1;
+    uint64_t instructions = 0;
+    int temp_used = 0;  // the program names r16, see MACRO_TEMP_REG
+    Emitter emitter;
 
 asm_pass:
+    stats_phase(pass == 1 ? "pass1" : "pass2");
+    emitter = (Emitter){.out = bcFile, .caps = caps};
     uint32_t pc = 0;
     while ((read = getline(&line, &len, asmFile)) != -1) {
         // remove \n from line
@@ -323,8 +509,10 @@ asm_pass:
 
         // correct format?
         Instruction instruction = Instructions[opcode];
-        if (__builtin_popcount(instruction.format) != opargsc - 1) {
-            error_argnum(__builtin_popcount(instruction.format), opargsc - 1, instruction.name, linec);
+        // only the low 4 bits are operands, the rest say which are vectors
+        int operands = __builtin_popcount(instruction.format & 0b1111);
+        if (operands != opargsc - 1) {
+            error_argnum(operands, opargsc - 1, instruction.name, linec);
         }
 
         uint32_t rd = 0;
@@ -334,74 +522,40 @@ asm_pass:
 
         size_t opargsi = 1;
         if (instruction.format & 0b0001) {
-            rd = expect_register(opargs[opargsi++]);
+            rd = expect_register_kind(opargs[opargsi++], instruction.format & 0b0010000 ? 'v' : 'r');
         }
         if (instruction.format & 0b0010) {
-            rs1 = expect_register(opargs[opargsi++]);
+            rs1 = expect_register_kind(opargs[opargsi++], instruction.format & 0b0100000 ? 'v' : 'r');
         }
         if (instruction.format & 0b0100) {
-            rs2 = expect_register(opargs[opargsi++]);
+            rs2 = expect_register_kind(opargs[opargsi++], instruction.format & 0b1000000 ? 'v' : 'r');
         }
         if (instruction.format & 0b1000) {
             imm = expect_immediate(opargs[opargsi++], labels, pass, pc);
         }
+        temp_used |= (instruction.format & 0b0010001) == 0b0000001 && rd == MACRO_TEMP_REG;
+        temp_used |= (instruction.format & 0b0100010) == 0b0000010 && rs1 == MACRO_TEMP_REG;
+        temp_used |= (instruction.format & 0b1000100) == 0b0000100 && rs2 == MACRO_TEMP_REG;
 
         // generate bytecode, technically we dont have to do this if we are in
         // pass 1 but like.. who cares.. we will just rewind() and overwrite
         // later so like does it even matter? the overhead is more than it's
         // worth
-
-        // do we need to extend immediate?
-        int32_t max_14imm = (1LL << 13) - 1;
-        int32_t min_14imm = -(1LL << 13);
-        int imm_size = 0;  // 0 = 14b, 1 = 32b, 2 = 64b
-        if (imm <= max_14imm && imm >= min_14imm) {
-            imm_size = 0;
-        } else if (imm <= INT32_MAX && imm >= INT32_MIN) {
-            imm_size = 1;
-        } else {
-            imm_size = 2;
-        }
-        rs2 = imm_size;  // imm size is safe to store in rs2 because no
-                         // instruction uses both imm and rs2 that would require
-                         // imm extension, for more info see InstructionFormat
-                         // at common/instruction.h
-
-        uint32_t instBC = 0;
-        set_op(&instBC, opcode);
-        set_rd(&instBC, rd);
-        set_rs1(&instBC, rs1);
-        set_rs2(&instBC, rs2);
-        set_imm(&instBC, imm & 0x3FFF);
-
-        // check for long immediates
-        if (imm_size) {
-            set_imm(&instBC, 0);  // set immediate to 0 for clarity (extended
-                                  // imm means imm will not be read from this
-                                  // instruction)
-            // check imm extension is supported
-            if (instruction.format & 0b0100 || !(instruction.format & 0b1000)) {
-                printf("Invalid Immediate extension format!\n");
-                exit(EXIT_FAILURE);
-            }
-            printf_DEBUG("Instruction: %X (%dbit ext)\n", instBC, 32 * imm_size);
-            emit_inst(instBC, bcFile, &pc);
-            int32_t imm_ext = (int32_t)(imm & 0xFFFFFFFF);
-            printf_DEBUG("Imm extension: %X\n", imm_ext);
-            emit_inst((uint32_t)imm_ext, bcFile, &pc);
-            if (imm_size == 2) {
-                imm_ext = (int32_t)((imm >> 32) & 0xFFFFFFFF);
-                printf_DEBUG("Imm extension: %X\n", imm_ext);
-                emit_inst((uint32_t)imm_ext, bcFile, &pc);  // 64bit extension
-            }
-        } else {
-            printf_DEBUG("Instruction: %X\n", instBC);
-            emit_inst(instBC, bcFile, &pc);
-        }
+        emitter.pc = pc;
+        emit_lowered(&emitter, opcode, rd, rs1, rs2, imm, linec);
+        pc = emitter.pc;
 
         // cleanup
         free(opargs_base);
         linec++;
+        instructions += pass == 2;
+    }
+
+    // an expansion would clobber a register the program uses
+    if (pass == 1 && emitter.temp_needed && temp_used) {
+        fprintf(stderr, "r%d is the scratch register of expansions the target needs, the program can't use it\n",
+                MACRO_TEMP_REG);
+        exit(EXIT_FAILURE);
     }
 
     // second pass
@@ -413,7 +567,29 @@ asm_pass:
         goto asm_pass;
     }
 
+    stats_done();
+    stats_count("instructions", instructions);
+    stats_count("words", pc);
+    stats_count("labels", labels->count);
+    stats_count("expanded", emitter.expanded);
+
+    // label sidecar, same pcs the vm counts block leaders in
+    if (symbols) {
+        char* symPath = malloc(strlen(bcPath) + 5);
+        sprintf(symPath, "%s.sym", bcPath);
+        FILE* symFile = fopen(symPath, "w");
+        if (symFile == NULL) {
+            fprintf(stderr, "Error opening file '%s': %s\n", symPath, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < labels->count; i++)
+            fprintf(symFile, "%u %s\n", labels->labels[i].pc, labels->labels[i].name);
+        fclose(symFile);
+        free(symPath);
+    }
+
     free(line);
     fclose(asmFile);
     fclose(bcFile);
+    stats_print("u2asm", stderr);
 }
@@ -1,3 +1,9 @@
 #define OPCODE_BITS 6
 #define REG_BITS 4
 #define IMM_BITS 14
+
+// register holding the program result once execution falls off the end
+#define RETURN_REG 1
+
+// vector registers v1-v16 each hold this many 32 bit lanes
+#define VECTOR_LANES 8
@@ -1,12 +1,13 @@
 #include "instruction.h"
+#include <stddef.h>
+#include <string.h>
 
 Instruction Instructions[] = {
     // DATA
     [U2_MOV] = {0b0011, "mov"},  // copy rs1 to rd
     [U2_LI] = {0b1001, "li"},    // load immediate to rd
-    [U2_LD] = {0b1011, "ld"},    // load memory to rd
-                                 // TODO: how tf is memory going to work???
-    [U2_ST] = {0b1110, "st"},    // store to memory from rs1
+    [U2_LD] = {0b1011, "ld"},    // load memory at rs1 + imm to rd
+    [U2_ST] = {0b1110, "st"},    // store rs1 to memory at rs2 + imm
 
     // ARITHMETIC
     [U2_ADD] = {0b0111, "add"},  // add rs1 and rs2 and store in rd
@@ -36,11 +37,110 @@ Instruction Instructions[] = {
     [U2_JL] = {0b1000, "jl"},    // jump if less than
     [U2_JG] = {0b1000, "jg"},    // jump if greater than
 
+    // VECTOR, VECTOR_LANES 32 bit lanes at a time
+    [U2_VLD] = {0b0011011, "vld"},        // load memory at rs1 + imm to vector rd
+    [U2_VST] = {0b0101110, "vst"},        // store vector rs1 to memory at rs2 + imm
+    [U2_VADD] = {0b1110111, "vadd"},      // add lanes of rs1 and rs2 and store in rd
+    [U2_VSUB] = {0b1110111, "vsub"},      // subtract lanes of rs1 and rs2 and store in rd
+    [U2_VMUL] = {0b1110111, "vmul"},      // multiply lanes of rs1 and rs2 and store in rd
+    [U2_VAND] = {0b1110111, "vand"},      // and rs1 and rs2 and store in rd
+    [U2_VOR] = {0b1110111, "vor"},        // or rs1 and rs2 and store in rd
+    [U2_VXOR] = {0b1110111, "vxor"},      // xor rs1 and rs2 and store in rd
+    [U2_VCMPEQ] = {0b1110111, "vcmpeq"},  // lanes of rd all ones where rs1 == rs2, 0 elsewhere
+    [U2_VCMPGT] = {0b1110111, "vcmpgt"},  // lanes of rd all ones where rs1 > rs2 (signed), 0 elsewhere
+
     // TODO: is stack built into vm?
 };
 
 const int Instruction_Count = sizeof(Instructions) / sizeof(Instructions[0]);
 
+/**
+    Expansions
+
+    Each is a handful of instructions that does
+    what the expanded instruction does on a target
+    without its capability. Steps may use other
+    instructions that aren't base, those get
+    expanded again for the same target, so jg
+    turns into jl and jne and then, if jne isn't
+    there either, into jl, je and jmp. Everything
+    bottoms out in base instructions.
+
+    None of them touch the comparison state, jumps
+    only read it. not needs a scratch register.
+*/
+
+// or of a register with itself is the register
+static const MacroStep expand_mov[] = {
+    {U2_OR, MACRO_RD, MACRO_RS1, MACRO_RS1, MACRO_LITERAL, 0},
+};
+
+// xor with all ones
+static const MacroStep expand_not[] = {
+    {U2_LI, MACRO_TEMP, MACRO_NONE, MACRO_NONE, MACRO_LITERAL, -1},
+    {U2_XOR, MACRO_RD, MACRO_RS1, MACRO_TEMP, MACRO_LITERAL, 0},
+};
+
+// skip the jump when equal
+static const MacroStep expand_jne[] = {
+    {U2_JE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_END, 0},
+    {U2_JMP, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_TARGET, 0},
+};
+
+// not less, then greater unless equal
+static const MacroStep expand_jg[] = {
+    {U2_JL, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_END, 0},
+    {U2_JNE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_TARGET, 0},
+};
+
+#define EXPANSION(cap, steps) {cap, steps, sizeof(steps) / sizeof(steps[0])}
+
+// indexed like Instructions, anything not listed is base
+InstructionCaps InstructionCapabilities[sizeof(Instructions) / sizeof(Instructions[0])] = {
+    [U2_MOV] = EXPANSION(CAP_MOV, expand_mov),
+    [U2_NOT] = EXPANSION(CAP_NOT, expand_not),
+    [U2_JNE] = EXPANSION(CAP_BRANCH, expand_jne),
+    [U2_JG] = EXPANSION(CAP_BRANCH, expand_jg),
+    [U2_VLD] = {CAP_VECTOR, NULL, 0},
+    [U2_VST] = {CAP_VECTOR, NULL, 0},
+    [U2_VADD] = {CAP_VECTOR, NULL, 0},
+    [U2_VSUB] = {CAP_VECTOR, NULL, 0},
+    [U2_VMUL] = {CAP_VECTOR, NULL, 0},
+    [U2_VAND] = {CAP_VECTOR, NULL, 0},
+    [U2_VOR] = {CAP_VECTOR, NULL, 0},
+    [U2_VXOR] = {CAP_VECTOR, NULL, 0},
+    [U2_VCMPEQ] = {CAP_VECTOR, NULL, 0},
+    [U2_VCMPGT] = {CAP_VECTOR, NULL, 0},
+};
+
+#undef EXPANSION
+
+static struct {
+    Capability cap;
+    char* name;
+} capability_names[] = {
+    {CAP_BASE, "base"}, {CAP_MOV, "mov"}, {CAP_NOT, "not"}, {CAP_BRANCH, "branch"}, {CAP_VECTOR, "vector"},
+};
+
+#define CAPABILITY_NAMES (sizeof(capability_names) / sizeof(capability_names[0]))
+
+char* capability_name(Capability cap) {
+    for (size_t i = 0; i < CAPABILITY_NAMES; i++) {
+        if (capability_names[i].cap == cap)
+            return capability_names[i].name;
+    }
+    return "unknown";
+}
+
+// -1 if there's no such capability
+Capability capability_from_name(const char* name) {
+    for (size_t i = 0; i < CAPABILITY_NAMES; i++) {
+        if (strcmp(capability_names[i].name, name) == 0)
+            return capability_names[i].cap;
+    }
+    return (Capability)-1;
+}
+
 char* instruction_from_id(int id) {
     if (id >= Instruction_Count)
         return "Unknown";
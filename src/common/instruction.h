@@ -18,6 +18,10 @@
  * bit 2 -> rs2: will the instruction require a second register argument?
  *
  * bit 3 -> immediate: will the instruction require a constant value?
+ *
+ * bits 4-6 say which of rd, rs1 and rs2 (in that order) name a vector register
+ * v1-v16 instead of a general purpose one. they don't add operands, only bits
+ * 0-3 count towards those
  */
 typedef uint8_t InstructionFormat;
 
@@ -33,6 +37,7 @@ typedef struct {
     uint32_t rs2;
     uint32_t imm_ext;
     uint64_t imm;
+    uint64_t pc;  // offset in 32bit words, immediate extensions take up words too
     Instruction obj;
 } ParsedInstruction;
 
@@ -57,10 +62,76 @@ typedef enum {
     U2_JNE,
     U2_JL,
     U2_JG,
+    U2_VLD,
+    U2_VST,
+    U2_VADD,
+    U2_VSUB,
+    U2_VMUL,
+    U2_VAND,
+    U2_VOR,
+    U2_VXOR,
+    U2_VCMPEQ,
+    U2_VCMPGT,
 } Opcode;
 
+/**
+ * Capabilities
+ *
+ * An implementation has to provide the base instructions, everything else
+ * belongs to a capability it may or may not have. InstructionCapabilities says
+ * which one for every opcode, along with how to do the same thing with
+ * instructions that need less (an expansion) when there is a way.
+ */
+typedef enum {
+    CAP_BASE = 0,
+    CAP_MOV = 1 << 0,     // mov
+    CAP_NOT = 1 << 1,     // not
+    CAP_BRANCH = 1 << 2,  // jne and jg, everything else branches on je and jl
+    CAP_VECTOR = 1 << 3,  // vector registers and instructions, no expansion
+} Capability;
+
+#define CAP_ALL (CAP_MOV | CAP_NOT | CAP_BRANCH | CAP_VECTOR)
+
+// where a register of an expansion step comes from
+typedef enum {
+    MACRO_NONE,
+    MACRO_RD,  // the expanded instruction's own operands
+    MACRO_RS1,
+    MACRO_RS2,
+    MACRO_TEMP,  // MACRO_TEMP_REG, which the program can't use then
+} MacroRegister;
+
+// where the immediate of an expansion step comes from
+typedef enum {
+    MACRO_LITERAL,  // imm of the step as written
+    MACRO_IMM,      // the expanded instruction's imm
+    MACRO_TARGET,   // the expanded jump's target, relative to the step
+    MACRO_END,      // just past the whole expansion, relative to the step
+} MacroImmediate;
+
+// expansions that need a scratch register get r16, like $at on mips
+#define MACRO_TEMP_REG 16
+
+typedef struct {
+    uint32_t opcode;
+    MacroRegister rd;
+    MacroRegister rs1;
+    MacroRegister rs2;
+    MacroImmediate imm_kind;
+    int64_t imm;
+} MacroStep;
+
+typedef struct {
+    Capability cap;
+    const MacroStep* expansion;  // NULL if a target without cap can't have it
+    int steps;
+} InstructionCaps;
+
 extern Instruction Instructions[];
 extern const int Instruction_Count;
+extern InstructionCaps InstructionCapabilities[];
 char* instruction_from_id(int id);
+char* capability_name(Capability cap);
+Capability capability_from_name(const char* name);
 
 #endif
@@ -0,0 +1,196 @@
+#include "stats.h"
+#include <errno.h>
+#include <malloc.h>  // malloc_usable_size
+#include <string.h>
+#include <time.h>
+
+/**
+    Phase stats
+
+    Output is one JSON object, a phase per line
+    like the block counts so it greps as well as
+    it parses:
+
+        {
+          "tool": "u2vm",
+          "peak_bytes": 1941504,
+          "phases": [
+            {"name": "decode", "ns": 41250, "peak_bytes": 9216},
+            ...
+          ],
+          "counts": {
+            "instructions": 20016,
+            ...
+          }
+        }
+
+    Phases show up in the order they ran, a tool
+    that exits early just has fewer of them.
+
+    Heap bytes are what malloc_usable_size says,
+    slack included, since that's what the process
+    really holds. The wrappers below replace the
+    libc ones for the whole process and hand the
+    work to glibc's own __libc_ versions, so
+    getline and strdup are counted along with
+    everything else. That has to be every way
+    into the heap, the aligned ones and
+    reallocarray included: whatever they hand out
+    comes back through free, which would subtract
+    blocks that were never added and let the
+    numbers drift. The jit threads allocate too,
+    hence the atomics. mmap'd memory (code arena,
+    vm memory) isn't heap and isn't counted, x86
+    bytes are a count of their own.
+*/
+
+Stats stats;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+extern void* __libc_pvalloc(size_t size);
+
+static void stats_heap(int64_t bytes) {
+    int64_t heap = __atomic_add_fetch(&stats.heap, bytes, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&stats.heap_peak, __ATOMIC_RELAXED);
+    while (heap > peak && !__atomic_compare_exchange_n(&stats.heap_peak, &peak, heap, 1, __ATOMIC_RELAXED,
+                                                       __ATOMIC_RELAXED))
+        ;
+    peak = __atomic_load_n(&stats.heap_max, __ATOMIC_RELAXED);
+    while (heap > peak &&
+           !__atomic_compare_exchange_n(&stats.heap_max, &peak, heap, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// a block that was just handed out
+static void* stats_allocated(void* ptr) {
+    if (stats.enabled && ptr)
+        stats_heap(malloc_usable_size(ptr));
+    return ptr;
+}
+
+void* malloc(size_t size) {
+    return stats_allocated(__libc_malloc(size));
+}
+
+void* calloc(size_t count, size_t size) {
+    return stats_allocated(__libc_calloc(count, size));
+}
+
+void* memalign(size_t alignment, size_t size) {
+    return stats_allocated(__libc_memalign(alignment, size));
+}
+
+void* valloc(size_t size) {
+    return stats_allocated(__libc_valloc(size));
+}
+
+void* pvalloc(size_t size) {
+    return stats_allocated(__libc_pvalloc(size));
+}
+
+// the checks glibc makes before it gets to memalign
+void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1)) || alignment == 0)
+        return EINVAL;
+    void* ptr = memalign(alignment, size);
+    if (ptr == NULL)
+        return ENOMEM;
+    *out = ptr;
+    return 0;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (!stats.enabled)
+        return __libc_realloc(ptr, size);
+    int64_t old = ptr ? malloc_usable_size(ptr) : 0;
+    void* moved = __libc_realloc(ptr, size);
+    // a failed realloc leaves the old block alone
+    if (moved || size == 0)
+        stats_heap((moved ? (int64_t)malloc_usable_size(moved) : 0) - old);
+    return moved;
+}
+
+void* reallocarray(void* ptr, size_t count, size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(count, size, &bytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, bytes);
+}
+
+void free(void* ptr) {
+    if (stats.enabled && ptr)
+        stats_heap(-(int64_t)malloc_usable_size(ptr));
+    __libc_free(ptr);
+}
+
+static uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ends whatever phase is running and starts name
+void stats_phase(const char* name) {
+    if (!stats.enabled)
+        return;
+    stats_done();
+    if (stats.phase_count == STATS_MAX_PHASES)
+        return;
+    stats.phases[stats.phase_count++] = (StatsPhase){.name = name};
+    stats.heap_phase_base = stats.heap_peak = stats.heap;
+    stats.phase_start = stats_now();
+}
+
+void stats_done(void) {
+    if (!stats.enabled || !stats.phase_start)
+        return;
+    StatsPhase* phase = &stats.phases[stats.phase_count - 1];
+    phase->ns = stats_now() - stats.phase_start;
+    phase->peak_bytes = stats.heap_peak - stats.heap_phase_base;
+    stats.phase_start = 0;
+}
+
+// a count that's already there is replaced
+void stats_count(const char* name, uint64_t value) {
+    if (!stats.enabled)
+        return;
+    size_t i = 0;
+    while (i < stats.count_count && strcmp(stats.counts[i].name, name) != 0)
+        i++;
+    if (i == STATS_MAX_COUNTS)
+        return;
+    if (i == stats.count_count)
+        stats.count_count++;
+    stats.counts[i] = (StatsCount){.name = name, .value = value};
+}
+
+void stats_print(const char* tool, FILE* out) {
+    if (!stats.enabled)
+        return;
+    stats_done();
+    fprintf(out, "{\n  \"tool\": \"%s\",\n  \"peak_bytes\": %ld,\n  \"phases\": [", tool, stats.heap_max);
+    for (size_t i = 0; i < stats.phase_count; i++) {
+        StatsPhase* phase = &stats.phases[i];
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"ns\": %lu, \"peak_bytes\": %ld}", i ? "," : "", phase->name,
+                phase->ns, phase->peak_bytes);
+    }
+    fprintf(out, "\n  ],\n  \"counts\": {");
+    for (size_t i = 0; i < stats.count_count; i++)
+        fprintf(out, "%s\n    \"%s\": %lu", i ? "," : "", stats.counts[i].name, stats.counts[i].value);
+    fprintf(out, "\n  }\n}\n");
+}
@@ -0,0 +1,56 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * stats.h
+ *
+ * --stats: wall time and peak heap per phase plus a few counts, printed as
+ * JSON on stderr at exit. A phase runs from one stats_phase() call to the
+ * next (or to stats_done()), so timing a tool is a call between each step of
+ * its main. The heap is every malloc in the process, libc's own included,
+ * tracked by wrapping malloc and friends in stats.c. Everything, the wrappers
+ * too, costs one branch unless stats.enabled is set.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define STATS_MAX_PHASES 16
+#define STATS_MAX_COUNTS 16
+
+typedef struct {
+    const char* name;
+    uint64_t ns;
+    int64_t peak_bytes;  // most the heap grew past where it was at the start
+} StatsPhase;
+
+typedef struct {
+    const char* name;
+    uint64_t value;
+} StatsCount;
+
+typedef struct {
+    int enabled;
+    StatsPhase phases[STATS_MAX_PHASES];
+    size_t phase_count;
+    uint64_t phase_start;  // of the last phase, 0 when none is running
+    StatsCount counts[STATS_MAX_COUNTS];
+    size_t count_count;
+
+    // bytes, can go negative when something allocated before --stats was
+    // seen is freed
+    int64_t heap;
+    int64_t heap_peak;        // since the last phase started
+    int64_t heap_phase_base;  // heap when it did
+    int64_t heap_max;         // over the whole run
+} Stats;
+
+extern Stats stats;
+
+void stats_phase(const char* name);
+void stats_done(void);
+void stats_count(const char* name, uint64_t value);
+void stats_print(const char* tool, FILE* out);
+
+#endif
@@ -1,6 +1,7 @@
 " ~/.vim/syntax/u2a.vim
 
 syntax keyword u2aInstruction mov li ld st add sub mul div and or xor not shl shr cmp jmp je jne jl jg
+syntax keyword u2aInstruction vld vst vadd vsub vmul vand vor vxor vcmpeq vcmpgt
 
 syntax match u2aNumber /\<\d\+\>/
 syntax match u2aHex /0x[0-9A-Fa-f]\+/
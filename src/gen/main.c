@@ -0,0 +1,289 @@
+#include "../common/config.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+
+/**
+    U2 PROGRAM GENERATOR
+
+    Writes a random but valid u2 assembly program
+    of about the requested size, the same one every
+    time for the same flags. Made for finding out
+    how the assembler and vm scale, not for finding
+    bugs in them.
+
+    Usage = u2gen [--seed=N] [--size=N] [--branches=PCT] [--depth=N]
+                  [--labels=PCT] [--imm=14|32|64] [--regs=N] out.u2a
+
+    --size       instructions, 10000 by default
+    --branches   percent of instructions that start a forward
+                 cmp/jcc over the next few, 10 by default
+    --depth      most loops nested inside each other, 2 by default
+    --labels     percent of instructions with a label of their own
+                 nothing jumps to, for the label table, 0 by default
+    --imm        widest li immediate, 14 by default
+    --regs       data registers to spread the work over, 8 by
+                 default and at most 14 - depth
+
+    Every program terminates:
+    - the only backward jumps are loop latches, each on a
+      counter of its own nesting depth set to 2 just before
+      the loop, so the run is at most size * 2^depth
+    - forward branches land inside the sequence they start
+      in, never past the end of a loop body or into another
+      loop
+    - there's no div and ld/st only go through the zero
+      register with offsets under 8k, so nothing traps
+
+    Loop bodies are kept under 1000 instructions so every
+    jump fits in a 14 bit immediate, the assembler sizes
+    label references before it knows where labels are.
+*/
+
+// reserved registers, loop counters count down from LOOP_REG_BASE
+#define ONE_REG 16
+#define ZERO_REG 15
+#define LOOP_REG_BASE 14
+
+#define MAX_DEPTH 8
+#define MAX_LOOP_BODY 1000
+#define MAX_BRANCH_SKIP 8
+#define MAX_PENDING 64
+
+typedef struct {
+    uint64_t size;
+    int branches;
+    int depth;
+    int labels;
+    int imm;
+    int regs;
+} GenOptions;
+
+typedef struct {
+    FILE* out;
+    GenOptions options;
+    uint64_t rng;
+    uint64_t emitted;  // instructions so far
+    uint64_t next_label;
+} Gen;
+
+// xorshift64*, deterministic across platforms unlike rand()
+uint64_t next_random(Gen* gen) {
+    gen->rng ^= gen->rng >> 12;
+    gen->rng ^= gen->rng << 25;
+    gen->rng ^= gen->rng >> 27;
+    return gen->rng * 0x2545F4914F6CDD1Dull;
+}
+
+// in [0, n)
+uint64_t below(Gen* gen, uint64_t n) {
+    return next_random(gen) % n;
+}
+
+int chance(Gen* gen, int percent) {
+    return (int)below(gen, 100) < percent;
+}
+
+int data_reg(Gen* gen) {
+    return 1 + below(gen, gen->options.regs);
+}
+
+void emit_li(Gen* gen) {
+    int64_t imm;
+    int widths = gen->options.imm == 64 ? 3 : gen->options.imm == 32 ? 2 : 1;
+    switch (below(gen, widths)) {
+    case 0:
+        imm = (int64_t)below(gen, 1 << 14) - (1 << 13);
+        break;
+    case 1:
+        imm = (int32_t)next_random(gen);
+        break;
+    default:
+        // INT64_MIN has no positive half for the assembler to negate
+        imm = (int64_t)(next_random(gen) >> 1) * (below(gen, 2) ? -1 : 1);
+        break;
+    }
+    fprintf(gen->out, "li r%d %" PRId64 "\n", data_reg(gen), imm);
+    gen->emitted++;
+}
+
+// anything that falls through, the bulk of every program
+void emit_straight(Gen* gen) {
+    static const char* alu[] = {"add", "sub", "mul", "and", "or", "xor"};
+    uint64_t pick = below(gen, 16);
+    if (pick < 9) {
+        fprintf(gen->out, "%s r%d r%d r%d\n", alu[pick % 6], data_reg(gen), data_reg(gen), data_reg(gen));
+    } else if (pick < 11) {
+        emit_li(gen);
+        return;
+    } else if (pick == 11) {
+        fprintf(gen->out, "mov r%d r%d\n", data_reg(gen), data_reg(gen));
+    } else if (pick == 12) {
+        fprintf(gen->out, "not r%d r%d\n", data_reg(gen), data_reg(gen));
+    } else if (pick == 13) {
+        fprintf(gen->out, "%s r%d r%d %d\n", below(gen, 2) ? "shl" : "shr", data_reg(gen), data_reg(gen),
+                (int)below(gen, 63) + 1);
+    } else if (pick == 14) {
+        fprintf(gen->out, "ld r%d r%d %d\n", data_reg(gen), ZERO_REG, (int)below(gen, 1024) * 8);
+    } else {
+        fprintf(gen->out, "st r%d r%d %d\n", data_reg(gen), ZERO_REG, (int)below(gen, 1024) * 8);
+    }
+    gen->emitted++;
+}
+
+void emit_label(Gen* gen, uint64_t label) {
+    fprintf(gen->out, "L%" PRIu64 ":\n", label);
+}
+
+/*
+ * A sequence is the top level or one loop body. Forward branches count down
+ * in instructions of this sequence until their label goes down, nested loops
+ * only start when none are waiting so no branch can jump into one.
+ */
+void gen_sequence(Gen* gen, uint64_t budget, int depth) {
+    static const char* jcc[] = {"je", "jne", "jl", "jg"};
+    uint64_t pending_label[MAX_PENDING];
+    int pending_left[MAX_PENDING];
+    int pending = 0;
+    uint64_t end = gen->emitted + budget;
+
+    while (gen->emitted < end) {
+        // labels whose branch has skipped enough go down before this one
+        for (int i = 0; i < pending;) {
+            if (pending_left[i]-- == 0) {
+                emit_label(gen, pending_label[i]);
+                pending_label[i] = pending_label[--pending];
+                pending_left[i] = pending_left[pending];
+            } else {
+                i++;
+            }
+        }
+        if (chance(gen, gen->options.labels))
+            emit_label(gen, gen->next_label++);
+
+        uint64_t left = end - gen->emitted;
+        if (pending == 0 && depth < gen->options.depth && left > 16 && below(gen, 64) == 0) {
+            // a counted loop, its body is a sequence of its own
+            int counter = LOOP_REG_BASE - depth;
+            uint64_t body = 8 + below(gen, (left < MAX_LOOP_BODY ? left : MAX_LOOP_BODY) - 8);
+            uint64_t header = gen->next_label++;
+            fprintf(gen->out, "li r%d 2\n", counter);
+            emit_label(gen, header);
+            gen->emitted++;
+            gen_sequence(gen, body, depth + 1);
+            fprintf(gen->out, "sub r%d r%d r%d\ncmp r%d r%d\njg L%" PRIu64 "\n", counter, counter, ONE_REG, counter,
+                    ZERO_REG, header);
+            gen->emitted += 3;
+        } else if (pending < MAX_PENDING && chance(gen, gen->options.branches)) {
+            pending_label[pending] = gen->next_label++;
+            pending_left[pending] = 1 + below(gen, MAX_BRANCH_SKIP);
+            fprintf(gen->out, "cmp r%d r%d\n%s L%" PRIu64 "\n", data_reg(gen), data_reg(gen), jcc[below(gen, 4)],
+                    pending_label[pending]);
+            pending++;
+            gen->emitted += 2;
+        } else {
+            emit_straight(gen);
+        }
+    }
+
+    // whatever is still waiting lands at the end of the sequence
+    for (int i = 0; i < pending; i++)
+        emit_label(gen, pending_label[i]);
+}
+
+// a number with nothing after it, or exit
+uint64_t parse_number(char* str) {
+    char* end;
+    errno = 0;
+    uint64_t n = strtoull(str, &end, 0);
+    if (*str == '\0' || *end != '\0' || errno) {
+        fprintf(stderr, "Bad number: %s\n", str);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+int main(int argc, char** argv) {
+    char* outPath = NULL;
+    uint64_t seed = 1;
+    GenOptions options = {.size = 10000, .branches = 10, .depth = 2, .labels = 0, .imm = 14, .regs = 8};
+
+    for (int i = 1; i < argc; i++) {
+        char* arg = argv[i];
+
+        if (arg[0] == '-') {
+            // flags
+            if (strncmp(arg, "--seed=", 7) == 0) {
+                seed = parse_number(arg + 7);
+            } else if (strncmp(arg, "--size=", 7) == 0) {
+                options.size = parse_number(arg + 7);
+            } else if (strncmp(arg, "--branches=", 11) == 0) {
+                options.branches = parse_number(arg + 11);
+            } else if (strncmp(arg, "--depth=", 8) == 0) {
+                options.depth = parse_number(arg + 8);
+            } else if (strncmp(arg, "--labels=", 9) == 0) {
+                options.labels = parse_number(arg + 9);
+            } else if (strncmp(arg, "--imm=", 6) == 0) {
+                options.imm = parse_number(arg + 6);
+            } else if (strncmp(arg, "--regs=", 7) == 0) {
+                options.regs = parse_number(arg + 7);
+            } else {
+                fprintf(stderr, "Unknown flag: %s\n", arg);
+                fprintf(stderr, "Usage: u2gen [flags] out.u2a\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            // file
+            if (outPath == NULL) {
+                outPath = arg;
+            } else {
+                fprintf(stderr, "Too many arguments.\n");
+                fprintf(stderr, "Usage: u2gen [flags] out.u2a\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if (outPath == NULL) {
+        fprintf(stderr, "Missing output file.\n");
+        fprintf(stderr, "Usage: u2gen [flags] out.u2a\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.depth > MAX_DEPTH || options.regs < 1 || options.regs > LOOP_REG_BASE - options.depth) {
+        fprintf(stderr, "--depth is at most %d and --regs 1 to 14 - depth\n", MAX_DEPTH);
+        exit(EXIT_FAILURE);
+    }
+    if (options.imm != 14 && options.imm != 32 && options.imm != 64) {
+        fprintf(stderr, "--imm is 14, 32 or 64\n");
+        exit(EXIT_FAILURE);
+    }
+    if (options.branches > 100 || options.labels > 100) {
+        fprintf(stderr, "--branches and --labels are percentages\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* out = fopen(outPath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", outPath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // a zero state would stay zero forever
+    Gen gen = {.out = out, .options = options, .rng = seed * 0x9E3779B97F4A7C15ull | 1};
+    fprintf(out, "; u2gen --seed=%" PRIu64 " --size=%" PRIu64, seed, options.size);
+    fprintf(out, " --branches=%d --depth=%d --labels=%d --imm=%d --regs=%d\n", options.branches, options.depth,
+            options.labels, options.imm, options.regs);
+    fprintf(out, "li r%d 1\nli r%d 0\n", ONE_REG, ZERO_REG);
+    gen.emitted = 2;
+    gen_sequence(&gen, options.size > 2 ? options.size - 2 : 0, 0);
+
+    if (fclose(out)) {
+        fprintf(stderr, "Error writing '%s': %s\n", outPath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include "aot.h"
+#include "memory.h"
+#include "x86encoding.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+    Ahead of time output
+
+    Code out of jit_program doesn't depend on where
+    it lives: branches are rel32/rel8 inside the
+    program, memory comes in as an argument and the
+    only absolute thing about it is the alignment
+    padding, which was worked out against the page
+    aligned arena base. So the arena bytes go into
+    the file as they are, in a section aligned at
+    least as strictly as the blocks in it.
+
+    The executable is a single R+X segment holding
+    the program and a stub after it, no libc and no
+    dynamic linker, startup is the kernel mapping
+    the file. The stub makes the same reservation
+    memory_create does with raw syscalls, calls the
+    program and writes r1 as hex to stdout. A trap
+    kills the process with the signal instead of
+    printing a u2 trap message, there is no handler
+    to catch it.
+*/
+
+#define SYS_WRITE 1
+#define SYS_MMAP 9
+#define SYS_MPROTECT 10
+#define SYS_EXIT_GROUP 231
+
+static size_t round_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void emit_syscall(uint8_t** jit_memory, uint32_t number) {
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RAX, 0, number);
+    emit_x86instruction(jit_memory, &__syscall, 0, 0, 0);
+}
+
+// entry point of the executable, lands right after the program
+static uint8_t* emit_stub(uint8_t** jit_memory, uint8_t* program, size_t memory_size) {
+    uint8_t* stub = *jit_memory;
+
+    // reservation = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+    emit_x86instruction(jit_memory, &__xor_rm32_r32, _x86_RDI, _x86_RDI, 0);
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RSI, 0, MEMORY_GUARD_BELOW + MEMORY_GUARD_ABOVE);
+    emit_x86instruction(jit_memory, &__xor_rm32_r32, _x86_RDX, _x86_RDX, 0);
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_R10, 0, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_R8, 0, (uint64_t)-1);
+    emit_x86instruction(jit_memory, &__xor_rm32_r32, _x86_R9, _x86_R9, 0);
+    emit_syscall(jit_memory, SYS_MMAP);
+
+    // base = reservation + MEMORY_GUARD_BELOW, opened up for the first memory_size bytes
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RBX, 0, MEMORY_GUARD_BELOW);
+    emit_x86instruction(jit_memory, &__add_rm64_r64, _x86_RAX, _x86_RBX, 0);
+    if (memory_size) {
+        emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RBX, _x86_RDI, 0);
+        emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RSI, 0, memory_size);
+        emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RDX, 0, PROT_READ | PROT_WRITE);
+        emit_syscall(jit_memory, SYS_MPROTECT);
+    }
+
+    // rsp is 16 byte aligned at _start, the call leaves it like any other call would
+    emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RBX, _x86_RDI, 0);
+    emit_x86instruction(jit_memory, &__call_rel32, 0, 0, program - (*jit_memory + 5));
+
+    // r1 as hex digits, built backwards below rsp
+    emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RAX, _x86_RDX, 0);
+    emit_x86instruction_mem(jit_memory, &__lea_r64_m, _x86_RDI, _x86_RSP, -1, 0);
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RAX, 0, '\n');
+    emit_x86instruction_mem(jit_memory, &__mov_rm8_r8, _x86_RAX, _x86_RDI, 0, 0);
+
+    uint8_t* digit = *jit_memory;
+    emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RDX, _x86_RAX, 0);
+    emit_x86instruction(jit_memory, &__and_rm64_imm8, 0, _x86_RAX, 15);
+    emit_x86instruction(jit_memory, &__cmp_rm64_imm8, 0, _x86_RAX, 10);
+    emit_x86instruction(jit_memory, &__jl_rel8, 0, 0, 0);
+    uint8_t* decimal = *jit_memory;
+    emit_x86instruction(jit_memory, &__add_rm64_imm8, 0, _x86_RAX, 'A' - '0' - 10);
+    decimal[-1] = *jit_memory - decimal;
+    emit_x86instruction(jit_memory, &__add_rm64_imm8, 0, _x86_RAX, '0');
+    emit_x86instruction(jit_memory, &__sub_rm64_imm8, 0, _x86_RDI, 1);
+    emit_x86instruction_mem(jit_memory, &__mov_rm8_r8, _x86_RAX, _x86_RDI, 0, 0);
+    emit_x86instruction(jit_memory, &__shr_rm64_imm8, 0, _x86_RDX, 4);
+    emit_x86instruction(jit_memory, &__cmp_rm64_imm8, 0, _x86_RDX, 0);
+    emit_x86instruction(jit_memory, &__jne_rel8, 0, 0, digit - (*jit_memory + 2));
+
+    // write(1, digits, rsp - digits)
+    emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RDI, _x86_RSI, 0);
+    emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RSP, _x86_RDX, 0);
+    emit_x86instruction(jit_memory, &__sub_rm64_r64, _x86_RDI, _x86_RDX, 0);
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RDI, 0, 1);
+    emit_syscall(jit_memory, SYS_WRITE);
+
+    emit_x86instruction(jit_memory, &__xor_rm32_r32, _x86_RDI, _x86_RDI, 0);
+    emit_syscall(jit_memory, SYS_EXIT_GROUP);
+    return stub;
+}
+
+static void fill_ident(Elf64_Ehdr* header, uint16_t type) {
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header->e_type = type;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+}
+
+// header, two program headers, then the code at an aligned offset
+static uint8_t* build_executable(uint8_t* code, size_t code_size, size_t entry, size_t alignment, size_t* size) {
+    size_t code_offset = round_up(sizeof(Elf64_Ehdr) + 2 * sizeof(Elf64_Phdr), alignment);
+    uint64_t load = round_up(AOT_LOAD_ADDRESS, alignment);
+    *size = code_offset + code_size;
+    uint8_t* file = calloc(1, *size);
+
+    Elf64_Ehdr* header = (Elf64_Ehdr*)file;
+    fill_ident(header, ET_EXEC);
+    header->e_entry = load + code_offset + entry;
+    header->e_phoff = sizeof(Elf64_Ehdr);
+    header->e_phentsize = sizeof(Elf64_Phdr);
+    header->e_phnum = 2;
+
+    Elf64_Phdr* segments = (Elf64_Phdr*)(file + header->e_phoff);
+    segments[0] = (Elf64_Phdr){
+        .p_type = PT_LOAD, .p_flags = PF_R | PF_X, .p_vaddr = load, .p_paddr = load, .p_filesz = *size,
+        .p_memsz = *size, .p_align = 0x1000};
+    segments[1] = (Elf64_Phdr){.p_type = PT_GNU_STACK, .p_flags = PF_R | PF_W, .p_align = 16};
+
+    memcpy(file + code_offset, code, code_size);
+    return file;
+}
+
+enum { OBJ_NULL, OBJ_TEXT, OBJ_SYMTAB, OBJ_STRTAB, OBJ_SHSTRTAB, OBJ_NOTE_STACK, OBJ_SECTIONS };
+
+// .text with the program in it and one global symbol at its start
+static uint8_t* build_object(uint8_t* code, size_t code_size, size_t alignment, size_t* size) {
+    static const char strtab[] = "\0" AOT_SYMBOL;
+    static const char shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+    Elf64_Sym symbols[] = {
+        {0},
+        {.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION), .st_shndx = OBJ_TEXT},
+        {.st_name = 1, .st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC), .st_shndx = OBJ_TEXT, .st_size = code_size},
+    };
+
+    size_t text_offset = round_up(sizeof(Elf64_Ehdr), alignment);
+    size_t symtab_offset = round_up(text_offset + code_size, 8);
+    size_t strtab_offset = symtab_offset + sizeof(symbols);
+    size_t shstrtab_offset = strtab_offset + sizeof(strtab);
+    size_t sections_offset = round_up(shstrtab_offset + sizeof(shstrtab), 8);
+    *size = sections_offset + OBJ_SECTIONS * sizeof(Elf64_Shdr);
+    uint8_t* file = calloc(1, *size);
+
+    Elf64_Ehdr* header = (Elf64_Ehdr*)file;
+    fill_ident(header, ET_REL);
+    header->e_shoff = sections_offset;
+    header->e_shentsize = sizeof(Elf64_Shdr);
+    header->e_shnum = OBJ_SECTIONS;
+    header->e_shstrndx = OBJ_SHSTRTAB;
+
+    memcpy(file + text_offset, code, code_size);
+    memcpy(file + symtab_offset, symbols, sizeof(symbols));
+    memcpy(file + strtab_offset, strtab, sizeof(strtab));
+    memcpy(file + shstrtab_offset, shstrtab, sizeof(shstrtab));
+
+    Elf64_Shdr* sections = (Elf64_Shdr*)(file + sections_offset);
+    sections[OBJ_TEXT] = (Elf64_Shdr){
+        .sh_name = 1, .sh_type = SHT_PROGBITS, .sh_flags = SHF_ALLOC | SHF_EXECINSTR, .sh_offset = text_offset,
+        .sh_size = code_size, .sh_addralign = alignment};
+    sections[OBJ_SYMTAB] = (Elf64_Shdr){
+        .sh_name = 7, .sh_type = SHT_SYMTAB, .sh_offset = symtab_offset, .sh_size = sizeof(symbols),
+        .sh_link = OBJ_STRTAB, .sh_info = 2, .sh_addralign = 8, .sh_entsize = sizeof(Elf64_Sym)};
+    sections[OBJ_STRTAB] = (Elf64_Shdr){
+        .sh_name = 15, .sh_type = SHT_STRTAB, .sh_offset = strtab_offset, .sh_size = sizeof(strtab),
+        .sh_addralign = 1};
+    sections[OBJ_SHSTRTAB] = (Elf64_Shdr){
+        .sh_name = 23, .sh_type = SHT_STRTAB, .sh_offset = shstrtab_offset, .sh_size = sizeof(shstrtab),
+        .sh_addralign = 1};
+    sections[OBJ_NOTE_STACK] = (Elf64_Shdr){
+        .sh_name = 33, .sh_type = SHT_PROGBITS, .sh_offset = sections_offset, .sh_addralign = 1};
+    return file;
+}
+
+// code is what jit_program left in the arena, it has to start on a page
+// boundary. returns 0 or -1 with errno set
+int aot_write(const char* path, AotKind kind, uint8_t** jit_memory, uint8_t* code, size_t alignment,
+              size_t memory_size) {
+    if (alignment < 16)
+        alignment = 16;
+
+    size_t size;
+    uint8_t* file;
+    if (kind == AOT_EXECUTABLE) {
+        uint8_t* stub = emit_stub(jit_memory, code, memory_size);
+        file = build_executable(code, *jit_memory - code, stub - code, alignment, &size);
+    } else {
+        file = build_object(code, *jit_memory - code, alignment, &size);
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, kind == AOT_EXECUTABLE ? 0755 : 0644);
+    ssize_t written = fd < 0 ? -1 : write(fd, file, size);
+    if (fd >= 0)
+        close(fd);
+    free(file);
+    return written == (ssize_t)size ? 0 : -1;
+}
@@ -0,0 +1,33 @@
+#ifndef AOT_H
+#define AOT_H
+
+/*
+ * aot.h
+ *
+ * Writes a program compiled by jit_program out as an ELF file so it can run
+ * without the vm. The object exports the program as
+ *
+ *     uint64_t u2_program(uint8_t* mem);
+ *
+ * mem must sit inside guard pages the way memory.c lays them out. The
+ * executable brings a small runtime stub that sets up that memory, runs the
+ * program and prints r1 in hex.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AOT_SYMBOL "u2_program"
+
+// where the executable gets loaded
+#define AOT_LOAD_ADDRESS 0x400000
+
+typedef enum {
+    AOT_EXECUTABLE,
+    AOT_OBJECT,
+} AotKind;
+
+int aot_write(const char* path, AotKind kind, uint8_t** jit_memory, uint8_t* code, size_t alignment,
+              size_t memory_size);
+
+#endif
@@ -0,0 +1,96 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/**
+    Code arena
+
+    Reserving instead of allocating means we never
+    have to guess how big the output will be up
+    front and never have to relocate code that
+    already has absolute addresses pointing into
+    it. The reservation is PROT_NONE and costs
+    nothing until a chunk is committed.
+
+    With huge pages the reservation is 2MiB aligned
+    and handed to madvise so the kernel can back it
+    with huge pages, large programs then need far
+    fewer iTLB entries.
+*/
+
+CodeArena* arena_create(size_t reserve, int huge_pages) {
+    size_t align = huge_pages ? ARENA_HUGE_CHUNK : ARENA_CHUNK;
+    reserve = (reserve + align - 1) & ~(align - 1);
+
+    // over reserve so the start can be rounded up to the alignment
+    size_t mapped = reserve + align;
+    uint8_t* map = mmap(NULL, mapped, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    uint8_t* base = (uint8_t*)(((uintptr_t)map + align - 1) & ~(uintptr_t)(align - 1));
+    if (base != map)
+        munmap(map, base - map);
+    munmap(base + reserve, (map + mapped) - (base + reserve));
+
+    if (huge_pages && madvise(base, reserve, MADV_HUGEPAGE) != 0) {
+        // not fatal, the kernel may just not have THP enabled
+        huge_pages = 0;
+    }
+
+    CodeArena* arena = malloc(sizeof(CodeArena));
+    arena->advance = base;
+    arena->base = base;
+    arena->committed = base;
+    arena->limit = base + reserve;
+    arena->chunk = align;
+    arena->huge_pages = huge_pages;
+    return arena;
+}
+
+void arena_free(CodeArena* arena) {
+    if (arena == NULL)
+        return;
+    munmap(arena->base, arena->limit - arena->base);
+    free(arena);
+}
+
+// make sure the next `bytes` bytes can be written, committing more of the
+// reservation if needed. emitters only ever see the advance pointer, which is
+// the first member of the arena so the arena can be recovered from it
+void arena_ensure(uint8_t** jit_memory, size_t bytes) {
+    CodeArena* arena = (CodeArena*)jit_memory;
+    if (arena->advance + bytes <= arena->committed)
+        return;
+
+    size_t needed = arena->advance + bytes - arena->committed;
+    size_t grow = (needed + arena->chunk - 1) & ~(arena->chunk - 1);
+    if (arena->committed + grow > arena->limit) {
+        fprintf(stderr, "Out of code space, %zu bytes reserved\n", (size_t)(arena->limit - arena->base));
+        exit(EXIT_FAILURE);
+    }
+    if (mprotect(arena->committed, grow, PROT_READ | PROT_WRITE) != 0) {
+        perror("mprotect");
+        exit(EXIT_FAILURE);
+    }
+    arena->committed += grow;
+}
+
+static void arena_protect(CodeArena* arena, int prot) {
+    size_t size = arena->committed - arena->base;
+    if (size && mprotect(arena->base, size, prot) != 0) {
+        perror("mprotect");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// done emitting, everything committed becomes read + execute
+void arena_seal(CodeArena* arena) {
+    arena_protect(arena, PROT_READ | PROT_EXEC);
+}
+
+// back to read + write for emitting more code (or patching)
+void arena_unseal(CodeArena* arena) {
+    arena_protect(arena, PROT_READ | PROT_WRITE);
+}
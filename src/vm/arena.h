@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/*
+ * arena.h
+ *
+ * Executable memory for the jit. A large range of address space is reserved up
+ * front and committed in chunks as code is emitted, so code never moves and
+ * absolute addresses into it stay valid. Pages are writable while emitting
+ * and flipped to executable once done, never both at once.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_DEFAULT_RESERVE (1ULL << 30)
+#define ARENA_CHUNK (64 << 10)
+#define ARENA_HUGE_CHUNK (2 << 20)
+
+typedef struct {
+    uint8_t* advance;    // next byte to emit, must stay first (see arena_ensure)
+    uint8_t* base;       // start of the reservation
+    uint8_t* committed;  // end of the writable part
+    uint8_t* limit;      // end of the reservation
+    size_t chunk;        // commit granularity
+    int huge_pages;      // madvise'd for transparent huge pages
+} CodeArena;
+
+CodeArena* arena_create(size_t reserve, int huge_pages);
+void arena_free(CodeArena* arena);
+void arena_ensure(uint8_t** jit_memory, size_t bytes);
+void arena_seal(CodeArena* arena);
+void arena_unseal(CodeArena* arena);
+
+#endif
@@ -0,0 +1,230 @@
+#include "baseline.h"
+#include "../common/config.h"
+#include "../common/instruction.h"
+#include "state.h"
+#include "x86encoding.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// build/stencils.h, made by stencilgen out of stencils.c
+#include "stencils.h"
+
+/**
+    Baseline jit
+
+    x86jit.c is the optimizing path and spends
+    most of its time on liveness, register
+    allocation and picking encodings. None of that
+    happens here, every instruction is its stencil
+    copied into the arena with the holes patched:
+    register holes get the register's offset in the
+    VMState, immediate holes the immediate and
+    hole_next/hole_target the code to continue at.
+    The code is slower than what x86jit.c makes
+    (every operand is a load or store through rdi)
+    but it comes out at memcpy speed.
+
+    Holes are patched the way a linker would apply
+    the relocation gcc left there, the hole's value
+    plus the addend, minus the field's own address
+    for pc relative ones. Jumps to blocks that are
+    not copied yet are patched once everything is.
+*/
+
+typedef struct {
+    uint8_t* field;
+    const StencilHole* hole;
+    size_t target;  // block index, cfg->count for the exit
+} TargetHole;
+
+typedef struct {
+    TargetHole* holes;
+    size_t count;
+    size_t capacity;
+} TargetList;
+
+static void patch_hole(uint8_t* field, const StencilHole* hole, uint64_t value) {
+    uint32_t patched = value + hole->addend - (hole->relative ? (uintptr_t)field : 0);
+    memcpy(field, &patched, 4);
+}
+
+static void add_target(TargetList* list, uint8_t* field, const StencilHole* hole, size_t target) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->holes = realloc(list->holes, sizeof(TargetHole) * list->capacity);
+    }
+    list->holes[list->count++] = (TargetHole){field, hole, target};
+}
+
+static const Stencil* stencil_for(ParsedInstruction* pi) {
+    switch (pi->opcode) {
+    case U2_MOV:
+        return &stencil_mov;
+    case U2_LI:
+        return pi->imm <= UINT32_MAX ? &stencil_li32 : &stencil_li64;
+    case U2_LD:
+        return &stencil_ld;
+    case U2_ST:
+        return &stencil_st;
+    case U2_ADD:
+        return &stencil_add;
+    case U2_SUB:
+        return &stencil_sub;
+    case U2_MUL:
+        return &stencil_mul;
+    case U2_DIV:
+        return &stencil_div;
+    case U2_AND:
+        return &stencil_and;
+    case U2_OR:
+        return &stencil_or;
+    case U2_XOR:
+        return &stencil_xor;
+    case U2_NOT:
+        return &stencil_not;
+    case U2_SHL:
+        return &stencil_shl;
+    case U2_SHR:
+        return &stencil_shr;
+    case U2_CMP:
+        return &stencil_cmp;
+    case U2_JMP:
+        return &stencil_jmp;
+    case U2_JE:
+        return &stencil_je;
+    case U2_JNE:
+        return &stencil_jne;
+    case U2_JL:
+        return &stencil_jl;
+    case U2_JG:
+        return &stencil_jg;
+    case U2_VLD:
+        return &stencil_vld;
+    case U2_VST:
+        return &stencil_vst;
+    case U2_VADD:
+        return &stencil_vadd;
+    case U2_VSUB:
+        return &stencil_vsub;
+    case U2_VMUL:
+        return &stencil_vmul;
+    case U2_VAND:
+        return &stencil_vand;
+    case U2_VOR:
+        return &stencil_vor;
+    case U2_VXOR:
+        return &stencil_vxor;
+    case U2_VCMPEQ:
+        return &stencil_vcmpeq;
+    case U2_VCMPGT:
+        return &stencil_vcmpgt;
+    default:
+        return NULL;
+    }
+}
+
+// offset of register reg in the VMState, vector says it's one of vregs
+static uint64_t state_offset(uint32_t reg, int vector) {
+    if (vector)
+        return offsetof(VMState, vregs) + sizeof(((VMState*)0)->vregs[0]) * reg;
+    return offsetof(VMState, regs) + 8 * reg;
+}
+
+static void copy_stencil(uint8_t** jit_memory, const Stencil* stencil, ParsedInstruction* pi, size_t target,
+                         TargetList* targets) {
+    arena_ensure(jit_memory, stencil->size);
+    uint8_t* code = *jit_memory;
+    memcpy(code, stencil->code, stencil->size);
+    *jit_memory += stencil->size;
+
+    uint64_t imm = pi->opcode == U2_SHL || pi->opcode == U2_SHR ? pi->imm & 63 : pi->imm;
+    for (size_t i = 0; i < stencil->hole_count; i++) {
+        const StencilHole* hole = &stencil->holes[i];
+        uint8_t* field = code + hole->offset;
+        switch (hole->kind) {
+        case HOLE_RD:
+            patch_hole(field, hole, state_offset(pi->rd, pi->obj.format & (1 << 4)));
+            break;
+        case HOLE_RS1:
+            patch_hole(field, hole, state_offset(pi->rs1, pi->obj.format & (1 << 5)));
+            break;
+        case HOLE_RS2:
+            patch_hole(field, hole, state_offset(pi->rs2, pi->obj.format & (1 << 6)));
+            break;
+        case HOLE_IMM_LO:
+            patch_hole(field, hole, (uint32_t)imm);
+            break;
+        case HOLE_IMM_HI:
+            patch_hole(field, hole, imm >> 32);
+            break;
+        case HOLE_NEXT:
+            patch_hole(field, hole, (uintptr_t)*jit_memory);
+            break;
+        case HOLE_TARGET:
+            add_target(targets, field, hole, target);
+            break;
+        }
+    }
+}
+
+static size_t block_id(CFG* cfg, BasicBlock* bb) {
+    return bb ? bb->index : cfg->count;
+}
+
+// the whole program, blocks in program order with the exit after the last
+// one. entered with a VMState* and returns r1 like a jit_program does
+BaselineEntry baseline_program(uint8_t** jit_memory, CFG* cfg, JitOptions* options) {
+    uint8_t* entry = *jit_memory;
+    uint8_t** label = calloc(cfg->count + 1, sizeof(uint8_t*));
+    TargetList targets = {0};
+
+    // stencils want the memory base in rsi next to the state in rdi
+    emit_x86instruction_mem(jit_memory, &__mov_r64_rm64, _x86_RSI, _x86_RDI, offsetof(VMState, mem), 0);
+
+    ParsedInstruction fallthrough = {.opcode = U2_JMP};
+    for (size_t b = 0; b < cfg->count; b++) {
+        BasicBlock* bb = cfg->nodes[b];
+        label[b] = *jit_memory;
+        for (size_t i = 0; i < bb->instructions_count; i++) {
+            ParsedInstruction* pi = bb->instructions[i];
+            if (options->profile)
+                profile_mark(options->profile, *jit_memory, pi->pc);
+            size_t target = block_id(cfg, bb->target);
+            // a jmp to whatever comes next is just the end of the stencil before it
+            if (pi->opcode == U2_JMP && target == b + 1)
+                continue;
+            copy_stencil(jit_memory, stencil_for(pi), pi, target, &targets);
+        }
+
+        ParsedInstruction* last = bb->instructions[bb->instructions_count - 1];
+        if (last->opcode != U2_JMP && block_id(cfg, bb->fallthrough) != b + 1)
+            copy_stencil(jit_memory, &stencil_jmp, &fallthrough, block_id(cfg, bb->fallthrough), &targets);
+    }
+
+    // rdi still holds the state, every stencil passed it on
+    label[cfg->count] = *jit_memory;
+    if (options->profile)
+        profile_mark(options->profile, *jit_memory, PROFILE_NO_PC);
+    emit_x86instruction_mem(jit_memory, &__mov_r64_rm64, _x86_RAX, _x86_RDI,
+                            offsetof(VMState, regs) + 8 * RETURN_REG, 0);
+    emit_x86instruction(jit_memory, &__ret, 0, 0, 0);
+
+    for (size_t i = 0; i < targets.count; i++) {
+        TargetHole* hole = &targets.holes[i];
+        patch_hole(hole->field, hole->hole, (uintptr_t)label[hole->target]);
+    }
+
+    JitSymbols* symbols = options->symbols;
+    if (symbols) {
+        symbols_add(symbols, entry, label[0] - entry, "u2_entry");
+        for (size_t b = 0; b < cfg->count; b++)
+            symbols_add_block(symbols, label[b], label[b + 1] - label[b], cfg->nodes[b]->instructions[0]->pc);
+        symbols_add(symbols, label[cfg->count], *jit_memory - label[cfg->count], "u2_exit");
+        symbols_commit(symbols);
+    }
+
+    free(targets.holes);
+    free(label);
+    return (BaselineEntry)entry;
+}
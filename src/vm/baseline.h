@@ -0,0 +1,49 @@
+#ifndef BASELINE_H
+#define BASELINE_H
+
+/*
+ * baseline.h
+ *
+ * Copy and patch jit. Every u2 opcode has a stencil of machine code that gcc
+ * compiled ahead of time (see stencils.c), compiling a program is copying
+ * stencils one after another and filling in their holes. No register
+ * allocation and no liveness, u2 registers stay in a VMState the whole time.
+ */
+
+#include "arena.h"
+#include "cfg.h"
+#include "x86jit.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    HOLE_RD,      // offset of rd in the VMState
+    HOLE_RS1,     // offset of rs1
+    HOLE_RS2,     // offset of rs2
+    HOLE_IMM_LO,  // low 32 bits of the immediate
+    HOLE_IMM_HI,  // high 32 bits
+    HOLE_NEXT,    // code right after the stencil
+    HOLE_TARGET,  // code of the block a jump goes to
+} HoleKind;
+
+typedef struct {
+    uint32_t offset;   // of the 32 bit field in the stencil
+    uint8_t kind;      // HoleKind
+    uint8_t relative;  // pc relative (value - field address) rather than absolute
+    int32_t addend;
+} StencilHole;
+
+typedef struct {
+    const uint8_t* code;
+    size_t size;
+    const StencilHole* holes;
+    size_t hole_count;
+} Stencil;
+
+// called like a jit_program with the VMState instead of the memory base
+typedef uint64_t (*BaselineEntry)(void* state);
+
+// only the symbols and profile in options are used
+BaselineEntry baseline_program(uint8_t** jit_memory, CFG* cfg, JitOptions* options);
+
+#endif
@@ -0,0 +1,461 @@
+#include "batch.h"
+#include "memory.h"
+#include "state.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+    Batch runs
+
+    The program is compiled once as a unit over
+    every block (see jit_unit) that observes
+    r1..rN at the end, so a record costs a call
+    plus the loads and stores of the registers it
+    actually uses at either end.
+
+    The workers are started once and wait on the
+    pool for a chunk, which is split between as
+    many of them as it has records for. There are
+    two chunk buffers: while the workers run one,
+    the main thread reads the next into the other,
+    and while they run that it writes out the
+    first. So I/O overlaps with running code
+    instead of adding to it.
+
+    A worker goes through its share of a chunk
+    inside a single memory_run, a trap jumps out of
+    it and the worker picks up again at the record
+    after. Each worker has a memory of its own,
+    cleared between records only if the program can
+    touch it at all. Workers also format their own
+    csv, the main thread only parses and writes.
+*/
+
+// fewer records than this per worker and starting the thread costs more than
+// it saves
+#define BATCH_MIN_PER_WORKER 256
+
+typedef struct {
+    int index;          // which of the two buffers, workers keep csv for each
+    uint64_t* records;  // N registers each, results replace them
+    int* trap_signal;   // per record, 0 if it ran to the end
+    int64_t* trap_offset;
+    size_t count;
+    long used;  // workers it's split between
+} BatchChunk;
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} BatchText;
+
+typedef struct {
+    FILE* in;
+    BatchOptions* options;
+    char* line;  // getline's
+    size_t capacity;
+    // why the input is bad. the chunk after the last good one is read while
+    // that one runs, so this waits for its traps to be reported first
+    char error[128];
+} BatchReader;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start;     // a chunk was handed out, or it's time to stop
+    pthread_cond_t finished;  // the last worker on a chunk is done
+    BatchChunk* chunk;        // handed out last
+    uint64_t generation;      // chunks handed out so far
+    long running;             // workers still on the chunk
+    long workers;             // threads that could be started, chunks are split between these
+    int stop;
+} BatchPool;
+
+typedef struct {
+    BatchPool* pool;
+    long index;
+    JitUnit unit;
+    BatchOptions* options;
+    VMMemory* memory;
+    BatchChunk* chunk;  // being run
+    size_t first;       // records of the chunk this worker runs
+    size_t count;
+    size_t next;        // record being run, where a trap left off
+    BatchText text[2];  // csv of its records, per chunk buffer
+} BatchWorker;
+
+uint16_t batch_exit_live(int regs) {
+    uint16_t live = 0;
+    for (int r = 1; r <= regs; r++)
+        live |= 1 << (r & 15);
+    return live;
+}
+
+// signed decimal, printf is most of the cost of a small program otherwise
+static char* format_int(char* p, int64_t value) {
+    char digits[20];
+    uint64_t v = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (value < 0)
+        *p++ = '-';
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+// runs records until one traps, memory_run comes back either way
+static uint64_t run_records(void* arg) {
+    BatchWorker* w = arg;
+    int n = w->options->regs;
+    for (; w->next < w->first + w->count; w->next++) {
+        uint64_t* record = &w->chunk->records[w->next * n];
+        VMState state = {.mem = w->memory->base};
+        for (int r = 0; r < n; r++)
+            state.regs[(r + 1) & 15] = record[r];
+        w->unit(&state);
+        for (int r = 0; r < n; r++)
+            record[r] = state.regs[(r + 1) & 15];
+        if (w->options->clear_memory)
+            memory_clear(w->memory);
+    }
+    return 0;
+}
+
+// this worker's share of its chunk
+static void run_share(BatchWorker* w) {
+    BatchChunk* chunk = w->chunk;
+    w->next = w->first;
+    while (w->next < w->first + w->count) {
+        MemoryTrap trap;
+        memory_run(w->memory, run_records, w, &trap);
+        if (trap.signal) {
+            // the record keeps the registers it came in with
+            chunk->trap_signal[w->next] = trap.signal;
+            chunk->trap_offset[w->next] = trap.offset;
+            if (w->options->clear_memory)
+                memory_clear(w->memory);
+            w->next++;
+        }
+    }
+
+    if (w->options->format == BATCH_CSV) {
+        int n = w->options->regs;
+        BatchText* text = &w->text[chunk->index];
+        size_t needed = w->count * (22 * n + 1);
+        if (needed > text->capacity) {
+            text->capacity = needed;
+            text->data = realloc(text->data, needed);
+        }
+        char* p = text->data;
+        for (size_t i = w->first; i < w->first + w->count; i++) {
+            for (int r = 0; r < n; r++) {
+                if (r)
+                    *p++ = ',';
+                p = format_int(p, (int64_t)chunk->records[i * n + r]);
+            }
+            *p++ = '\n';
+        }
+        text->size = p - text->data;
+    }
+}
+
+static void* batch_worker(void* arg) {
+    BatchWorker* w = arg;
+    BatchPool* pool = w->pool;
+    uint64_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        BatchChunk* chunk = pool->chunk;
+        pthread_mutex_unlock(&pool->lock);
+
+        // a small chunk leaves some workers out
+        if (w->index >= chunk->used)
+            continue;
+        w->chunk = chunk;
+        w->first = chunk->count * w->index / chunk->used;
+        w->count = chunk->count * (w->index + 1) / chunk->used - w->first;
+        run_share(w);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// split chunk between the workers and let them go. none may be running
+static void batch_dispatch(BatchPool* pool, BatchWorker* workers, BatchOptions* options, BatchChunk* chunk) {
+    memset(chunk->trap_signal, 0, sizeof(int) * chunk->count);
+    chunk->used = (chunk->count + BATCH_MIN_PER_WORKER - 1) / BATCH_MIN_PER_WORKER;
+    if (chunk->used > pool->workers)
+        chunk->used = pool->workers;
+    // idle workers don't look at their memory until they see the chunk
+    for (long t = 0; t < chunk->used; t++) {
+        if (workers[t].memory == NULL)
+            workers[t].memory = memory_create(options->memory_size);
+        if (workers[t].memory == NULL) {
+            fprintf(stderr, "Could not reserve vm memory!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->chunk = chunk;
+    pool->generation++;
+    pool->running = chunk->used;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// until the chunk handed out last is done, right away if there is none
+static void batch_wait(BatchPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running)
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// one csv record into record, 0 at the end of input and -1 (with a message in
+// reader->error) if it doesn't parse. blank lines are skipped
+static int read_csv_record(BatchReader* reader, uint64_t* record, size_t number) {
+    int n = reader->options->regs;
+    for (;;) {
+        if (getline(&reader->line, &reader->capacity, reader->in) < 0)
+            return 0;
+        char* p = reader->line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p != '\n' && *p != '\r' && *p != '\0')
+            break;
+    }
+
+    memset(record, 0, sizeof(uint64_t) * n);
+    char* p = reader->line;
+    for (int r = 0;; r++) {
+        if (r == n) {
+            snprintf(reader->error, sizeof(reader->error), "Record %zu has more than %d registers", number, n);
+            return -1;
+        }
+        while (*p == ' ' || *p == '\t')
+            p++;
+        char* end;
+        errno = 0;
+        record[r] = *p == '-' ? (uint64_t)strtoll(p, &end, 0) : strtoull(p, &end, 0);
+        if (end == p || errno) {
+            snprintf(reader->error, sizeof(reader->error), "Record %zu: bad register value for r%d", number, r + 1);
+            return -1;
+        }
+        p = end;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p != ',')
+            break;
+        p++;
+    }
+    if (*p != '\n' && *p != '\r' && *p != '\0') {
+        snprintf(reader->error, sizeof(reader->error), "Record %zu: expected a comma, got '%c'", number, *p);
+        return -1;
+    }
+    return 1;
+}
+
+// fills records with up to BATCH_CHUNK of them, -1 if the input is bad. done
+// records came before
+static long read_chunk(BatchReader* reader, uint64_t* records, size_t done) {
+    int n = reader->options->regs;
+    if (reader->options->format == BATCH_BINARY) {
+        size_t record_size = sizeof(uint64_t) * n;
+        size_t bytes = fread(records, 1, record_size * BATCH_CHUNK, reader->in);
+        if (ferror(reader->in)) {
+            snprintf(reader->error, sizeof(reader->error), "Error reading records: %s", strerror(errno));
+            return -1;
+        }
+        if (bytes % record_size) {
+            snprintf(reader->error, sizeof(reader->error), "Input ends in the middle of record %zu",
+                     done + bytes / record_size + 1);
+            return -1;
+        }
+        return bytes / record_size;
+    }
+
+    size_t count = 0;
+    while (count < BATCH_CHUNK) {
+        int read = read_csv_record(reader, &records[count * n], done + count + 1);
+        if (read < 0)
+            return -1;
+        if (read == 0)
+            break;
+        count++;
+    }
+    return count;
+}
+
+// trap messages for a chunk that's done, first is the number of its first
+// record. returns how many trapped
+static long report_traps(BatchChunk* chunk, size_t first) {
+    long trapped = 0;
+    for (size_t i = 0; i < chunk->count; i++) {
+        if (chunk->trap_signal[i] == SIGSEGV) {
+            fprintf(stderr, "Record %zu: u2 trap: memory access out of bounds at 0x%" PRIX64 "\n", first + i,
+                    (uint64_t)chunk->trap_offset[i]);
+        } else if (chunk->trap_signal[i] == SIGFPE) {
+            fprintf(stderr, "Record %zu: u2 trap: division by zero or overflow\n", first + i);
+        }
+        trapped += chunk->trap_signal[i] != 0;
+    }
+    return trapped;
+}
+
+// results of a chunk that's done, 0 or -1 if they couldn't be written
+static int write_chunk(FILE* out, BatchOptions* options, BatchChunk* chunk, BatchWorker* workers) {
+    if (options->format == BATCH_BINARY) {
+        fwrite(chunk->records, sizeof(uint64_t) * options->regs, chunk->count, out);
+    } else {
+        for (long t = 0; t < chunk->used; t++)
+            fwrite(workers[t].text[chunk->index].data, 1, workers[t].text[chunk->index].size, out);
+    }
+    if (ferror(out)) {
+        fprintf(stderr, "Error writing results: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// how many records ran goes in records_run (if not NULL). returns how many of
+// them trapped, -1 if the input couldn't be read, the output written or not a
+// single worker started
+long batch_run(JitUnit unit, BatchOptions* options, size_t* records_run) {
+    int from_stdin = options->in_path == NULL || strcmp(options->in_path, "-") == 0;
+    int to_stdout = options->out_path == NULL || strcmp(options->out_path, "-") == 0;
+    FILE* in = from_stdin ? stdin : fopen(options->in_path, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", options->in_path, strerror(errno));
+        return -1;
+    }
+    FILE* out = to_stdout ? stdout : fopen(options->out_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", options->out_path, strerror(errno));
+        if (!from_stdin)
+            fclose(in);
+        return -1;
+    }
+
+    int n = options->regs;
+    BatchChunk chunks[2];
+    for (int c = 0; c < 2; c++) {
+        chunks[c] = (BatchChunk){.index = c};
+        chunks[c].records = malloc(sizeof(uint64_t) * n * BATCH_CHUNK);
+        chunks[c].trap_signal = malloc(sizeof(int) * BATCH_CHUNK);
+        chunks[c].trap_offset = malloc(sizeof(int64_t) * BATCH_CHUNK);
+    }
+    BatchReader reader = {.in = in, .options = options};
+
+    BatchPool pool = {0};
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.start, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+    BatchWorker* workers = calloc(options->threads, sizeof(BatchWorker));
+    pthread_t* threads = malloc(sizeof(pthread_t) * options->threads);
+    // the first that won't start leaves the chunks to the ones before it
+    int error = 0;
+    while (pool.workers < options->threads) {
+        BatchWorker* w = &workers[pool.workers];
+        *w = (BatchWorker){.pool = &pool, .index = pool.workers, .unit = unit, .options = options};
+        if ((error = pthread_create(&threads[pool.workers], NULL, batch_worker, w)) != 0)
+            break;
+        pool.workers++;
+    }
+
+    long trapped = 0;
+    size_t done = 0;
+    BatchChunk* running = &chunks[0];
+    long count = 0;
+    if (pool.workers == 0) {
+        fprintf(stderr, "Could not start a batch worker: %s\n", strerror(error));
+        trapped = -1;
+    } else {
+        count = read_chunk(&reader, running->records, done);
+        if (count < 0) {
+            fprintf(stderr, "%s\n", reader.error);
+            trapped = -1;
+        }
+    }
+    running->count = count > 0 ? count : 0;
+    if (running->count)
+        batch_dispatch(&pool, workers, options, running);
+
+    while (running->count) {
+        // the next chunk is read while this one runs, a short one was the last
+        BatchChunk* next = &chunks[!running->index];
+        count = 0;
+        if (running->count == BATCH_CHUNK)
+            count = read_chunk(&reader, next->records, done + running->count);
+        next->count = count > 0 ? count : 0;
+
+        batch_wait(&pool);
+        trapped += report_traps(running, done + 1);
+        // and runs while this one is written
+        if (next->count)
+            batch_dispatch(&pool, workers, options, next);
+        if (count < 0)
+            fprintf(stderr, "%s\n", reader.error);
+        if (write_chunk(out, options, running, workers) < 0 || count < 0) {
+            trapped = -1;
+            break;
+        }
+        done += running->count;
+        running = next;
+    }
+
+    batch_wait(&pool);
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+    for (long t = 0; t < pool.workers; t++)
+        pthread_join(threads[t], NULL);
+
+    if (fflush(out) != 0 && trapped >= 0) {
+        fprintf(stderr, "Error writing results: %s\n", strerror(errno));
+        trapped = -1;
+    }
+    for (long t = 0; t < options->threads; t++) {
+        memory_free(workers[t].memory);
+        free(workers[t].text[0].data);
+        free(workers[t].text[1].data);
+    }
+    if (!from_stdin)
+        fclose(in);
+    if (!to_stdout)
+        fclose(out);
+    free(reader.line);
+    free(threads);
+    free(workers);
+    for (int c = 0; c < 2; c++) {
+        free(chunks[c].trap_offset);
+        free(chunks[c].trap_signal);
+        free(chunks[c].records);
+    }
+    pthread_cond_destroy(&pool.finished);
+    pthread_cond_destroy(&pool.start);
+    pthread_mutex_destroy(&pool.lock);
+    if (records_run)
+        *records_run = done;
+    return trapped;
+}
@@ -0,0 +1,42 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/*
+ * batch.h
+ *
+ * --batch: one compiled program run over a stream of records. A record is the
+ * registers r1..rN a run starts with and the same registers are written back
+ * once it ends, every record starts like a fresh u2vm run otherwise (other
+ * registers and memory zeroed). Records are read a chunk at a time and each
+ * chunk is split between the workers, results come out in input order.
+ *
+ * csv is a line per record, up to N comma separated integers (decimal, 0x hex
+ * or negative) with missing ones taken as 0, results are signed decimal. bin
+ * is N little endian 64 bit words per record both ways.
+ */
+
+#include "x86jit.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define BATCH_CHUNK 16384  // records read (and run) at a time
+
+typedef enum {
+    BATCH_CSV,
+    BATCH_BINARY,
+} BatchFormat;
+
+typedef struct {
+    const char* in_path;   // records, NULL or "-" for stdin
+    const char* out_path;  // results, NULL or "-" for stdout
+    BatchFormat format;    // of both
+    int regs;              // N, records hold r1..rN
+    int threads;           // workers
+    size_t memory_size;    // linear memory of each worker
+    int clear_memory;      // the program uses ld/st, zero memory between records
+} BatchOptions;
+
+uint16_t batch_exit_live(int regs);
+long batch_run(JitUnit unit, BatchOptions* options, size_t* records);
+
+#endif
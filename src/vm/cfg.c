@@ -3,10 +3,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "../common/debug.h"
-
-extern int DEV_DEBUG;
-
 /*
  * cfg.c
  *
@@ -37,6 +33,15 @@ void push_parsed_array(ParsedArray* parsed_array, ParsedInstruction* instruction
     parsed_array->instructions[parsed_array->count++] = copy;
 }
 
+void free_parsed_array(ParsedArray* parsed_array) {
+    if (parsed_array == NULL)
+        return;
+    for (size_t i = 0; i < parsed_array->count; i++)
+        free(parsed_array->instructions[i]);
+    free(parsed_array->instructions);
+    free(parsed_array);
+}
+
 /*
  * STEP 2: BREAK PARSED INSTRUCTIONS INTO BASIC BLOCKS
 
@@ -73,18 +78,52 @@ int64_t sign_ext_imm__(uint64_t imm, uint32_t imm_ext) {
     }
 }
 
+// entries are added in program order so they're sorted by source
 JumpTableEntry* jte_from_source(uint64_t source, JumpTable* jt) {
-    for (size_t i = 0; i < jt->count; i++) {
-        if (jt->entries[i]->source_id == source) {
-            return jt->entries[i];
-        }
+    size_t lo = 0;
+    size_t hi = jt->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (jt->entries[mid]->source_id < source)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    if (lo < jt->count && jt->entries[lo]->source_id == source)
+        return jt->entries[lo];
     return NULL;
 }
 
+// jumps are relative in words (that's what the assembler counts) but
+// everything past here wants an index into the parsed array, extended
+// immediates make the two drift apart. a jump to the word just past the last
+// instruction leaves the program and resolves to count, one that lands
+// anywhere else resolves to UINT64_MAX
+uint64_t index_from_pc__(ParsedArray* parsed_array, uint64_t source, int64_t target_pc) {
+    size_t lo = 0;
+    size_t hi = parsed_array->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((int64_t)parsed_array->instructions[mid]->pc < target_pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < parsed_array->count && (int64_t)parsed_array->instructions[lo]->pc == target_pc)
+        return lo;
+
+    ParsedInstruction* last = parsed_array->instructions[parsed_array->count - 1];
+    if (target_pc == (int64_t)(last->pc + 1 + last->imm_ext))
+        return parsed_array->count;
+
+    fprintf(stderr, "Jump at instruction %lu lands outside the program or inside an instruction\n", source);
+    return UINT64_MAX;
+}
+
 // remember, the only goal of this function is just to generate a jump table
 // from the parsed array. this just means we have to match every jump and find
-// where it lands
+// where it lands. NULL if one of them lands nowhere
 JumpTable* jumptable_from_parsed_array(ParsedArray* parsed_array) {
     // initialize
     JumpTable* jt = malloc(sizeof(JumpTable));
@@ -99,18 +138,32 @@ JumpTable* jumptable_from_parsed_array(ParsedArray* parsed_array) {
             JumpTableEntry* jte = malloc(sizeof(JumpTableEntry));
             jte->source_id = i;
             jte->target_id = (int64_t)sign_ext_imm__(imm, imm_ext);
-            jte->resolved_target_id = jte->source_id + jte->target_id;
+            int64_t target_pc = (int64_t)parsed_array->instructions[i]->pc + (int64_t)jte->target_id;
+            jte->resolved_target_id = index_from_pc__(parsed_array, i, target_pc);
             if (jt->count == jt->capacity) {
                 jt->capacity *= 2;
                 jt->entries = realloc(jt->entries, sizeof(JumpTableEntry*) * jt->capacity);
             }
             jt->entries[jt->count++] = jte;
+            if (jte->resolved_target_id == UINT64_MAX) {
+                free_jump_table(jt);
+                return NULL;
+            }
         }
     }
 
     return jt;
 }
 
+void free_jump_table(JumpTable* jt) {
+    if (jt == NULL)
+        return;
+    for (size_t i = 0; i < jt->count; i++)
+        free(jt->entries[i]);
+    free(jt->entries);
+    free(jt);
+}
+
 /*
  * STEP 3: GENERATE LEADERS FOR BASIC BLOCKS
  *
@@ -129,18 +182,22 @@ JumpTable* jumptable_from_parsed_array(ParsedArray* parsed_array) {
  * and also which type of jump instruction we have hit!
  */
 
+// only valid once generate_leaders has sorted the set
 int in_leaders(LeaderSet* ls, uint64_t pc) {
-    for (size_t i = 0; i < ls->count; i++) {
-        if (ls->leaders[i] == pc)
-            return 1;
+    size_t lo = 0;
+    size_t hi = ls->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ls->leaders[mid] < pc)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return 0;
+    return lo < ls->count && ls->leaders[lo] == pc;
 }
 
+// duplicates are fine, they're dropped after sorting
 void add_leader(LeaderSet* ls, uint64_t pc) {
-    if (in_leaders(ls, pc))
-        return;  // O(n) but i just dont care, ok actually
-                 // i kinda do a little.. TODO: fix this
     ls->leaders[ls->count++] = pc;
     if (ls->count == ls->capacity) {
         ls->capacity *= 2;
@@ -166,23 +223,51 @@ LeaderSet* generate_leaders(ParsedArray* pa, JumpTable* jt) {
     ls->leaders = malloc(sizeof(uint64_t) * ls->capacity);
 
     // add first instruction to leaders
-    add_leader(ls, 0);
+    if (pa->count)
+        add_leader(ls, 0);
 
-    // add jump targets (absolute)
+    // add jump targets (absolute), jumping to the end of the program just
+    // exits so it doesn't start a block
     for (size_t i = 0; i < jt->count; i++) {
         JumpTableEntry* jte = jt->entries[i];
-        add_leader(ls, jte->resolved_target_id);
+        if (jte->resolved_target_id < pa->count)
+            add_leader(ls, jte->resolved_target_id);
         if (jte->source_id + 1 < pa->count)
             add_leader(ls, jte->source_id + 1);  // add instruction after jump if
                                                  // not at last line
     }
 
-    // dont forget to sort!
+    // dont forget to sort! (and dedup)
     qsort(ls->leaders, ls->count, sizeof(uint64_t), cmp_uint64);
+    size_t unique = 0;
+    for (size_t i = 0; i < ls->count; i++) {
+        if (unique == 0 || ls->leaders[unique - 1] != ls->leaders[i])
+            ls->leaders[unique++] = ls->leaders[i];
+    }
+    ls->count = unique;
 
     return ls;
 }
 
+// a leader that doesn't come from the program itself (an entry point), the
+// set stays sorted and free of duplicates
+void insert_leader(LeaderSet* ls, uint64_t pc) {
+    if (in_leaders(ls, pc))
+        return;
+    add_leader(ls, pc);
+    size_t i = ls->count - 1;
+    for (; i > 0 && ls->leaders[i - 1] > pc; i--)
+        ls->leaders[i] = ls->leaders[i - 1];
+    ls->leaders[i] = pc;
+}
+
+void free_leader_set(LeaderSet* ls) {
+    if (ls == NULL)
+        return;
+    free(ls->leaders);
+    free(ls);
+}
+
 /*
  * STEP 4: BASIC BLOCKS
  *
@@ -211,13 +296,34 @@ void add_bb(BasicBlock* bb, ParsedInstruction* pi) {
     }
 }
 
+// edges are unbounded in the incoming direction (any number of jumps can land
+// on a block) so both lists grow
+void add_edge(BasicBlock* from, BasicBlock* to) {
+    if (from->outgoing_count == from->outgoing_capacity) {
+        from->outgoing_capacity *= 2;
+        from->outgoing = realloc(from->outgoing, sizeof(BasicBlock*) * from->outgoing_capacity);
+    }
+    from->outgoing[from->outgoing_count++] = to;
+    if (to->incoming_count == to->incoming_capacity) {
+        to->incoming_capacity *= 2;
+        to->incoming = realloc(to->incoming, sizeof(BasicBlock*) * to->incoming_capacity);
+    }
+    to->incoming[to->incoming_count++] = from;
+}
+
+// blocks are built from the sorted leaders so they're sorted too
 BasicBlock* get_bb_by_leader(CFG* cfg, uint64_t leader) {
-    for (size_t i = 0; i < cfg->count; i++) {
-        BasicBlock* bb = cfg->nodes[i];
-        if (bb->leader == leader) {
-            return bb;
-        }
+    size_t lo = 0;
+    size_t hi = cfg->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->nodes[mid]->leader < leader)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    if (lo < cfg->count && cfg->nodes[lo]->leader == leader)
+        return cfg->nodes[lo];
     return NULL;
 }
 
@@ -225,6 +331,9 @@ CFG* build_cfg(ParsedArray* pa, JumpTable* jt, LeaderSet* ls) {
     CFG* cfg = malloc(sizeof(CFG));
     cfg->count = 0;
     cfg->capacity = 16;
+    cfg->profile = NULL;
+    cfg->exit_live = 0;
+    cfg->regalloc = NULL;
     cfg->nodes = malloc(sizeof(BasicBlock*) * cfg->capacity);
     // build a basic block spanning each leader
     for (size_t i = 0; i < ls->count; i++) {
@@ -234,11 +343,9 @@ CFG* build_cfg(ParsedArray* pa, JumpTable* jt, LeaderSet* ls) {
         bb->outgoing_count = 0;
 
         bb->instructions_capacity = 16;
-        bb->incoming_capacity = 2;  // likely no situation will ever arise where
-                                    // there are more than 2 incoming or
-                                    // outgoing connections, as that would imply
-                                    // a conditional jump with 2 targets, but oh
-                                    // well..
+        bb->incoming_capacity = 2;  // outgoing never goes past 2 (jump target and
+                                    // fallthrough) but any number of jumps can
+                                    // land on a block, see add_edge
         bb->outgoing_capacity = 2;
 
         bb->instructions = malloc(sizeof(ParsedInstruction*) * bb->instructions_capacity);
@@ -247,6 +354,12 @@ CFG* build_cfg(ParsedArray* pa, JumpTable* jt, LeaderSet* ls) {
 
         bb->live_in = 0;
         bb->live_out = 0;
+        bb->flags_live_in = 0;
+        bb->flags_live_out = 0;
+        bb->index = i;
+        bb->target = NULL;
+        bb->fallthrough = NULL;
+        bb->exits = 0;
 
         uint64_t pc_start = ls->leaders[i];
         uint64_t pc_end;  // inclusive
@@ -259,10 +372,8 @@ CFG* build_cfg(ParsedArray* pa, JumpTable* jt, LeaderSet* ls) {
         bb->leader = pc_start;  // keeping track of bb leader is important for linking bbs
 
         // add instructions from pc_start:pc_end to bb
-        for (uint64_t j = pc_start; j <= pc_end; j++) {
-            printf_DEBUG("Added instruction %lu to bb %ld\n", j, i);
+        for (uint64_t j = pc_start; j <= pc_end; j++)
             add_bb(bb, pa->instructions[j]);
-        }
         add_cfg(cfg, bb);
     }
 
@@ -285,27 +396,47 @@ CFG* build_cfg(ParsedArray* pa, JumpTable* jt, LeaderSet* ls) {
         int jumps = is_jump__(li->opcode);
         int fallthrough = is_jump_conditional__(li->opcode) || !jumps;
 
+        // a missing block on either edge means it leaves the program
         if (jumps) {
             JumpTableEntry* jte = jte_from_source(pc_end, jt);  // jump table of li
             assert(jte != NULL);
             BasicBlock* next_bb = get_bb_by_leader(cfg, jte->resolved_target_id);  // inst jumped to
-            if (next_bb) {
-                bb->outgoing[bb->outgoing_count++] = next_bb;
-                next_bb->incoming[next_bb->incoming_count++] = bb;
-            }
+            if (next_bb)
+                add_edge(bb, next_bb);
+            else
+                bb->exits = 1;
+            bb->target = next_bb;
         }
 
         if (fallthrough) {
             BasicBlock* next_bb = get_bb_by_leader(cfg, pc_end + 1);  // pc after li
-            if (next_bb) {
-                bb->outgoing[bb->outgoing_count++] = next_bb;
-                next_bb->incoming[next_bb->incoming_count++] = bb;
-            }
+            if (next_bb)
+                add_edge(bb, next_bb);
+            else
+                bb->exits = 1;
+            bb->fallthrough = next_bb;
         }
     }
     return cfg;
 }
 
+// the instructions belong to the parsed array, they're left alone
+void free_cfg(CFG* cfg) {
+    if (cfg == NULL)
+        return;
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        free(bb->instructions);
+        free(bb->incoming);
+        free(bb->outgoing);
+        free(bb);
+    }
+    free(cfg->nodes);
+    free(cfg->profile);
+    free(cfg->regalloc);
+    free(cfg);
+}
+
 /*
  * STEP 5:
  *
@@ -313,6 +444,39 @@ CFG* build_cfg(ParsedArray* pa, JumpTable* jt, LeaderSet* ls) {
  * which registers are expected and produced by each basic block
  */
 
+// return a 16bit bitmask of which registers an instruction reads
+uint16_t uses_from_instruction(ParsedInstruction* instruction) {
+    InstructionFormat f = instruction->obj.format;
+    uint16_t uses = 0;
+    if ((f & (1 << 2)) && !(f & (1 << 6)))  // expects rs2 (and it isn't a vector)
+        uses |= 1 << instruction->rs2;
+    if ((f & (1 << 1)) && !(f & (1 << 5)))  // expects rs1
+        uses |= 1 << instruction->rs1;
+    return uses;
+}
+
+// return a 16bit bitmask of which registers an instruction writes
+uint16_t defs_from_instruction(ParsedInstruction* instruction) {
+    InstructionFormat f = instruction->obj.format;
+    if ((f & (1 << 0)) && !(f & (1 << 4)))  // defines rd
+        return 1 << instruction->rd;
+    return 0;
+}
+
+// return a 16bit bitmask of which vector registers an instruction reads or
+// writes. vectors aren't allocated, nothing needs them split up
+uint16_t vectors_from_instruction(ParsedInstruction* instruction) {
+    InstructionFormat f = instruction->obj.format;
+    uint16_t vectors = 0;
+    if (f & (1 << 4))
+        vectors |= 1 << instruction->rd;
+    if (f & (1 << 5))
+        vectors |= 1 << instruction->rs1;
+    if (f & (1 << 6))
+        vectors |= 1 << instruction->rs2;
+    return vectors;
+}
+
 // return a 16bit bitmask of which registers are expected
 uint16_t live_in_from_bb(BasicBlock* bb) {
     ParsedInstruction** instructions = bb->instructions;
@@ -320,18 +484,8 @@ uint16_t live_in_from_bb(BasicBlock* bb) {
     uint16_t defined = 0;
     for (size_t i = 0; i < bb->instructions_count; i++) {
         ParsedInstruction* instruction = instructions[i];
-        InstructionFormat f = instruction->obj.format;
-        if (f & (1 << 2)) {  // expects rs2
-            if (!(defined & (1 << instruction->rs2)))
-                live_in |= 1 << instruction->rs2;
-        }
-        if (f & (1 << 1)) {  // expects rs1
-            if (!(defined & (1 << instruction->rs1)))
-                live_in |= 1 << instruction->rs1;
-        }
-        if (f & (1 << 0)) {  // defines rd
-            defined |= 1 << instruction->rd;
-        }
+        live_in |= uses_from_instruction(instruction) & ~defined;
+        defined |= defs_from_instruction(instruction);
     }
     return live_in;
 }
@@ -350,20 +504,43 @@ uint16_t defined_in_bb(BasicBlock* bb) {
     ParsedInstruction** instructions = bb->instructions;
     uint16_t defined = 0;
     for (size_t i = 0; i < bb->instructions_count; i++) {
-        ParsedInstruction* instruction = instructions[i];
-        InstructionFormat f = instruction->obj.format;
-        if (f & (1 << 0)) {  // defines rd
-            defined |= 1 << instruction->rd;
-        }
+        defined |= defs_from_instruction(instructions[i]);
     }
     return defined;
 }
 
-// flow liveness across cfg
-void compute_liveness(CFG* cfg) {
+// the comparison state is written by cmp, left undefined by arithmetic and
+// read by conditional jumps. 1 if the block reads it before writing it
+int flags_used_in_bb(BasicBlock* bb) {
+    for (size_t i = 0; i < bb->instructions_count; i++) {
+        uint32_t op = bb->instructions[i]->opcode;
+        if (is_jump_conditional__(op))
+            return 1;
+        if (op == U2_CMP || (op >= U2_ADD && op <= U2_SHR))
+            return 0;
+    }
+    return 0;
+}
+
+int flags_defined_in_bb(BasicBlock* bb) {
+    for (size_t i = 0; i < bb->instructions_count; i++) {
+        uint32_t op = bb->instructions[i]->opcode;
+        if (op == U2_CMP || (op >= U2_ADD && op <= U2_SHR))
+            return 1;
+    }
+    return 0;
+}
+
+// flow liveness across cfg, registers in exit_live are observed once the
+// program leaves through an exiting block (the return value for example).
+// returns how many passes over the blocks it took to settle
+int compute_liveness(CFG* cfg, uint16_t exit_live) {
+    cfg->exit_live = exit_live;
+    int passes = 0;
     int changed = 1;
     do {
         changed = 0;
+        passes++;
 
         for (size_t i = 0; i < cfg->count; i++) {
             BasicBlock* bb = cfg->nodes[i];
@@ -371,15 +548,68 @@ void compute_liveness(CFG* cfg) {
             uint16_t old_live_in = bb->live_in;
             uint16_t old_live_out = bb->live_out;
 
-            uint16_t new_live_out = 0;
+            uint16_t new_live_out = bb->exits ? exit_live : 0;
             for (size_t j = 0; j < bb->outgoing_count; j++)
                 new_live_out |= bb->outgoing[j]->live_in;
             bb->live_out = new_live_out;
 
             bb->live_in = live_in_from_bb(bb) | (bb->live_out & ~defined_in_bb(bb));
 
-            if (bb->live_in != old_live_in || bb->live_out != old_live_out)
+            // same thing for the flags, which only matters when switching
+            // between compiled code and the interpreter
+            int old_flags_in = bb->flags_live_in;
+            bb->flags_live_out = 0;
+            for (size_t j = 0; j < bb->outgoing_count; j++)
+                bb->flags_live_out |= bb->outgoing[j]->flags_live_in;
+            bb->flags_live_in = flags_used_in_bb(bb) || (bb->flags_live_out && !flags_defined_in_bb(bb));
+
+            if (bb->live_in != old_live_in || bb->live_out != old_live_out || bb->flags_live_in != old_flags_in)
                 changed = 1;
         }
     } while (changed);
+    return passes;
+}
+
+/*
+ * STEP 6: LOOPS
+ *
+ * Blocks are in program order so any edge going to a block at or before its
+ * source is a back edge and its target a loop header. The loop body is every
+ * block that reaches one of those back edges without going through the header
+ * first (walk incoming edges backwards from each latch, stop at the header).
+ */
+
+int is_back_edge(BasicBlock* from, BasicBlock* to) {
+    return to->index <= from->index;
+}
+
+// marks the blocks of the loop headed by header in in_loop, returns how many
+size_t natural_loop(CFG* cfg, BasicBlock* header, uint8_t* in_loop) {
+    BasicBlock** stack = malloc(sizeof(BasicBlock*) * cfg->count);
+    size_t sp = 0;
+    size_t count = 1;
+    in_loop[header->index] = 1;
+
+    for (size_t i = 0; i < header->incoming_count; i++) {
+        BasicBlock* latch = header->incoming[i];
+        if (is_back_edge(latch, header) && !in_loop[latch->index]) {
+            in_loop[latch->index] = 1;
+            stack[sp++] = latch;
+            count++;
+        }
+    }
+    while (sp) {
+        BasicBlock* bb = stack[--sp];
+        for (size_t i = 0; i < bb->incoming_count; i++) {
+            BasicBlock* pred = bb->incoming[i];
+            if (!in_loop[pred->index]) {
+                in_loop[pred->index] = 1;
+                stack[sp++] = pred;
+                count++;
+            }
+        }
+    }
+
+    free(stack);
+    return count;
 }
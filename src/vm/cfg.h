@@ -40,6 +40,20 @@ typedef struct BasicBlock {
     // liveness bitmasks
     uint16_t live_in;
     uint16_t live_out;
+
+    // is the result of a cmp still needed on the way in/out
+    int flags_live_in;
+    int flags_live_out;
+
+    // position in CFG.nodes, blocks are kept in program order
+    size_t index;
+
+    // where control goes after the last instruction, NULL when that edge
+    // leaves the program (target is only meaningful if the block ends in a
+    // jump, fallthrough only if it doesn't end in jmp)
+    struct BasicBlock* target;
+    struct BasicBlock* fallthrough;
+    int exits;  // some edge out of the block ends the program
 } BasicBlock;
 
 typedef struct {
@@ -66,19 +80,50 @@ typedef struct {
     size_t capacity;
 } LeaderSet;
 
+typedef struct RegAllocation RegAllocation;
+
 typedef struct {
     BasicBlock** nodes;
     size_t count;
     size_t capacity;
+
+    // recorded block and branch counts (laid out as in counts.h) when there
+    // is a profile to compile for, NULL to go by static guesses
+    uint64_t* profile;
+
+    // registers observed once the program ends, as last given to
+    // compute_liveness. compiled code that returns to a caller stores these
+    uint16_t exit_live;
+
+    // where every u2 register lives in compiled code, NULL until
+    // regalloc_program. freed along with the cfg
+    RegAllocation* regalloc;
 } CFG;
 
 // parsed array methods
 ParsedArray* init_parsed_array(void);
 void push_parsed_array(ParsedArray* parsed_array, ParsedInstruction* instruction);
+void free_parsed_array(ParsedArray* parsed_array);
 
 JumpTable* jumptable_from_parsed_array(ParsedArray* parsed_array);
 LeaderSet* generate_leaders(ParsedArray* parsed_array, JumpTable* jump_table);
 CFG* build_cfg(ParsedArray* pa, JumpTable* jt, LeaderSet* ls);
-void compute_liveness(CFG* cfg);
+void free_jump_table(JumpTable* jt);
+void insert_leader(LeaderSet* ls, uint64_t pc);
+void free_leader_set(LeaderSet* ls);
+void free_cfg(CFG* cfg);
+int compute_liveness(CFG* cfg, uint16_t exit_live);
+
+int is_jump__(uint32_t opcode);
+int is_jump_conditional__(uint32_t opcode);
+
+// loops
+int is_back_edge(BasicBlock* from, BasicBlock* to);
+size_t natural_loop(CFG* cfg, BasicBlock* header, uint8_t* in_loop);
+
+// per instruction register masks
+uint16_t uses_from_instruction(ParsedInstruction* instruction);
+uint16_t defs_from_instruction(ParsedInstruction* instruction);
+uint16_t vectors_from_instruction(ParsedInstruction* instruction);
 
 #endif
@@ -0,0 +1,150 @@
+#include "counts.h"
+#include "symbols.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+    Block counts
+
+    Written as JSON, a block per line and an edge
+    per line so it greps as well as it parses:
+
+        {
+          "hash": "9e3779b97f4a7c15",
+          "blocks": [
+            {"id": 0, "pc": 0, "label": "start", "count": 1},
+            ...
+          ],
+          "edges": [
+            {"from": 1, "to": 1, "kind": "taken", "count": 9, "probability": 0.9},
+            ...
+          ]
+        }
+
+    hash is FNV-1a over the bytecode file, a
+    profile is only good for the exact program it
+    was recorded from. pc is in words like u2asm
+    counts it, label is only there when the .sym
+    file has one. to is null for an edge leaving
+    the program. kind is "taken" or "fallthrough"
+    for the two sides of a conditional branch and
+    "jump" for everything else, probability is the
+    edge's share of the block's entries.
+*/
+
+uint64_t* counts_create(CFG* cfg) {
+    return calloc(2 * cfg->count, sizeof(uint64_t));
+}
+
+// 0 if the file can't be read
+uint64_t counts_hash(const char* bytecode_path) {
+    FILE* f = fopen(bytecode_path, "rb");
+    if (f == NULL)
+        return 0;
+    uint64_t hash = 0xcbf29ce484222325;
+    for (int c; (c = fgetc(f)) != EOF;)
+        hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+    fclose(f);
+    return hash;
+}
+
+static void write_edge(FILE* f, int* first, BasicBlock* from, BasicBlock* to, const char* kind, uint64_t count,
+                       uint64_t entries) {
+    fprintf(f, "%s\n    {\"from\": %zu, \"to\": ", *first ? "" : ",", from->index);
+    if (to)
+        fprintf(f, "%zu", to->index);
+    else
+        fprintf(f, "null");
+    fprintf(f, ", \"kind\": \"%s\", \"count\": %lu, \"probability\": %.6f}", kind, count,
+            entries ? (double)count / entries : 0.0);
+    *first = 0;
+}
+
+// -1 with errno set if path can't be written
+int counts_write(const char* path, CFG* cfg, uint64_t* counters, uint64_t hash, const char* sym_path) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+
+    size_t label_count;
+    char** labels = symbols_load_labels(sym_path, &label_count);
+
+    fprintf(f, "{\n  \"hash\": \"%016lx\",\n  \"blocks\": [", hash);
+    for (size_t b = 0; b < cfg->count; b++) {
+        uint64_t pc = cfg->nodes[b]->instructions[0]->pc;
+        fprintf(f, "%s\n    {\"id\": %zu, \"pc\": %lu, ", b ? "," : "", b, pc);
+        if (pc < label_count && labels[pc])
+            fprintf(f, "\"label\": \"%s\", ", labels[pc]);
+        fprintf(f, "\"count\": %lu}", counters[b]);
+    }
+    fprintf(f, "\n  ],\n  \"edges\": [");
+
+    int first = 1;
+    for (size_t b = 0; b < cfg->count; b++) {
+        BasicBlock* bb = cfg->nodes[b];
+        uint32_t opcode = bb->instructions[bb->instructions_count - 1]->opcode;
+        uint64_t entries = counters[b];
+        if (is_jump_conditional__(opcode)) {
+            uint64_t not_taken = counters[cfg->count + b];
+            write_edge(f, &first, bb, bb->target, "taken", entries - not_taken, entries);
+            write_edge(f, &first, bb, bb->fallthrough, "fallthrough", not_taken, entries);
+        } else {
+            write_edge(f, &first, bb, opcode == U2_JMP ? bb->target : bb->fallthrough, "jump", entries, entries);
+        }
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    symbols_free_labels(labels, label_count);
+    return fclose(f);
+}
+
+// only reads what counts_write writes, a line at a time. NULL with a message
+// on stderr when the file is unreadable or belongs to some other bytecode
+uint64_t* counts_read(const char* path, CFG* cfg, uint64_t hash) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    uint64_t* counters = counts_create(cfg);
+    uint64_t file_hash = 0;
+    size_t blocks = 0;
+    int bad = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char* field;
+        size_t id;
+        uint64_t count;
+        if ((field = strstr(line, "\"hash\":"))) {
+            bad |= sscanf(field, "\"hash\": \"%lx\"", &file_hash) != 1;
+        } else if ((field = strstr(line, "\"id\":"))) {
+            char* count_field = strstr(line, "\"count\":");
+            bad |= sscanf(field, "\"id\": %zu", &id) != 1 || id >= cfg->count || count_field == NULL ||
+                   sscanf(count_field, "\"count\": %lu", &count) != 1;
+            if (!bad) {
+                counters[id] = count;
+                blocks++;
+            }
+        } else if ((field = strstr(line, "\"from\":")) && strstr(line, "\"fallthrough\"")) {
+            char* count_field = strstr(line, "\"count\":");
+            bad |= sscanf(field, "\"from\": %zu", &id) != 1 || id >= cfg->count || count_field == NULL ||
+                   sscanf(count_field, "\"count\": %lu", &count) != 1;
+            if (!bad)
+                counters[cfg->count + id] = count;
+        }
+    }
+    fclose(f);
+
+    if (bad || blocks != cfg->count) {
+        fprintf(stderr, "'%s' isn't a block profile from --count-blocks, ignoring it\n", path);
+    } else if (file_hash != hash) {
+        fprintf(stderr, "'%s' was recorded from different bytecode, ignoring it\n", path);
+    } else {
+        return counters;
+    }
+    free(counters);
+    return NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef COUNTS_H
+#define COUNTS_H
+
+/*
+ * counts.h
+ *
+ * Exact block and branch counts for --count-blocks. The jit bumps a counter
+ * on every block entry and every time a conditional branch falls through,
+ * everything else (taken counts, edge frequencies) follows from those. The
+ * counters are one array indexed by block id:
+ *
+ *     counters[b]              times block b was entered
+ *     counters[cfg->count + b] times the branch ending block b wasn't taken
+ *
+ * The same array read back from a file is the profile --use-profile compiles
+ * for, it only applies to bytecode with the hash it was recorded from.
+ */
+
+#include "cfg.h"
+#include <stdint.h>
+
+uint64_t* counts_create(CFG* cfg);
+uint64_t counts_hash(const char* bytecode_path);
+int counts_write(const char* path, CFG* cfg, uint64_t* counters, uint64_t hash, const char* sym_path);
+uint64_t* counts_read(const char* path, CFG* cfg, uint64_t hash);
+
+#endif
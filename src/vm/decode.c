@@ -0,0 +1,141 @@
+#include "decode.h"
+#include "../common/config.h"
+#include "../common/instruction.h"
+#include <stdlib.h>
+
+// 1 for an instruction, 0 at the end, -1 if the read failed
+static int next_instruction(FILE* f, uint32_t* inst) {
+    size_t n = fread(inst, sizeof(uint32_t), 1, f);
+    if (n != 1) {
+        if (feof(f)) {
+            return 0;
+        } else {
+            fprintf(stderr, "Error reading instruction\n");
+            return -1;
+        }
+    }
+    return 1;
+}
+
+static uint32_t get_opcode(uint32_t inst) {
+    return inst >> (32 - OPCODE_BITS);
+}
+
+static uint32_t get_rd(uint32_t inst) {
+    return (inst >> (32 - OPCODE_BITS - REG_BITS)) & ((1u << REG_BITS) - 1);
+}
+
+static uint32_t get_rs1(uint32_t inst) {
+    return (inst >> (32 - OPCODE_BITS - 2 * REG_BITS)) & ((1u << REG_BITS) - 1);
+}
+
+static uint32_t get_rs2(uint32_t inst) {
+    return (inst >> (32 - OPCODE_BITS - 3 * REG_BITS)) & ((1u << REG_BITS) - 1);
+}
+
+static int64_t get_imm(uint32_t inst) {
+    uint32_t mask = (1u << IMM_BITS) - 1;
+    int imm = inst & mask;
+    // sign extend
+    if (imm & (1u << (IMM_BITS - 1))) {
+        imm |= ~mask;
+    }
+    return imm;
+}
+
+// what this vm runs on this host. the scalar instructions are plain x86-64,
+// vector code goes through xmm registers (ymm with avx2, see x86jit.c) and
+// needs at least sse2
+uint32_t host_capabilities(void) {
+    uint32_t caps = CAP_ALL & ~CAP_VECTOR;
+    if (__builtin_cpu_supports("sse2"))
+        caps |= CAP_VECTOR;
+    return caps;
+}
+
+// every instruction in f from the start, NULL with a message on stderr if it
+// can't be read or isn't bytecode
+ParsedArray* decode_bytecode(FILE* f) {
+    rewind(f);  // reset i/o if not already
+    ParsedArray* parsed_array = init_parsed_array();
+    uint32_t caps = host_capabilities();
+    uint32_t instruction;
+    uint64_t pc = 0;
+    int read;
+    while ((read = next_instruction(f, &instruction)) == 1) {
+        ParsedInstruction parsed;
+        uint32_t opcode = get_opcode(instruction);
+        uint32_t rd = get_rd(instruction);
+        uint32_t rs1 = get_rs1(instruction);
+        uint32_t rs2 = get_rs2(instruction);
+        int64_t immediate = get_imm(instruction);
+        if (opcode >= (uint32_t)Instruction_Count) {
+            fprintf(stderr, "Unknown opcode %u at pc %lu\n", opcode, pc);
+            free_parsed_array(parsed_array);
+            return NULL;
+        }
+        Capability cap = InstructionCapabilities[opcode].cap;
+        if ((caps & cap) != cap) {
+            fprintf(stderr, "%s at pc %lu needs the %s capability, which this host doesn't have\n",
+                    instruction_from_id(opcode), pc, capability_name(cap));
+            free_parsed_array(parsed_array);
+            return NULL;
+        }
+        Instruction instructionObj = Instructions[opcode];
+
+        parsed.opcode = opcode;
+        parsed.rd = rd;
+        parsed.rs1 = rs1;
+        parsed.rs2 = rs2;
+        parsed.imm = immediate;
+        parsed.imm_ext = 0;
+        parsed.pc = pc;
+        parsed.obj = instructionObj;
+
+        // check for long immediates
+        if (rs2 && !(instructionObj.format & 0b0100)) {  // value in rs2 when
+                                                         // one shouldn't be
+                                                         // expected
+            if (!(instructionObj.format & 0b1000)) {     // check imm extension is supported
+                fprintf(stderr,
+                        "Immediate extension is not supported for"
+                        " instructions of type %s",
+                        instructionObj.name);
+                free_parsed_array(parsed_array);
+                return NULL;
+            }
+
+            // if rs2 contains 1 or 2 load next rs2 bytes into imm
+            if (rs2 == 1 || rs2 == 2) {
+                parsed.imm_ext = 1;
+                uint32_t imm_ext;
+                int captured = next_instruction(f, &imm_ext);
+                if (captured != 1) {
+                    fprintf(stderr, "Expected immediate extension but instead recieved"
+                                    " EOF? Check rs2 value for last inst.\n");
+                }
+                immediate = (int32_t)imm_ext;  // the assembler only uses 32 bits for signed values that fit
+                if (rs2 == 2) {
+                    parsed.imm_ext = 2;
+                    captured = next_instruction(f, &imm_ext);
+                    if (captured != 1) {
+                        fprintf(stderr, "Expected immediate extension but instead"
+                                        " recieved EOF? Check rs2 value for second to"
+                                        " last inst.\n");
+                    }
+                    immediate = (immediate & UINT32_MAX) | ((int64_t)imm_ext << 32);
+                }
+            } else {
+                fprintf(stderr, "Invalid rs2 value\n");
+            }
+        }
+        parsed.imm = immediate;
+        pc += 1 + parsed.imm_ext;
+        push_parsed_array(parsed_array, &parsed);
+    }
+    if (read < 0) {
+        free_parsed_array(parsed_array);
+        return NULL;
+    }
+    return parsed_array;
+}
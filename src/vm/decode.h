@@ -0,0 +1,22 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+/*
+ * decode.h
+ *
+ * u2 bytecode to ParsedInstructions, the first thing done to every program
+ * whether it comes from a file (u2vm) or from memory (libu2vm, through
+ * fmemopen). Extension words are folded into the immediate of the
+ * instruction they extend, pc keeps counting them.
+ *
+ * Instructions of a capability the host doesn't have (see Capabilities in
+ * common/instruction.h) are refused here, u2asm --caps can expand them away.
+ */
+
+#include "cfg.h"
+#include <stdio.h>
+
+uint32_t host_capabilities(void);
+ParsedArray* decode_bytecode(FILE* f);
+
+#endif
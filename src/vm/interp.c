@@ -0,0 +1,389 @@
+#include "interp.h"
+#include "../common/config.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+    Direct threaded interpreter
+
+    The parsed instructions are flattened into an
+    array of ops that each carry the address of
+    their own handler, every handler ends by
+    jumping straight to the next op's handler
+    (computed goto) so there is no central switch
+    for the branch predictor to choke on.
+
+    Every block starts with an extra op that counts
+    how often the block is entered. Once that count
+    reaches the threshold the block and whatever
+    has already run downstream of it is compiled
+    into a unit (see jit_unit), from then on
+    entering the block runs the unit instead and
+    picks back up at whichever block it exits to.
+
+    Back edges first go through a trampoline op
+    that counts iterations of the loop. That trips
+    before the header's own count does and compiles
+    the whole natural loop, cold paths included,
+    and the interpreter jumps straight into it with
+    whatever iteration it was on (on stack
+    replacement). Units take all of their state from
+    the VMState so entering one halfway through a
+    loop is no different from entering it anywhere
+    else.
+
+    Nothing past the cfg is worked out until the
+    first promotion, short programs never pay for
+    liveness, register allocation or the jit.
+*/
+
+struct ThreadedOp {
+    void* handler;  // label in interp_run, filled in on the first run
+    uint32_t opcode;
+    uint32_t rd;
+    uint32_t rs1;
+    uint32_t rs2;
+    int64_t imm;
+    size_t target;  // op index jumps go to, block index for block entries
+};
+
+// pseudo opcodes past the real ones
+enum { OP_BLOCK = 64, OP_EXIT, OP_LOOP };
+
+Interp* interp_create(CFG* cfg, CodeArena* arena, JitOptions* options, RegAllocMode mode, uint64_t threshold,
+                      uint64_t osr_threshold) {
+    Interp* interp = calloc(1, sizeof(Interp));
+    interp->cfg = cfg;
+    interp->arena = arena;
+    interp->options = options;
+    interp->regalloc_mode = mode;
+    interp->threshold = threshold;
+    interp->osr_threshold = osr_threshold;
+
+    // every block and its instructions, the exit, and a trampoline per block
+    // for back edges (only loop headers end up using theirs)
+    size_t ops = 2 * cfg->count + 1;
+    for (size_t i = 0; i < cfg->count; i++)
+        ops += cfg->nodes[i]->instructions_count;
+
+    interp->code = calloc(ops, sizeof(ThreadedOp));
+    interp->code_count = ops;
+    interp->block_op = malloc(sizeof(size_t) * (cfg->count + 1));
+    interp->loop_op = malloc(sizeof(size_t) * cfg->count);
+    interp->counters = calloc(cfg->count, sizeof(uint64_t));
+    interp->backedges = calloc(cfg->count, sizeof(uint64_t));
+    interp->units = calloc(cfg->count, sizeof(JitUnit));
+
+    size_t n = 0;
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        interp->block_op[i] = n;
+        interp->code[n++] = (ThreadedOp){.opcode = OP_BLOCK, .target = i};
+        for (size_t j = 0; j < bb->instructions_count; j++) {
+            ParsedInstruction* pi = bb->instructions[j];
+            ThreadedOp* op = &interp->code[n++];
+            op->opcode = pi->opcode;
+            op->rd = pi->rd;
+            op->rs1 = pi->rs1;
+            op->rs2 = pi->rs2;
+            op->imm = pi->imm;
+        }
+    }
+    interp->block_op[cfg->count] = n;
+    interp->code[n++] = (ThreadedOp){.opcode = OP_EXIT};
+
+    for (size_t i = 0; i < cfg->count; i++) {
+        interp->loop_op[i] = n;
+        interp->code[n++] = (ThreadedOp){.opcode = OP_LOOP, .target = i};
+    }
+
+    // jumps only ever end a block, point them at the target's entry op or at
+    // its trampoline if they jump backwards
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        ThreadedOp* last = &interp->code[interp->block_op[i] + bb->instructions_count];
+        if (!is_jump__(last->opcode))
+            continue;
+        if (bb->target == NULL)
+            last->target = interp->block_op[cfg->count];
+        else if (is_back_edge(bb, bb->target))
+            last->target = interp->loop_op[bb->target->index];
+        else
+            last->target = interp->block_op[bb->target->index];
+    }
+
+    return interp;
+}
+
+void interp_free(Interp* interp) {
+    free(interp->code);
+    free(interp->block_op);
+    free(interp->loop_op);
+    free(interp->counters);
+    free(interp->backedges);
+    free(interp->units);
+    free(interp);
+}
+
+// compile the blocks in in_region into a unit entered at b
+static void compile_unit(Interp* interp, size_t b, uint8_t* in_region, size_t blocks, char* why) {
+    CFG* cfg = interp->cfg;
+    if (!interp->allocated) {
+        compute_liveness(cfg, 1 << RETURN_REG);
+        regalloc_program(cfg, interp->regalloc_mode);
+        interp->state_disp = regalloc_frame_slot(cfg->regalloc);
+        interp->allocated = 1;
+    }
+
+    CodeArena* arena = interp->arena;
+    arena_unseal(arena);
+    uint8_t* start = arena->advance;
+    interp->units[b] = jit_unit(&arena->advance, cfg, in_region, b, interp->state_disp, interp->options);
+    arena_seal(arena);
+    interp->promoted++;
+
+    if (interp->options->debug)
+        printf("%s: block %zu (%zu blocks, %zu bytes)\n", why, b, blocks, (size_t)(arena->advance - start));
+}
+
+// the hot block b along with everything reachable from it that has already
+// run, blocks that haven't are left to the interpreter
+static void promote(Interp* interp, size_t b) {
+    CFG* cfg = interp->cfg;
+    uint8_t* in_region = calloc(cfg->count, 1);
+    size_t* stack = malloc(sizeof(size_t) * cfg->count);
+    size_t sp = 0;
+    size_t blocks = 1;
+    in_region[b] = 1;
+    stack[sp++] = b;
+    while (sp) {
+        BasicBlock* bb = cfg->nodes[stack[--sp]];
+        for (size_t i = 0; i < bb->outgoing_count; i++) {
+            size_t next = bb->outgoing[i]->index;
+            if (!in_region[next] && interp->counters[next]) {
+                in_region[next] = 1;
+                stack[sp++] = next;
+                blocks++;
+            }
+        }
+    }
+
+    compile_unit(interp, b, in_region, blocks, "tier up");
+    free(stack);
+    free(in_region);
+}
+
+// on stack replacement: the interpreter is somewhere inside the loop headed
+// by h and about to go around again. the whole loop body is compiled (not
+// just what has run, a cold path inside a hot loop shouldn't bounce us back
+// out) and the caller jumps into it with the interpreter's registers
+static void promote_loop(Interp* interp, size_t h) {
+    CFG* cfg = interp->cfg;
+    uint8_t* in_loop = calloc(cfg->count, 1);
+    size_t blocks = natural_loop(cfg, cfg->nodes[h], in_loop);
+
+    compile_unit(interp, h, in_loop, blocks, "osr");
+    interp->osr_entries++;
+    free(in_loop);
+}
+
+static void trap_division(void) {
+    raise(SIGFPE);
+}
+
+uint64_t interp_run(void* arg) {
+    static void* handlers[] = {
+        [U2_MOV] = &&op_mov,
+        [U2_LI] = &&op_li,
+        [U2_LD] = &&op_ld,
+        [U2_ST] = &&op_st,
+        [U2_ADD] = &&op_add,
+        [U2_SUB] = &&op_sub,
+        [U2_MUL] = &&op_mul,
+        [U2_DIV] = &&op_div,
+        [U2_AND] = &&op_and,
+        [U2_OR] = &&op_or,
+        [U2_XOR] = &&op_xor,
+        [U2_NOT] = &&op_not,
+        [U2_SHL] = &&op_shl,
+        [U2_SHR] = &&op_shr,
+        [U2_CMP] = &&op_cmp,
+        [U2_JMP] = &&op_jmp,
+        [U2_JE] = &&op_je,
+        [U2_JNE] = &&op_jne,
+        [U2_JL] = &&op_jl,
+        [U2_JG] = &&op_jg,
+        [U2_VLD] = &&op_vld,
+        [U2_VST] = &&op_vst,
+        [U2_VADD] = &&op_vadd,
+        [U2_VSUB] = &&op_vsub,
+        [U2_VMUL] = &&op_vmul,
+        [U2_VAND] = &&op_vand,
+        [U2_VOR] = &&op_vor,
+        [U2_VXOR] = &&op_vxor,
+        [U2_VCMPEQ] = &&op_vcmpeq,
+        [U2_VCMPGT] = &&op_vcmpgt,
+        [OP_BLOCK] = &&op_block,
+        [OP_EXIT] = &&op_exit,
+        [OP_LOOP] = &&op_loop,
+    };
+
+    Interp* interp = arg;
+    ThreadedOp* code = interp->code;
+    uint64_t* regs = interp->state.regs;
+    uint8_t* mem = interp->state.mem;
+    uint32_t(*vregs)[VECTOR_LANES] = interp->state.vregs;
+
+    if (code[0].handler == NULL) {
+        for (size_t i = 0; i < interp->code_count; i++)
+            code[i].handler = handlers[code[i].opcode];
+    }
+
+    ThreadedOp* op = code;
+#define NEXT() goto *(++op)->handler
+#define JUMP(to) goto *(op = &code[to])->handler
+// vd = vs1 op vs2 a lane at a time, a and b are the lanes
+#define VECTOR_OP(expr)                                        \
+    for (int i = 0; i < VECTOR_LANES; i++) {                   \
+        uint32_t a = vregs[op->rs1][i];                        \
+        uint32_t b = vregs[op->rs2][i];                        \
+        vregs[op->rd][i] = (expr);                             \
+    }                                                          \
+    NEXT()
+
+    goto *op->handler;
+
+op_mov:
+    regs[op->rd] = regs[op->rs1];
+    NEXT();
+op_li:
+    regs[op->rd] = op->imm;
+    NEXT();
+op_ld:
+    memcpy(&regs[op->rd], mem + (uint32_t)regs[op->rs1] + (int32_t)op->imm, 8);
+    NEXT();
+op_st:
+    memcpy(mem + (uint32_t)regs[op->rs2] + (int32_t)op->imm, &regs[op->rs1], 8);
+    NEXT();
+op_add:
+    regs[op->rd] = regs[op->rs1] + regs[op->rs2];
+    NEXT();
+op_sub:
+    regs[op->rd] = regs[op->rs1] - regs[op->rs2];
+    NEXT();
+op_mul:
+    regs[op->rd] = regs[op->rs1] * regs[op->rs2];
+    NEXT();
+op_div: {
+    int64_t a = regs[op->rs1];
+    int64_t b = regs[op->rs2];
+    if (b == 0 || (a == INT64_MIN && b == -1))
+        trap_division();
+    regs[op->rd] = a / b;
+    NEXT();
+}
+op_and:
+    regs[op->rd] = regs[op->rs1] & regs[op->rs2];
+    NEXT();
+op_or:
+    regs[op->rd] = regs[op->rs1] | regs[op->rs2];
+    NEXT();
+op_xor:
+    regs[op->rd] = regs[op->rs1] ^ regs[op->rs2];
+    NEXT();
+op_not:
+    regs[op->rd] = ~regs[op->rs1];
+    NEXT();
+op_shl:
+    regs[op->rd] = regs[op->rs1] << (op->imm & 63);
+    NEXT();
+op_shr:
+    regs[op->rd] = regs[op->rs1] >> (op->imm & 63);
+    NEXT();
+op_cmp: {
+    // same bits an x86 cmp would leave, compiled code picks them up as is
+    uint64_t a = regs[op->rs1];
+    uint64_t b = regs[op->rs2];
+    uint64_t r = a - b;
+    uint64_t flags = 0;
+    if (r == 0)
+        flags |= STATE_ZF;
+    if (r >> 63)
+        flags |= STATE_SF;
+    if (((a ^ b) & (a ^ r)) >> 63)
+        flags |= STATE_OF;
+    if (a < b)
+        flags |= STATE_CF;
+    interp->state.flags = flags;
+    NEXT();
+}
+op_jmp:
+    JUMP(op->target);
+op_je:
+    if (interp->state.flags & STATE_ZF)
+        JUMP(op->target);
+    NEXT();
+op_jne:
+    if (!(interp->state.flags & STATE_ZF))
+        JUMP(op->target);
+    NEXT();
+op_jl:
+    if (!(interp->state.flags & STATE_SF) != !(interp->state.flags & STATE_OF))
+        JUMP(op->target);
+    NEXT();
+op_jg:
+    if (!(interp->state.flags & STATE_ZF) && !(interp->state.flags & STATE_SF) == !(interp->state.flags & STATE_OF))
+        JUMP(op->target);
+    NEXT();
+op_vld:
+    memcpy(vregs[op->rd], mem + (uint32_t)regs[op->rs1] + (int32_t)op->imm, sizeof(vregs[0]));
+    NEXT();
+op_vst:
+    memcpy(mem + (uint32_t)regs[op->rs2] + (int32_t)op->imm, vregs[op->rs1], sizeof(vregs[0]));
+    NEXT();
+op_vadd:
+    VECTOR_OP(a + b);
+op_vsub:
+    VECTOR_OP(a - b);
+op_vmul:
+    VECTOR_OP(a * b);
+op_vand:
+    VECTOR_OP(a & b);
+op_vor:
+    VECTOR_OP(a | b);
+op_vxor:
+    VECTOR_OP(a ^ b);
+op_vcmpeq:
+    VECTOR_OP(a == b ? UINT32_MAX : 0);
+op_vcmpgt:
+    VECTOR_OP((int32_t)a > (int32_t)b ? UINT32_MAX : 0);
+op_block: {
+    size_t b = op->target;
+    if (interp->units[b] == NULL && interp->threshold && ++interp->counters[b] == interp->threshold)
+        promote(interp, b);
+    if (interp->units[b]) {
+        uint64_t next = interp->units[b](&interp->state);
+        JUMP(interp->block_op[next]);
+    }
+    NEXT();
+}
+op_loop: {
+    // taken back edge, falls through to h's entry op unless the loop is compiled
+    size_t h = op->target;
+    if (interp->units[h] == NULL && interp->osr_threshold && ++interp->backedges[h] == interp->osr_threshold)
+        promote_loop(interp, h);
+    if (interp->units[h]) {
+        uint64_t next = interp->units[h](&interp->state);
+        JUMP(interp->block_op[next]);
+    }
+    JUMP(interp->block_op[h]);
+}
+op_exit:
+    return regs[RETURN_REG];
+
+#undef NEXT
+#undef JUMP
+#undef VECTOR_OP
+}
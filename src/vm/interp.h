@@ -0,0 +1,50 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+/*
+ * interp.h
+ *
+ * Direct threaded interpreter, the first tier. Programs start out here and
+ * blocks that get hot enough are handed to the jit, see interp.c.
+ */
+
+#include "arena.h"
+#include "cfg.h"
+#include "regalloc.h"
+#include "state.h"
+#include "x86jit.h"
+
+#define INTERP_DEFAULT_THRESHOLD 1000
+#define INTERP_DEFAULT_OSR_THRESHOLD 500
+
+typedef struct ThreadedOp ThreadedOp;
+
+typedef struct {
+    VMState state;
+    CFG* cfg;
+    ThreadedOp* code;        // one op per instruction plus one per block entry
+    size_t code_count;       // ops in code, the exit and trampolines included
+    size_t* block_op;        // index into code of each block's entry op, [count] is the exit
+    size_t* loop_op;         // index into code of each block's back edge trampoline
+    uint64_t* counters;      // times each block was entered
+    uint64_t* backedges;     // times each loop header was jumped back to
+    JitUnit* units;          // compiled code entered at each block, NULL until hot
+
+    // promotion
+    uint64_t threshold;      // block entries before compiling, 0 never compiles
+    uint64_t osr_threshold;  // loop iterations before compiling the loop, 0 never does
+    CodeArena* arena;
+    JitOptions* options;
+    RegAllocMode regalloc_mode;
+    int allocated;           // liveness and registers are only worked out on first promotion
+    int32_t state_disp;      // frame slot units keep the VMState* in
+    size_t promoted;         // units compiled so far
+    size_t osr_entries;      // of which were loops entered mid flight
+} Interp;
+
+Interp* interp_create(CFG* cfg, CodeArena* arena, JitOptions* options, RegAllocMode mode, uint64_t threshold,
+                      uint64_t osr_threshold);
+void interp_free(Interp* interp);
+uint64_t interp_run(void* interp);
+
+#endif
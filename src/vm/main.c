@@ -1,19 +1,34 @@
 #include "../common/config.h"
 #include "../common/instruction.h"
+#include "../common/stats.h"
 #include <inttypes.h>  // PRIX64
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>    // strerror
-#include <sys/mman.h>  // mmap
+#include <string.h>  // strerror
 
+#include "aot.h"
+#include "arena.h"
+#include "baseline.h"
+#include "batch.h"
 #include "cfg.h"
+#include "counts.h"
+#include "decode.h"
+#include "interp.h"
+#include "memory.h"
+#include "profile.h"
+#include "regalloc.h"
+#include "state.h"
 #include "x86jit.h"
 
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "../common/debug.h"
 
-int DEV_DEBUG = 0;
+// --dev, read only here. everything past main gets it through JitOptions
+static int DEV_DEBUG = 0;
 
 /**
     U2 VIRTUAL MACHINE
@@ -21,126 +36,56 @@ int DEV_DEBUG = 0;
     This is the main file for the u2 virtual machine
     u2 bytecode -> x86 execution
 
-    Usage = u2vm bytecode.u2b
+    Usage = u2vm [--dev] [--regalloc=linear|graph] [--mem=SIZE]
+                 [--align-blocks=N] [--align-loops=N] [--huge-pages]
+                 [--tiered] [--hot-threshold=N] [--osr-threshold=N] [--lazy]
+                 [--jit-threads=N] [--baseline] [--aot=FILE] [--aot-object=FILE]
+                 [--perf-map] [--jitdump] [--gdb-jit] [--profile-sample[=US]]
+                 [--count-blocks[=FILE]] [--use-profile[=FILE]] [--stats]
+                 [--batch[=FILE]] [--batch-out=FILE] [--batch-format=csv|bin]
+                 [--batch-regs=N] [--batch-threads=N] [--simd=sse2|avx2]
+                 bytecode.u2b
+           u2vm --caps
+
+    --perf-map, --jitdump and --gdb-jit name compiled code for perf and gdb,
+    see symbols.h. labels come from bytecode.u2b.sym when u2asm --sym made one
+
+    --profile-sample samples the running program every US microseconds of cpu
+    time and prints where it spent them per block and per label, see profile.h
+
+    --count-blocks counts every block entry and branch exactly and writes them
+    as JSON to FILE, bytecode.u2b.counts by default, see counts.c
+
+    --use-profile compiles for the counts --count-blocks recorded in FILE (same
+    default): never run blocks are moved out of the way and not aligned, only
+    hot loops are aligned, branches are turned so the likely side falls
+    through and spill costs are the real counts
+
+    --stats prints time and peak heap per phase and the size of the program at
+    each step as JSON on stderr, see stats.h
+
+    --batch compiles once and runs the program for every record in FILE
+    (stdin by default), each starting with r1..rN (N is 16 unless
+    --batch-regs says otherwise) from the record and writing r1..rN back to
+    --batch-out (stdout by default) once it ends. records are csv lines or
+    --batch-format=bin words, see batch.h. --batch-threads picks how many
+    workers share them, one per online cpu by default
+
+    --caps prints the capabilities this host runs natively (see
+    common/instruction.h) as a list for u2asm --caps, which expands
+    everything else into instructions the host does have
+
+    --simd picks what vector instructions compile to. avx2 whenever the cpu
+    has it by default, except for --aot which sticks to sse2 so the output
+    runs on any x86-64 unless asked otherwise. --baseline is always sse2
 */
 
-typedef struct {
-    uint8_t** jit_memory;  // pointer to the advance pointer, main way of
-                           // interfacing with jit memory
-    uint8_t* jit_base;     // pointer to the beginning of jit memory
-    uint8_t* jit_advance;  // pointer to the current position in jit_memory
-} Context;
-
 typedef struct {
     uint32_t reg;
     uint32_t start;
     uint32_t end;
 } RegisterLifetime;
 
-// global for cfg pass
-ParsedArray* parsed_arr;
-
-uint32_t next_instruction(FILE* f, uint32_t* inst) {
-    size_t n = fread(inst, sizeof(uint32_t), 1, f);
-    if (n != 1) {
-        if (feof(f)) {
-            return 0;
-        } else {
-            printf("Error reading instruction\n");
-            exit(EXIT_FAILURE);
-        }
-    }
-    return 1;
-}
-
-uint32_t get_opcode(uint32_t inst) {
-    return inst >> (32 - OPCODE_BITS);
-}
-
-uint32_t get_rd(uint32_t inst) {
-    return (inst >> (32 - OPCODE_BITS - REG_BITS)) & ((1u << REG_BITS) - 1);
-}
-
-uint32_t get_rs1(uint32_t inst) {
-    return (inst >> (32 - OPCODE_BITS - 2 * REG_BITS)) & ((1u << REG_BITS) - 1);
-}
-
-uint32_t get_rs2(uint32_t inst) {
-    return (inst >> (32 - OPCODE_BITS - 3 * REG_BITS)) & ((1u << REG_BITS) - 1);
-}
-
-int64_t get_imm(uint32_t inst) {
-    uint32_t mask = (1u << IMM_BITS) - 1;
-    int imm = inst & mask;
-    // sign extend
-    if (imm & (1u << (IMM_BITS - 1))) {
-        imm |= ~mask;
-    }
-    return imm;
-}
-
-void do_pass(void (*pass_eval)(ParsedInstruction*, Context*), Context* context, FILE* fptr) {
-    rewind(fptr);  // reset i/o if not already
-    uint32_t instruction;
-    while (next_instruction(fptr, &instruction)) {
-        ParsedInstruction* parsed = malloc(sizeof(ParsedInstruction));
-        uint32_t opcode = get_opcode(instruction);
-        uint32_t rd = get_rd(instruction);
-        uint32_t rs1 = get_rs1(instruction);
-        uint32_t rs2 = get_rs2(instruction);
-        int64_t immediate = get_imm(instruction);
-        Instruction instructionObj = Instructions[opcode];
-
-        parsed->opcode = opcode;
-        parsed->rd = rd;
-        parsed->rs1 = rs1;
-        parsed->rs2 = rs2;
-        parsed->imm = immediate;
-        parsed->imm_ext = 0;
-        parsed->obj = instructionObj;
-
-        // check for long immediates
-        if (rs2 && !(instructionObj.format & 0b0100)) {  // value in rs2 when
-                                                         // one shouldn't be
-                                                         // expected
-            if (!(instructionObj.format & 0b1000)) {     // check imm extension is supported
-                fprintf(stderr,
-                        "Immediate extension is not supported for"
-                        " instructions of type %s",
-                        instructionObj.name);
-                exit(EXIT_FAILURE);
-            }
-
-            // if rs2 contains 1 or 2 load next rs2 bytes into imm
-            if (rs2 == 1 || rs2 == 2) {
-                parsed->imm_ext = 1;
-                uint32_t imm_ext;
-                int captured = next_instruction(fptr, &imm_ext);
-                if (!captured) {
-                    fprintf(stderr, "Expected immediate extension but instead recieved"
-                                    " EOF? Check rs2 value for last inst.\n");
-                }
-                immediate = imm_ext;
-                if (rs2 == 2) {
-                    parsed->imm_ext = 2;
-                    captured = next_instruction(fptr, &imm_ext);
-                    if (!captured) {
-                        fprintf(stderr, "Expected immediate extension but instead"
-                                        " recieved EOF? Check rs2 value for second to"
-                                        " last inst.\n");
-                    }
-                    immediate |= (int64_t)imm_ext << 32;
-                }
-            } else {
-                fprintf(stderr, "Invalid rs2 value\n");
-            }
-        }
-        parsed->imm = immediate;
-        pass_eval(parsed, context);
-        free(parsed);
-    }
-}
-
 void _DEBUG_parsed_instruction(ParsedInstruction* parsed) {
     printf_DEBUG("ParsedInstruction {\n");
     printf_DEBUG("\topcode: %u (%s)\n", parsed->opcode, instruction_from_id(parsed->opcode));
@@ -174,6 +119,15 @@ void print_bitmask(uint16_t mask) {
         putchar((mask & (1 << i)) ? '1' : '0');
 }
 
+// which block each instruction ended up in
+void _DEBUG_blocks(CFG* cfg) {
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        for (size_t j = 0; j < bb->instructions_count; j++)
+            printf_DEBUG("Added instruction %lu to bb %ld\n", bb->leader + j, i);
+    }
+}
+
 void _DEBUG_cfg(CFG* cfg) {
     printf_DEBUG("\n===== CFG DEBUG =====\n");
     printf_DEBUG("CFG block count: %lu\n", cfg->count);
@@ -231,49 +185,162 @@ void _DEBUG_cfg(CFG* cfg) {
     printf_DEBUG("\n======================\n");
 }
 
-void cfg_pass(ParsedInstruction* parsed, Context* context) {
-    push_parsed_array(parsed_arr, parsed);
-    _DEBUG_parsed_instruction(parsed);
-    (void)context;
+void _DEBUG_regalloc(RegAllocation* ra) {
+    printf_DEBUG("===== register allocation =====\n");
+    char* modes[] = {[REGALLOC_LINEAR] = "linear", [REGALLOC_GRAPH] = "graph", [REGALLOC_IDENTITY] = "identity"};
+    printf_DEBUG("mode: %s\n", modes[ra->mode]);
+    for (int r = 0; r < 16; r++) {
+        if (!(ra->used & (1 << r)))
+            continue;
+        if (ra->x86[r] == _x86_SPILL) {
+            printf_DEBUG("  r%d -> [rsp+%d]\n", r, regalloc_spill_disp(ra, r));
+        } else {
+            printf_DEBUG("  r%d -> %s\n", r, x86_register_name(ra->x86[r]));
+        }
+    }
+    for (int r = 0; r < 16; r++) {
+        if (ra->vector_used & (1 << r))
+            printf_DEBUG("  v%d -> [rsp+%d]\n", r, regalloc_vector_disp(ra, r));
+    }
+    printf_DEBUG("spills: %d\n", ra->spill_count);
+    printf_DEBUG("coalesced: %d\n", ra->coalesced_count);
+    printf_DEBUG("saved:");
+    for (int reg = 0; reg < 16; reg++) {
+        if ((ra->x86_used & (1 << reg)) && x86_is_callee_saved(reg)) {
+            printf_DEBUG(" %s", x86_register_name(reg));
+        }
+    }
+    printf_DEBUG("\n");
+    printf_DEBUG("frame: %d bytes\n", ra->frame_size);
+    printf_DEBUG("\n");
+    // timings would make the reference outputs nondeterministic, keep them on stderr
+    if (DEV_DEBUG)
+        fprintf(stderr, "regalloc: %d spills in %.3f us\n", ra->spill_count, ra->time_ns / 1000.0);
+}
+
+// byte count with an optional k/m/g suffix
+size_t parse_size(char* str) {
+    char* end;
+    size_t size = strtoull(str, &end, 0);
+    switch (*end) {
+    case 'k':
+    case 'K':
+        size <<= 10;
+        break;
+    case 'm':
+    case 'M':
+        size <<= 20;
+        break;
+    case 'g':
+    case 'G':
+        size <<= 30;
+        break;
+    case '\0':
+        break;
+    default:
+        fprintf(stderr, "Invalid size: %s\n", str);
+        exit(EXIT_FAILURE);
+    }
+    return size;
+}
+
+// power of two code alignment, 0 and 1 both mean none
+size_t parse_alignment(char* str) {
+    size_t alignment = parse_size(str);
+    if (alignment & (alignment - 1)) {
+        fprintf(stderr, "Alignment must be a power of two: %s\n", str);
+        exit(EXIT_FAILURE);
+    }
+    return alignment ? alignment : 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 0 means one per online cpu
+int parse_threads(char* str) {
+    long threads = strtol(str, NULL, 0);
+    if (threads == 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1 || threads > 1024) {
+        fprintf(stderr, "Bad thread count: %s\n", str);
+        exit(EXIT_FAILURE);
+    }
+    return threads;
+}
+
+// registers in a --batch record, 1 to 16
+int parse_batch_regs(char* str) {
+    char* end;
+    long regs = strtol(str, &end, 0);
+    if (*end != '\0' || regs < 1 || regs > 16) {
+        fprintf(stderr, "Bad register count: %s\n", str);
+        exit(EXIT_FAILURE);
+    }
+    return regs;
+}
+
+// microseconds between samples, at least 1
+long parse_interval(char* str) {
+    char* end;
+    long interval = strtol(str, &end, 0);
+    if (*end != '\0' || interval < 1) {
+        fprintf(stderr, "Bad sampling interval: %s\n", str);
+        exit(EXIT_FAILURE);
+    }
+    return interval;
 }
 
-void jit_pass(ParsedInstruction* parsed, Context* context) {
-    // debug
-    /*switch (parsed->obj.format) {
-        case FORMAT_F:
-            printf(" r%d r%d r%d", parsed->rd + 1, parsed->rs1 + 1, parsed->rs2 + 1);
-            break;
-        case FORMAT_R:
-            printf(" r%d r%d", parsed->rd + 1, parsed->rs1 + 1);
-            break;
-        case FORMAT_I:
-            printf(" r%d %" PRIX64, parsed->rd + 1, parsed->imm);
-            break;
-        case FORMAT_J:
-            printf(" %" PRIX64, parsed->imm);
-            break;
-        case FORMAT_D:
-            printf(" r%d", parsed->rd + 1);
-            break;
-        case FORMAT_NONE:
-            break;
-        default:
-            printf(" [unknown]");
-            exit(1);
-            break;
-    }
-    printf("\n");*/
-
-    emit_jit(context->jit_memory, parsed->opcode, parsed->rd, parsed->rs1, parsed->rs2, parsed->imm);
+// the synopsis at the top of this file, for every error about the command line
+static void usage(void) {
+    fprintf(stderr, "Usage: u2vm [--dev] [--regalloc=linear|graph] [--mem=SIZE]\n"
+                    "            [--align-blocks=N] [--align-loops=N] [--huge-pages]\n"
+                    "            [--tiered] [--hot-threshold=N] [--osr-threshold=N] [--lazy]\n"
+                    "            [--jit-threads=N] [--baseline] [--aot=FILE] [--aot-object=FILE]\n"
+                    "            [--perf-map] [--jitdump] [--gdb-jit] [--profile-sample[=US]]\n"
+                    "            [--count-blocks[=FILE]] [--use-profile[=FILE]] [--stats]\n"
+                    "            [--batch[=FILE]] [--batch-out=FILE] [--batch-format=csv|bin]\n"
+                    "            [--batch-regs=N] [--batch-threads=N] [--simd=sse2|avx2]\n"
+                    "            bytecode.u2b\n"
+                    "       u2vm --caps\n");
 }
 
-void free_context(Context* context) {
-    free(context);
+// as a list u2asm --caps reads back
+static void print_capabilities(uint32_t caps) {
+    printf("base");
+    for (uint32_t cap = 1; cap & CAP_ALL; cap <<= 1) {
+        if (caps & cap)
+            printf(",%s", capability_name(cap));
+    }
+    printf("\n");
 }
 
 int main(int argc, char** argv) {
     DEV_DEBUG = 0;
     char* bytecodePath = NULL;
+    RegAllocMode regalloc_mode = REGALLOC_LINEAR;
+    size_t memory_size = MEMORY_DEFAULT_SIZE;
+    JitOptions jit_options = {.block_align = 1, .loop_align = 16, .threads = 1};
+    int huge_pages = 0;
+    int tiered = 0;
+    int lazy = 0;
+    int baseline = 0;
+    char* aot_path = NULL;
+    AotKind aot_kind = AOT_EXECUTABLE;
+    int symbol_outputs = 0;
+    long profile_interval = 0;
+    int count_blocks = 0;
+    char* counts_path = NULL;
+    int use_profile = 0;
+    char* profile_path = NULL;
+    uint64_t hot_threshold = INTERP_DEFAULT_THRESHOLD;
+    uint64_t osr_threshold = INTERP_DEFAULT_OSR_THRESHOLD;
+    int batch = 0;
+    int simd = -1;  // avx2 or not, -1 until known
+    BatchOptions batch_options = {.format = BATCH_CSV, .regs = 16, .threads = parse_threads("0")};
 
     // parse args
     for (int i = 1; i < argc; i++) {
@@ -283,9 +350,86 @@ int main(int argc, char** argv) {
             // flags
             if (strcmp(arg, "--dev") == 0) {
                 DEV_DEBUG = 1;
+                jit_options.debug = 1;
+            } else if (strcmp(arg, "--caps") == 0) {
+                print_capabilities(host_capabilities());
+                return 0;
+            } else if (strcmp(arg, "--regalloc=linear") == 0) {
+                regalloc_mode = REGALLOC_LINEAR;
+            } else if (strcmp(arg, "--regalloc=graph") == 0) {
+                regalloc_mode = REGALLOC_GRAPH;
+            } else if (strncmp(arg, "--mem=", 6) == 0) {
+                memory_size = parse_size(arg + 6);
+            } else if (strncmp(arg, "--align-blocks=", 15) == 0) {
+                jit_options.block_align = parse_alignment(arg + 15);
+            } else if (strncmp(arg, "--align-loops=", 14) == 0) {
+                jit_options.loop_align = parse_alignment(arg + 14);
+            } else if (strcmp(arg, "--huge-pages") == 0) {
+                huge_pages = 1;
+            } else if (strncmp(arg, "--jit-threads=", 14) == 0) {
+                jit_options.threads = parse_threads(arg + 14);
+            } else if (strcmp(arg, "--lazy") == 0) {
+                lazy = 1;
+            } else if (strncmp(arg, "--aot=", 6) == 0) {
+                aot_path = arg + 6;
+                aot_kind = AOT_EXECUTABLE;
+            } else if (strncmp(arg, "--aot-object=", 13) == 0) {
+                aot_path = arg + 13;
+                aot_kind = AOT_OBJECT;
+            } else if (strcmp(arg, "--baseline") == 0) {
+                baseline = 1;
+            } else if (strcmp(arg, "--perf-map") == 0) {
+                symbol_outputs |= SYMBOLS_PERF_MAP;
+            } else if (strcmp(arg, "--jitdump") == 0) {
+                symbol_outputs |= SYMBOLS_JITDUMP;
+            } else if (strcmp(arg, "--gdb-jit") == 0) {
+                symbol_outputs |= SYMBOLS_GDB;
+            } else if (strcmp(arg, "--profile-sample") == 0) {
+                profile_interval = PROFILE_DEFAULT_INTERVAL;
+            } else if (strncmp(arg, "--profile-sample=", 17) == 0) {
+                profile_interval = parse_interval(arg + 17);
+            } else if (strcmp(arg, "--count-blocks") == 0) {
+                count_blocks = 1;
+            } else if (strncmp(arg, "--count-blocks=", 15) == 0) {
+                count_blocks = 1;
+                counts_path = arg + 15;
+            } else if (strcmp(arg, "--use-profile") == 0) {
+                use_profile = 1;
+            } else if (strncmp(arg, "--use-profile=", 14) == 0) {
+                use_profile = 1;
+                profile_path = arg + 14;
+            } else if (strcmp(arg, "--stats") == 0) {
+                stats.enabled = 1;
+            } else if (strcmp(arg, "--batch") == 0) {
+                batch = 1;
+            } else if (strncmp(arg, "--batch=", 8) == 0) {
+                batch = 1;
+                batch_options.in_path = arg + 8;
+            } else if (strncmp(arg, "--batch-out=", 12) == 0) {
+                batch_options.out_path = arg + 12;
+            } else if (strcmp(arg, "--batch-format=csv") == 0) {
+                batch_options.format = BATCH_CSV;
+            } else if (strcmp(arg, "--batch-format=bin") == 0) {
+                batch_options.format = BATCH_BINARY;
+            } else if (strncmp(arg, "--batch-regs=", 13) == 0) {
+                batch_options.regs = parse_batch_regs(arg + 13);
+            } else if (strncmp(arg, "--batch-threads=", 16) == 0) {
+                batch_options.threads = parse_threads(arg + 16);
+            } else if (strcmp(arg, "--simd=sse2") == 0) {
+                simd = 0;
+            } else if (strcmp(arg, "--simd=avx2") == 0) {
+                simd = 1;
+            } else if (strcmp(arg, "--tiered") == 0) {
+                tiered = 1;
+            } else if (strncmp(arg, "--hot-threshold=", 16) == 0) {
+                tiered = 1;
+                hot_threshold = strtoull(arg + 16, NULL, 0);
+            } else if (strncmp(arg, "--osr-threshold=", 16) == 0) {
+                tiered = 1;
+                osr_threshold = strtoull(arg + 16, NULL, 0);
             } else {
                 fprintf(stderr, "Unknown flag: %s\n", arg);
-                fprintf(stderr, "Usage: u2vm [flags] bytecode.u2b\n");
+                usage();
                 exit(EXIT_FAILURE);
             }
         } else {
@@ -294,16 +438,51 @@ int main(int argc, char** argv) {
                 bytecodePath = arg;
             } else {
                 fprintf(stderr, "Too many arguments.\n");
-                fprintf(stderr, "Usage: u2vm [flags] bytecode.u2b\n");
+                usage();
                 exit(EXIT_FAILURE);
             }
         }
     }
 
+    if (baseline && (tiered || lazy)) {
+        fprintf(stderr, "--baseline can't be combined with --tiered or --lazy\n");
+        exit(EXIT_FAILURE);
+    }
+    if (aot_path && (tiered || lazy || baseline)) {
+        fprintf(stderr, "--aot can't be combined with --tiered, --lazy or --baseline\n");
+        exit(EXIT_FAILURE);
+    }
+    if (aot_path && profile_interval) {
+        fprintf(stderr, "--profile-sample needs the program to run, not --aot\n");
+        exit(EXIT_FAILURE);
+    }
+    // the interpreter and the stencils don't count, and the counters are
+    // addressed absolutely so they can't go in a file
+    if (count_blocks && (tiered || baseline || aot_path)) {
+        fprintf(stderr, "--count-blocks can't be combined with --tiered, --baseline or --aot\n");
+        exit(EXIT_FAILURE);
+    }
+    // the whole program is compiled up front as one unit, and counters would
+    // be bumped by every worker at once
+    if (batch && (tiered || lazy || baseline || aot_path || count_blocks)) {
+        fprintf(stderr, "--batch can't be combined with --tiered, --lazy, --baseline, --aot or --count-blocks\n");
+        exit(EXIT_FAILURE);
+    }
+    // an aot binary might not run where it was compiled
+    if (simd == 1 && !aot_path && !__builtin_cpu_supports("avx2")) {
+        fprintf(stderr, "--simd=avx2 but this cpu doesn't have avx2\n");
+        exit(EXIT_FAILURE);
+    }
+    jit_options.avx2 = simd < 0 ? !aot_path && __builtin_cpu_supports("avx2") : simd;
+    if (use_profile && baseline) {
+        fprintf(stderr, "--use-profile has nothing to tune in --baseline\n");
+        exit(EXIT_FAILURE);
+    }
+
     // does file exist??
     if (bytecodePath == NULL) {
         fprintf(stderr, "Missing bytecode file.\n");
-        fprintf(stderr, "Usage: u2vm [--dev] bytecode.u2b\n");
+        usage();
         exit(EXIT_FAILURE);
     }
 
@@ -314,31 +493,67 @@ int main(int argc, char** argv) {
         exit(EXIT_FAILURE);
     }
 
+    char* sym_path = malloc(strlen(bytecodePath) + 5);
+    sprintf(sym_path, "%s.sym", bytecodePath);
+    if (symbol_outputs)
+        jit_options.symbols = symbols_create(symbol_outputs, sym_path);
+    if (profile_interval)
+        jit_options.profile = profile_create(profile_interval);
+
     // prepare memory for jit execution
-    uint8_t* jit_base = mmap(NULL,  // address
-                             4096,  // size
-                             PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS,
-                             -1,  // fd
-                             0);  // offset
-    if (jit_base == MAP_FAILED) {
+    CodeArena* arena = arena_create(ARENA_DEFAULT_RESERVE, huge_pages);
+    if (arena == NULL) {
         fprintf(stderr, "Could not allocate memory for jit compilation!\n");
         exit(EXIT_FAILURE);
     }
-    uint8_t* jit_advance = jit_base;
-    uint8_t** jit_memory = &jit_advance;
-    init_jit(jit_memory);
-    Context* context = malloc(sizeof(Context));
-    context->jit_memory = jit_memory;
-    context->jit_base = jit_base;
-    context->jit_advance = jit_advance;
-
-    // init global for cfg pass
-    parsed_arr = init_parsed_array();
-    do_pass(cfg_pass, context, bytecodeFile);
+    uint8_t** jit_memory = &arena->advance;
+
+    stats_phase("decode");
+    ParsedArray* parsed_arr = decode_bytecode(bytecodeFile);
+    if (parsed_arr == NULL)
+        exit(EXIT_FAILURE);
+    for (size_t i = 0; i < parsed_arr->count; i++)
+        _DEBUG_parsed_instruction(parsed_arr->instructions[i]);
+    stats_phase("jumptable");
     JumpTable* jt = jumptable_from_parsed_array(parsed_arr);
+    if (jt == NULL)
+        exit(EXIT_FAILURE);
+    stats_phase("leaders");
     LeaderSet* ls = generate_leaders(parsed_arr, jt);
+    stats_phase("build_cfg");
     CFG* cfg = build_cfg(parsed_arr, jt, ls);
-    compute_liveness(cfg);
+    stats_done();
+    _DEBUG_blocks(cfg);
+    if (stats.enabled) {
+        size_t edges = 0;
+        for (size_t b = 0; b < cfg->count; b++)
+            edges += cfg->nodes[b]->outgoing_count;
+        stats_count("instructions", parsed_arr->count);
+        stats_count("blocks", cfg->count);
+        stats_count("edges", edges);
+    }
+    if (count_blocks)
+        jit_options.counters = counts_create(cfg);
+
+    // a profile that doesn't fit is only warned about, the program still runs
+    char* default_counts_path = malloc(strlen(bytecodePath) + 8);
+    sprintf(default_counts_path, "%s.counts", bytecodePath);
+    uint64_t bytecode_hash = counts_hash(bytecodePath);
+    if (use_profile) {
+        cfg->profile = counts_read(profile_path ? profile_path : default_counts_path, cfg, bytecode_hash);
+        printf_DEBUG("profile: %s\n", cfg->profile ? "loaded" : "not used");
+    }
+
+    // the interpreter works all of this out for itself once something is hot,
+    // stencils never need it
+    if (!tiered && !baseline) {
+        stats_phase("liveness");
+        uint16_t exit_live = batch ? batch_exit_live(batch_options.regs) : 1 << RETURN_REG;
+        stats_count("liveness_iterations", compute_liveness(cfg, exit_live));
+        stats_phase("regalloc");
+        regalloc_program(cfg, regalloc_mode);
+    }
+    stats_done();
 
     // debug jump table
     _DEBUG_jump_table(jt);
@@ -346,28 +561,182 @@ int main(int argc, char** argv) {
     // debug cfg
     _DEBUG_cfg(cfg);
 
-    do_pass(jit_pass, context, bytecodeFile);
+    // blocks are compiled as they are first reached, nothing to dump yet
+    JitLazy* jit_lazy_program = NULL;
+    BaselineEntry baseline_entry = NULL;
+    JitUnit batch_unit = NULL;
+    if (!tiered && lazy) {
+        _DEBUG_regalloc(cfg->regalloc);
+        jit_lazy_program = jit_lazy(arena, cfg, &jit_options);
+    } else if (!tiered) {
+        stats_phase("jit");
+        uint64_t jit_start = now_ns();
+        if (baseline) {
+            baseline_entry = baseline_program(jit_memory, cfg, &jit_options);
+            if (DEV_DEBUG) {
+                fprintf(stderr, "baseline: %zu bytes in %.3f us\n", (size_t)(*jit_memory - arena->base),
+                        (now_ns() - jit_start) / 1000.0);
+            }
+        } else if (batch) {
+            _DEBUG_regalloc(cfg->regalloc);
+
+            // every block, entered with a VMState at the first
+            int32_t state_disp = regalloc_frame_slot(cfg->regalloc);
+            uint8_t* in_region = malloc(cfg->count);
+            memset(in_region, 1, cfg->count);
+            batch_unit = jit_unit(jit_memory, cfg, in_region, 0, state_disp, &jit_options);
+            free(in_region);
+            if (DEV_DEBUG) {
+                fprintf(stderr, "jit: %zu bytes in %.3f us as a batch unit\n", (size_t)(*jit_memory - arena->base),
+                        (now_ns() - jit_start) / 1000.0);
+            }
+        } else {
+            // debug register allocation
+            _DEBUG_regalloc(cfg->regalloc);
+
+            jit_program(jit_memory, cfg, &jit_options);
+            if (DEV_DEBUG) {
+                fprintf(stderr, "jit: %zu bytes in %.3f us on %d threads\n", (size_t)(*jit_memory - arena->base),
+                        (now_ns() - jit_start) / 1000.0, jit_options.threads);
+            }
+        }
+        arena_seal(arena);
+        stats_done();
+
+        // dump machine code because god knows im not getting this right my first
+        // try or my second or third or fourth
+        size_t emitted_size = *jit_memory - arena->base;
+        printf_DEBUG("===== x86 dump =====\n");
+        for (size_t i = 0; i < emitted_size; i++) {
+            printf_DEBUG("%02X ", (unsigned char)arena->base[i]);
+        }
+        printf_DEBUG("\n\n");
+    }
+
+    // nothing runs, the compiled program goes to a file instead
+    if (aot_path) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t alignment = jit_options.block_align > jit_options.loop_align ? jit_options.block_align
+                                                                               : jit_options.loop_align;
+        size_t code_size = *jit_memory - arena->base;
+        arena_unseal(arena);
+        if (aot_write(aot_path, aot_kind, jit_memory, arena->base, alignment, (memory_size + page - 1) & ~(page - 1))) {
+            fprintf(stderr, "Error writing '%s': %s\n", aot_path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        printf_DEBUG("aot: %zu bytes of code written to %s\n", code_size, aot_path);
+        stats_count("x86_bytes", code_size);
+        stats_print("u2vm", stderr);
+
+        fclose(bytecodeFile);
+        symbols_free(jit_options.symbols);
+        free(sym_path);
+        free(default_counts_path);
+        free(cfg->profile);
+        arena_free(arena);
+        return 0;
+    }
 
-    // return from jit
-    free_jit(jit_memory);
-    emit_x86ret_reg(jit_memory, 1);
+    // every record runs on its own, in whatever worker gets to it
+    if (batch) {
+        if (jit_options.profile)
+            profile_start(jit_options.profile);
+        stats_phase("run");
+        batch_options.memory_size = memory_size;
+        batch_options.clear_memory = cfg->regalloc->uses_memory;
+        size_t records = 0;
+        uint64_t batch_start = now_ns();
+        long trapped = batch_run(batch_unit, &batch_options, &records);
+        stats_done();
+        if (DEV_DEBUG) {
+            double seconds = (now_ns() - batch_start) / 1e9;
+            fprintf(stderr, "batch: %zu records in %.3f ms on %d threads (%.0f records/s)\n", records, seconds * 1000,
+                    batch_options.threads, records / seconds);
+        }
+        if (jit_options.profile) {
+            profile_stop(jit_options.profile);
+            profile_report(jit_options.profile, cfg, sym_path, stderr);
+        }
+        stats_count("records", records);
+        stats_count("x86_bytes", *jit_memory - arena->base);
+        stats_print("u2vm", stderr);
+
+        fclose(bytecodeFile);
+        symbols_free(jit_options.symbols);
+        profile_free(jit_options.profile);
+        free(sym_path);
+        free(default_counts_path);
+        free(cfg->profile);
+        arena_free(arena);
+        return trapped ? EXIT_FAILURE : 0;
+    }
 
-    // dump machine code because god knows im not getting this right my first
-    // try or my second or third or fourth
-    size_t emitted_size = *jit_memory - jit_base;
-    printf_DEBUG("===== x86 dump =====\n");
-    for (size_t i = 0; i < emitted_size; i++) {
-        printf_DEBUG("%02X ", (unsigned char)jit_base[i]);
+    // linear memory for ld/st, reserved even if unused so traps have
+    // something to compare against
+    VMMemory* memory = memory_create(memory_size);
+    if (memory == NULL) {
+        fprintf(stderr, "Could not reserve vm memory!\n");
+        exit(EXIT_FAILURE);
     }
-    printf_DEBUG("\n\n");
 
-    // try to execute jit memory
-    uint64_t (*func)() = (uint64_t(*)())jit_base;
-    uint64_t result = func();
+    // try to execute jit memory (or interpret)
+    MemoryTrap trap;
+    uint64_t result;
+    if (jit_options.profile)
+        profile_start(jit_options.profile);
+    stats_phase("run");
+    if (tiered) {
+        Interp* interp = interp_create(cfg, arena, &jit_options, regalloc_mode, hot_threshold, osr_threshold);
+        interp->state.mem = memory->base;
+        result = memory_run(memory, interp_run, interp, &trap);
+        interp_free(interp);
+    } else if (jit_lazy_program) {
+        result = memory_run(memory, (RunEntry)jit_lazy_program->entry, memory->base, &trap);
+        printf_DEBUG("lazy: %zu of %zu blocks compiled\n", jit_lazy_program->compiled, cfg->count);
+        jit_lazy_free(jit_lazy_program);
+    } else if (baseline_entry) {
+        VMState state = {.mem = memory->base};
+        result = memory_run(memory, (RunEntry)baseline_entry, &state, &trap);
+    } else {
+        result = memory_run(memory, (RunEntry)arena->base, memory->base, &trap);
+    }
+    stats_done();
+    if (jit_options.profile) {
+        profile_stop(jit_options.profile);
+        profile_report(jit_options.profile, cfg, sym_path, stderr);
+    }
 
-    printf_DEBUG("%" PRIX64 "\n", result);
+    // written even after a trap, up to where it happened
+    if (count_blocks) {
+        char* path = counts_path ? counts_path : default_counts_path;
+        if (counts_write(path, cfg, jit_options.counters, bytecode_hash, sym_path)) {
+            fprintf(stderr, "Error writing '%s': %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        uint64_t entries = 0;
+        for (size_t b = 0; b < cfg->count; b++)
+            entries += jit_options.counters[b];
+        printf_DEBUG("counts: %" PRIu64 " block entries written to %s\n", entries, path);
+        free(jit_options.counters);
+    }
+    if (trap.signal == SIGSEGV) {
+        fprintf(stderr, "u2 trap: memory access out of bounds at 0x%" PRIX64 "\n", (uint64_t)trap.offset);
+    } else if (trap.signal == SIGFPE) {
+        fprintf(stderr, "u2 trap: division by zero or overflow\n");
+    } else {
+        printf_DEBUG("%" PRIX64 "\n", result);
+    }
+    // lazy and tiered code is only all there now
+    stats_count("x86_bytes", *jit_memory - arena->base);
+    stats_print("u2vm", stderr);
 
     fclose(bytecodeFile);
-    free_context(context);
-    return 0;
+    memory_free(memory);
+    symbols_free(jit_options.symbols);
+    profile_free(jit_options.profile);
+    free(sym_path);
+    free(default_counts_path);
+    free(cfg->profile);
+    arena_free(arena);
+    return trap.signal ? EXIT_FAILURE : 0;
 }
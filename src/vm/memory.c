@@ -0,0 +1,160 @@
+#include "memory.h"
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+    Guard page memory
+
+    Every address a u2 ld/st can form is within
+    [base - 2GiB, base + 6GiB), so the whole range
+    is reserved PROT_NONE up front and only the
+    first `size` bytes after base are opened up.
+    An out of bounds access faults instead of
+    needing a compare and branch in front of it,
+    the signal handler below turns that fault back
+    into a u2 trap.
+
+    Reserving 8GiB of address space costs nothing
+    but page table entries for pages actually
+    touched.
+
+    Both signals are synchronous, they arrive on
+    the thread that faulted, so everything the
+    handler needs is per thread and any number of
+    threads can be running programs at once. The
+    handlers themselves are per process. The first
+    run installs them and they stay, so a run costs
+    no sigaction calls and no lock. A signal that
+    isn't a u2 trap goes on to whatever handler was
+    there before, since an embedder may rely on its
+    own SIGSEGV handler (a GC write barrier, a
+    crash reporter).
+*/
+
+// the memory this thread is executing against, NULL when it isn't
+static __thread VMMemory* running;
+static __thread sigjmp_buf trap_env;
+static __thread volatile sig_atomic_t trap_signal;
+static __thread volatile int64_t trap_offset;
+
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+static struct sigaction old_segv, old_fpe;
+
+VMMemory* memory_create(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) & ~(page - 1);
+    if (size > (4ULL << 30)) {
+        fprintf(stderr, "Memory size %zu is larger than the 4GiB u2 can address\n", size);
+        return NULL;
+    }
+
+    size_t reserve = MEMORY_GUARD_BELOW + MEMORY_GUARD_ABOVE;
+    uint8_t* reservation = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED)
+        return NULL;
+
+    uint8_t* base = reservation + MEMORY_GUARD_BELOW;
+    if (size && mprotect(base, size, PROT_READ | PROT_WRITE) != 0) {
+        munmap(reservation, reserve);
+        return NULL;
+    }
+
+    VMMemory* memory = malloc(sizeof(VMMemory));
+    memory->reservation = reservation;
+    memory->base = base;
+    memory->size = size;
+    return memory;
+}
+
+void memory_free(VMMemory* memory) {
+    if (memory == NULL)
+        return;
+    munmap(memory->reservation, MEMORY_GUARD_BELOW + MEMORY_GUARD_ABOVE);
+    free(memory);
+}
+
+// back to all zeroes. the pages are handed back and come back zeroed on the
+// next touch, so this costs what the program touched, not what's there
+void memory_clear(VMMemory* memory) {
+    if (memory->size)
+        madvise(memory->base, memory->size, MADV_DONTNEED);
+}
+
+// hand a signal that isn't ours to the handler that was there before
+static void chain_handler(int sig, siginfo_t* info, void* ucontext) {
+    struct sigaction* old = sig == SIGSEGV ? &old_segv : &old_fpe;
+    if (old->sa_flags & SA_SIGINFO) {
+        old->sa_sigaction(sig, info, ucontext);
+        return;
+    }
+    if (old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN) {
+        old->sa_handler(sig);
+        return;
+    }
+    // sent with kill and ignored, nothing to do
+    if (old->sa_handler == SIG_IGN && info->si_code <= 0)
+        return;
+
+    // the default action. a real fault can't be ignored either, the kernel
+    // would kill the process anyway. returning re-executes the fault and dies
+    // normally, a sent signal has to be raised again (it's delivered once the
+    // handler returns)
+    signal(sig, SIG_DFL);
+    if (info->si_code <= 0)
+        raise(sig);
+}
+
+static void trap_handler(int sig, siginfo_t* info, void* ucontext) {
+    uint8_t* addr = info->si_addr;
+
+    // a fault on a thread that isn't running a program, or a segfault outside
+    // the reservation, is a bug in the vm (or whoever embeds it), not the program
+    if (running == NULL) {
+        chain_handler(sig, info, ucontext);
+        return;
+    }
+    uint8_t* end = running->reservation + MEMORY_GUARD_BELOW + MEMORY_GUARD_ABOVE;
+    if (sig == SIGSEGV && (addr < running->reservation || addr >= end)) {
+        chain_handler(sig, info, ucontext);
+        return;
+    }
+
+    trap_signal = sig;
+    trap_offset = sig == SIGSEGV ? addr - running->base : 0;
+    siglongjmp(trap_env, 1);
+}
+
+static void install_handlers(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = trap_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &old_segv);
+    sigaction(SIGFPE, &action, &old_fpe);
+}
+
+// run a program (jitted code or the interpreter) against memory, a guard page
+// hit (or a division trap) comes back as a filled in MemoryTrap
+uint64_t memory_run(VMMemory* memory, RunEntry entry, void* arg, MemoryTrap* trap) {
+    pthread_once(&handler_once, install_handlers);
+
+    running = memory;
+    trap_signal = 0;
+    trap_offset = 0;
+
+    uint64_t result = 0;
+    if (sigsetjmp(trap_env, 1) == 0)
+        result = entry(arg);
+    running = NULL;
+
+    trap->signal = trap_signal;
+    trap->offset = trap_offset;
+    return result;
+}
@@ -0,0 +1,41 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+/*
+ * memory.h
+ *
+ * Linear memory for ld/st. The jit never bounds checks an access, instead the
+ * memory sits inside a reservation big enough that every address a u2 program
+ * can form lands either in the memory itself or in PROT_NONE guard pages.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEMORY_DEFAULT_SIZE (16ULL << 20)
+
+// an address is zext32(register) + sext32(imm), so it can reach 2GiB below
+// the base and 4GiB + 2GiB above it. above gets a little extra so an access
+// starting at the very last of those (a vector is 32 bytes) ends in it too
+#define MEMORY_GUARD_BELOW (2ULL << 30)
+#define MEMORY_GUARD_ABOVE ((6ULL << 30) + (64 << 10))
+
+typedef struct {
+    uint8_t* reservation;  // start of the whole mapping, guard pages included
+    uint8_t* base;         // address 0 as seen by u2 code
+    size_t size;           // accessible bytes from base, rounded up to a page
+} VMMemory;
+
+typedef struct {
+    int signal;      // 0 if the program ran to completion
+    int64_t offset;  // faulting address relative to base (SIGSEGV only)
+} MemoryTrap;
+
+typedef uint64_t (*RunEntry)(void* arg);
+
+VMMemory* memory_create(size_t size);
+void memory_free(VMMemory* memory);
+void memory_clear(VMMemory* memory);
+uint64_t memory_run(VMMemory* memory, RunEntry entry, void* arg, MemoryTrap* trap);
+
+#endif
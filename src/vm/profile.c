@@ -0,0 +1,212 @@
+#define _GNU_SOURCE  // REG_RIP
+#include "profile.h"
+#include "symbols.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+/**
+    Sampling profiler
+
+    The signal handler does as little as it can:
+    it appends the interrupted rip to a buffer that
+    was allocated up front and nothing else, so it
+    is safe no matter what it interrupted, including
+    the jit compiling a lazy block or a unit in the
+    middle of the run.
+
+    Marks come from whoever compiles code, one per
+    instruction at its first byte plus a PROFILE_NO_PC
+    mark wherever code that isn't an instruction
+    starts (every batch ends in one). Samples are
+    only matched against the marks at the end, by
+    then all code is where it stays. A sample below
+    the first mark or after a PROFILE_NO_PC one is
+    outside compiled code, the interpreter or
+    something it called.
+
+    ITIMER_PROF counts cpu time, so a program that
+    waits on something isn't sampled while it does.
+*/
+
+// only one profile can be armed, the handler has nowhere else to find it
+static JitProfile* sampling;
+
+static void sample_handler(int sig, siginfo_t* info, void* context) {
+    (void)sig;
+    (void)info;
+    ucontext_t* uc = context;
+    size_t n = sampling->sample_count;
+    if (n < PROFILE_MAX_SAMPLES) {
+        sampling->samples[n] = uc->uc_mcontext.gregs[REG_RIP];
+        sampling->sample_count = n + 1;
+    } else {
+        sampling->dropped++;
+    }
+}
+
+JitProfile* profile_create(long interval) {
+    JitProfile* profile = calloc(1, sizeof(JitProfile));
+    profile->interval = interval;
+    profile->samples = malloc(sizeof(uintptr_t) * PROFILE_MAX_SAMPLES);
+    return profile;
+}
+
+// marks have to come in the order the code was emitted
+void profile_mark(JitProfile* profile, uint8_t* code, uint64_t pc) {
+    // an instruction that compiled to nothing shares its address with
+    // whatever comes next, which is what really is there
+    if (profile->mark_count && profile->marks[profile->mark_count - 1].code == code) {
+        profile->marks[profile->mark_count - 1].pc = pc;
+        return;
+    }
+    if (profile->mark_count == profile->mark_capacity) {
+        profile->mark_capacity = profile->mark_capacity ? profile->mark_capacity * 2 : 256;
+        profile->marks = realloc(profile->marks, sizeof(PcMark) * profile->mark_capacity);
+    }
+    profile->marks[profile->mark_count++] = (PcMark){.code = code, .pc = pc};
+}
+
+void profile_start(JitProfile* profile) {
+    sampling = profile;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = sample_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &profile->old_action);
+
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = profile->interval / 1000000, .tv_usec = profile->interval % 1000000},
+        .it_value = {.tv_sec = profile->interval / 1000000, .tv_usec = profile->interval % 1000000},
+    };
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void profile_stop(JitProfile* profile) {
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &profile->old_action, NULL);
+    sampling = NULL;
+}
+
+static int mark_cmp(const void* a, const void* b) {
+    uint8_t* x = ((const PcMark*)a)->code;
+    uint8_t* y = ((const PcMark*)b)->code;
+    return x < y ? -1 : x > y;
+}
+
+// pc of the instruction whose code holds rip, PROFILE_NO_PC if none does
+static uint64_t resolve(JitProfile* profile, uintptr_t rip) {
+    size_t lo = 0;
+    size_t hi = profile->mark_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((uintptr_t)profile->marks[mid].code <= rip)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? profile->marks[lo - 1].pc : PROFILE_NO_PC;
+}
+
+typedef struct {
+    uint64_t samples;
+    uint64_t pc;  // of the first instruction of the block, or of the label
+} ProfileRow;
+
+static int row_cmp(const void* a, const void* b) {
+    const ProfileRow* x = a;
+    const ProfileRow* y = b;
+    if (x->samples != y->samples)
+        return x->samples < y->samples ? 1 : -1;
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+// one line per row with any samples, blocks are named by pc and label
+static void print_rows(ProfileRow* rows, size_t count, int by_label, size_t total, char** labels, size_t label_count,
+                       FILE* out) {
+    qsort(rows, count, sizeof(ProfileRow), row_cmp);
+    fprintf(out, "  samples        %%  %s\n", by_label ? "label" : "block");
+    for (size_t i = 0; i < count && rows[i].samples; i++) {
+        fprintf(out, "%9lu  %6.2f%%  ", rows[i].samples, 100.0 * rows[i].samples / total);
+        char* label = rows[i].pc < label_count ? labels[rows[i].pc] : NULL;
+        if (by_label)
+            fprintf(out, "%s\n", label ? label : "(before any label)");
+        else if (label)
+            fprintf(out, "%lu %s\n", rows[i].pc, label);
+        else
+            fprintf(out, "%lu\n", rows[i].pc);
+    }
+}
+
+void profile_report(JitProfile* profile, CFG* cfg, const char* sym_path, FILE* out) {
+    size_t total = profile->sample_count;
+    if (total == 0) {
+        fprintf(out, "profile: no samples, the program ran for less than %ld us\n", profile->interval);
+        return;
+    }
+
+    qsort(profile->marks, profile->mark_count, sizeof(PcMark), mark_cmp);
+    uint64_t pc_count = 0;
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        uint64_t last = bb->instructions[bb->instructions_count - 1]->pc;
+        if (last >= pc_count)
+            pc_count = last + 1;
+    }
+
+    uint64_t* counts = calloc(pc_count, sizeof(uint64_t));
+    size_t outside = 0;
+    for (size_t i = 0; i < total; i++) {
+        uint64_t pc = resolve(profile, profile->samples[i]);
+        if (pc < pc_count)
+            counts[pc]++;
+        else
+            outside++;
+    }
+
+    size_t label_count;
+    char** labels = symbols_load_labels(sym_path, &label_count);
+
+    fprintf(out, "profile: %zu samples every %ld us, %zu outside compiled code", total, profile->interval, outside);
+    if (profile->dropped)
+        fprintf(out, ", %zu more dropped", (size_t)profile->dropped);
+    fprintf(out, "\n");
+
+    ProfileRow* rows = calloc(cfg->count > pc_count ? cfg->count : pc_count, sizeof(ProfileRow));
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        rows[i].pc = bb->instructions[0]->pc;
+        for (size_t j = 0; j < bb->instructions_count; j++)
+            rows[i].samples += counts[bb->instructions[j]->pc];
+    }
+    print_rows(rows, cfg->count, 0, total, labels, label_count, out);
+
+    // a label covers everything up to the next one
+    if (labels) {
+        size_t row_count = 0;
+        for (uint64_t pc = 0; pc < pc_count; pc++) {
+            if (row_count == 0 || (pc < label_count && labels[pc]))
+                rows[row_count++] = (ProfileRow){.pc = pc};
+            rows[row_count - 1].samples += counts[pc];
+        }
+        print_rows(rows, row_count, 1, total, labels, label_count, out);
+    } else {
+        fprintf(out, "no labels, assemble with u2asm --sym for a profile per label\n");
+    }
+
+    free(rows);
+    free(counts);
+    symbols_free_labels(labels, label_count);
+}
+
+void profile_free(JitProfile* profile) {
+    if (profile == NULL)
+        return;
+    free(profile->marks);
+    free(profile->samples);
+    free(profile);
+}
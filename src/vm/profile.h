@@ -0,0 +1,52 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * profile.h
+ *
+ * Sampling profiler for compiled code. While the program runs a SIGPROF timer
+ * records wherever it interrupted, the jit records where each u2 instruction's
+ * code starts, and at exit the two are matched up into a flat profile per
+ * block and per source label.
+ */
+
+#include "cfg.h"
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PROFILE_DEFAULT_INTERVAL 1000  // us of cpu time between samples
+
+// samples kept, a bit over 15 minutes at the default interval
+#define PROFILE_MAX_SAMPLES (1 << 20)
+
+// pc of code that doesn't belong to any instruction (entry, exit, stubs)
+#define PROFILE_NO_PC UINT64_MAX
+
+typedef struct {
+    uint8_t* code;  // first byte, runs up to the next mark
+    uint64_t pc;
+} PcMark;
+
+typedef struct JitProfile {
+    long interval;  // us
+
+    PcMark* marks;  // in no particular order until the report
+    size_t mark_count;
+    size_t mark_capacity;
+
+    uintptr_t* samples;  // interrupted rip of each sample
+    volatile size_t sample_count;
+    volatile size_t dropped;  // past PROFILE_MAX_SAMPLES
+    struct sigaction old_action;
+} JitProfile;
+
+JitProfile* profile_create(long interval);
+void profile_mark(JitProfile* profile, uint8_t* code, uint64_t pc);
+void profile_start(JitProfile* profile);
+void profile_stop(JitProfile* profile);
+void profile_report(JitProfile* profile, CFG* cfg, const char* sym_path, FILE* out);
+void profile_free(JitProfile* profile);
+
+#endif
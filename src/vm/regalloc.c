@@ -1,43 +1,550 @@
 #include "regalloc.h"
+#include "x86jit.h"
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+/*
+ * regalloc.c
+ *
+ * Maps the 16 u2 registers onto x86 registers for a whole program. Every u2
+ * register gets exactly one home (an x86 register or a stack slot) so the jit
+ * never has to shuffle values around at block boundaries.
+ *
+ * Two allocators are provided:
+ *
+ * LINEAR: each u2 register is reduced to one live interval over the
+ * instruction index and the intervals are handed registers in order of their
+ * start, spilling whichever active interval ends last once we run out
+ * (poletto & sarkar). Cheap and good enough for startup.
+ *
+ * GRAPH: chaitin-briggs style graph coloring on the interference graph built
+ * from the cfg liveness, with conservative (briggs) coalescing of mov related
+ * registers and optimistic spilling. Costs more but understands holes in
+ * lifetimes and removes movs.
+ *
+ * Programs touching no more registers than we have to give out skip both and
+ * get a straight one to one mapping instead (see IDENTITY below).
+ *
+ * Spill costs are uses and defs weighted by a guess at loop depth, or by how
+ * often their block really ran when the cfg carries a profile (--use-profile).
+ *
+ * Vector registers aren't allocated at all. Every one the program touches gets
+ * a slot at the bottom of the frame and vector code works on those directly,
+ * the spill slots sit above them.
+ */
+
+// r11 is held back from the allocator as a scratch register for spill traffic.
+// caller saved registers come first so small programs never pay for a push,
+// the callee saved tail is only touched once those run out. JIT_MEMBASE has to
+// stay last, programs using ld/st lose it to the memory base
 _x86_register u2a_regset[] = {
-    _x86_RAX, _x86_RCX, _x86_RDX, _x86_RSI, _x86_RDI, _x86_R8, _x86_R9, _x86_R10, _x86_R11,
+    _x86_RAX, _x86_RCX, _x86_RDX, _x86_RSI, _x86_RDI, _x86_R8,  _x86_R9,
+    _x86_R10, _x86_RBX, _x86_R12, _x86_R13, _x86_R14, JIT_MEMBASE,
 };
 
+#define REGSET_SIZE (int)(sizeof(u2a_regset) / sizeof(_x86_register))
+
+typedef struct {
+    uint16_t adj[16];    // interference graph as adjacency bitmasks
+    uint16_t moves[16];  // registers each register is mov related to
+    uint64_t cost[16];   // spill cost, uses and defs weighted by loop depth
+    int profiled;        // cost is exact (from a profile), not a guess
+    int64_t start[16];   // live interval of each register (linear scan)
+    int64_t end[16];
+} LiveInfo;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void add_interference(LiveInfo* info, int a, uint16_t others) {
+    others &= ~(1 << a);
+    info->adj[a] |= others;
+    for (int r = 0; r < 16; r++) {
+        if (others & (1 << r))
+            info->adj[r] |= 1 << a;
+    }
+}
+
+static void extend_interval(LiveInfo* info, uint16_t regs, int64_t pos) {
+    for (int r = 0; r < 16; r++) {
+        if (!(regs & (1 << r)))
+            continue;
+        if (pos < info->start[r])
+            info->start[r] = pos;
+        if (pos > info->end[r])
+            info->end[r] = pos;
+    }
+}
+
+// loops are approximated by back edges, every instruction between a back edge
+// target and its source gets one level deeper. 10^depth is the usual weight
+static uint64_t weight_from_depth(int depth) {
+    uint64_t weight = 1;
+    for (int i = 0; i < depth && i < 4; i++)
+        weight *= 10;
+    return weight;
+}
+
+static void build_live_info(CFG* cfg, LiveInfo* info, uint16_t* used) {
+    memset(info, 0, sizeof(LiveInfo));
+    for (int r = 0; r < 16; r++) {
+        info->start[r] = INT64_MAX;
+        info->end[r] = INT64_MIN;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < cfg->count; i++)
+        count += cfg->nodes[i]->instructions_count;
+
+    int* depth = calloc(count + 1, sizeof(int));
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        for (size_t j = 0; j < bb->outgoing_count; j++) {
+            BasicBlock* target = bb->outgoing[j];
+            if (target->leader <= bb->leader) {
+                depth[target->leader]++;
+                depth[bb->leader + bb->instructions_count]--;
+            }
+        }
+    }
+    for (size_t pc = 1; pc <= count; pc++)
+        depth[pc] += depth[pc - 1];
+
+    *used = 0;
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        uint16_t live = bb->live_out;
+        for (size_t j = bb->instructions_count; j-- > 0;) {
+            ParsedInstruction* inst = bb->instructions[j];
+            int64_t pc = bb->leader + j;
+            uint16_t uses = uses_from_instruction(inst);
+            uint16_t defs = defs_from_instruction(inst);
+            uint64_t weight = cfg->profile ? cfg->profile[i] : weight_from_depth(depth[pc]);
+
+            *used |= uses | defs;
+            for (int r = 0; r < 16; r++) {
+                if ((uses | defs) & (1 << r))
+                    info->cost[r] += weight;
+            }
+            extend_interval(info, live | uses | defs, pc);
+
+            // the destination of a mov does not interfere with its source,
+            // they hold the same value so they may share a register
+            uint16_t interferes = live;
+            if (inst->opcode == U2_MOV && defs && uses) {
+                interferes &= ~uses;
+                info->moves[inst->rd] |= uses;
+                info->moves[inst->rs1] |= defs;
+            }
+            for (int r = 0; r < 16; r++) {
+                if (defs & (1 << r))
+                    add_interference(info, r, interferes);
+            }
+            live = (live & ~defs) | uses;
+        }
+    }
+
+    // registers read before being written are all defined by whoever called
+    // us, so they are alive together at the entry
+    if (cfg->count) {
+        uint16_t entry = cfg->nodes[0]->live_in;
+        for (int r = 0; r < 16; r++) {
+            if (entry & (1 << r))
+                add_interference(info, r, entry);
+        }
+        extend_interval(info, entry, -1);
+    }
+
+    for (int r = 0; r < 16; r++)
+        info->moves[r] &= ~(1 << r);
+    info->profiled = cfg->profile != NULL;
+
+    free(depth);
+}
+
+static void assign_spill_slots(RegAllocation* ra) {
+    ra->spill_count = 0;
+    ra->vector_count = 0;
+    for (int r = 0; r < 16; r++) {
+        ra->spill_slot[r] = -1;
+        if ((ra->used & (1 << r)) && ra->x86[r] == _x86_SPILL)
+            ra->spill_slot[r] = ra->spill_count++;
+        ra->vector_slot[r] = -1;
+        if (ra->vector_used & (1 << r))
+            ra->vector_slot[r] = ra->vector_count++;
+    }
+}
+
+// work out what the prologue has to do: which callee saved registers we
+// clobber and how much stack the spill slots need
+static void layout_frame(RegAllocation* ra) {
+    ra->x86_used = 0;
+    for (int r = 0; r < 16; r++) {
+        if ((ra->used & (1 << r)) && ra->x86[r] != _x86_SPILL)
+            ra->x86_used |= 1 << ra->x86[r];
+    }
+
+    if (ra->uses_memory)
+        ra->x86_used |= 1 << JIT_MEMBASE;
+
+    int pushes = 0;
+    for (int i = 0; i < REGSET_SIZE; i++) {
+        if ((ra->x86_used & (1 << u2a_regset[i])) && x86_is_callee_saved(u2a_regset[i]))
+            pushes++;
+    }
+
+    // the call into us left rsp 8 off a 16 byte boundary, keep it aligned
+    // past the pushes so anything we call into later can rely on it
+    ra->frame_size = ra->vector_count * 32 + (ra->spill_count + ra->extra_slots) * 8;
+    if (ra->frame_size && (8 + 8 * pushes + ra->frame_size) % 16)
+        ra->frame_size += 8;
+}
+
+/*
+ * IDENTITY
+ *
+ * When every register the program touches can have an x86 register to itself
+ * there is nothing to decide, hand them out in order and skip the analysis.
+ */
+
+static uint16_t used_in_cfg(CFG* cfg) {
+    uint16_t used = 0;
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        for (size_t j = 0; j < bb->instructions_count; j++)
+            used |= uses_from_instruction(bb->instructions[j]) | defs_from_instruction(bb->instructions[j]);
+    }
+    return used;
+}
+
+static int memory_in_cfg(CFG* cfg) {
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        for (size_t j = 0; j < bb->instructions_count; j++) {
+            uint32_t op = bb->instructions[j]->opcode;
+            if (op == U2_LD || op == U2_ST || op == U2_VLD || op == U2_VST)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static uint16_t vectors_in_cfg(CFG* cfg) {
+    uint16_t vectors = 0;
+    for (size_t i = 0; i < cfg->count; i++) {
+        BasicBlock* bb = cfg->nodes[i];
+        for (size_t j = 0; j < bb->instructions_count; j++)
+            vectors |= vectors_from_instruction(bb->instructions[j]);
+    }
+    return vectors;
+}
+
+static void identity_map(RegAllocation* ra) {
+    int next = 0;
+    for (int r = 0; r < 16; r++) {
+        if (ra->used & (1 << r))
+            ra->x86[r] = u2a_regset[next++];
+    }
+}
+
 /*
-static int regcount = sizeof(u2a_regset) / sizeof(_x86_register);
-
-static void spill_reg(uint8_t** jit_memory, _x86_register reg) {
-    // TODO
-    (void)jit_memory;
-    (void)reg;
-}*/
-
-_x86_register regalloc_u2a_x86(uint32_t reg) {
-    // TODO
-    (void)reg;
-    return _x86_RAX;
-}
-
-void init_reg_spill_stack(uint8_t** jit_memory) {
-    // sub rsp, 16 * 8 (alloc 16 regs of 8 bytes on rsp)
-    emit_byte(jit_memory, 0x48);
-    emit_byte(jit_memory, 0x81);
-    emit_byte(jit_memory, 0xec);
-    emit_byte(jit_memory, 0x80);
-    emit_byte(jit_memory, 0x00);
-    emit_byte(jit_memory, 0x00);
-    emit_byte(jit_memory, 0x00);
-}
-
-void free_reg_spill_stack(uint8_t** jit_memory) {
-    // add rsp, 16 * 8 (free 16 regs of 8 bytes on rsp)
-    emit_byte(jit_memory, 0x48);
-    emit_byte(jit_memory, 0x81);
-    emit_byte(jit_memory, 0xc4);
-    emit_byte(jit_memory, 0x80);
-    emit_byte(jit_memory, 0x00);
-    emit_byte(jit_memory, 0x00);
-    emit_byte(jit_memory, 0x00);
+ * LINEAR SCAN
+ */
+
+static void linear_scan(LiveInfo* info, RegAllocation* ra) {
+    int order[16];
+    int n = 0;
+    for (int r = 0; r < 16; r++) {
+        if (ra->used & (1 << r))
+            order[n++] = r;
+    }
+    // insertion sort by interval start, there are at most 16 of them
+    for (int i = 1; i < n; i++) {
+        int r = order[i];
+        int j = i;
+        while (j > 0 && info->start[order[j - 1]] > info->start[r]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = r;
+    }
+
+    int active[16];
+    int active_count = 0;
+    int color[16];
+    uint32_t free_colors = (1u << ra->regcount) - 1;
+
+    for (int i = 0; i < n; i++) {
+        int r = order[i];
+
+        // expire intervals that ended before this one starts
+        for (int a = 0; a < active_count;) {
+            if (info->end[active[a]] < info->start[r]) {
+                free_colors |= 1u << color[active[a]];
+                active[a] = active[--active_count];
+            } else {
+                a++;
+            }
+        }
+
+        if (free_colors) {
+            color[r] = __builtin_ctz(free_colors);
+            free_colors &= ~(1u << color[r]);
+            active[active_count++] = r;
+            continue;
+        }
+
+        // out of registers, spill whichever interval reaches furthest. with a
+        // profile the cost is how many loads and stores a spill really adds,
+        // so the cheapest one goes instead
+        int pick = 0;
+        for (int a = 1; a < active_count; a++) {
+            if (info->profiled ? info->cost[active[a]] < info->cost[active[pick]]
+                               : info->end[active[a]] > info->end[active[pick]])
+                pick = a;
+        }
+        int victim = active[pick];
+        if (info->profiled ? info->cost[victim] < info->cost[r] : info->end[victim] > info->end[r]) {
+            color[r] = color[victim];
+            color[victim] = -1;
+            active[pick] = r;
+        } else {
+            color[r] = -1;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        int r = order[i];
+        ra->x86[r] = color[r] < 0 ? _x86_SPILL : u2a_regset[color[r]];
+    }
+}
+
+/*
+ * GRAPH COLORING
+ *
+ * With only 16 nodes the whole graph fits in a handful of bitmasks so every
+ * worklist is just a mask of the registers still in play.
+ */
+
+static int degree_in(LiveInfo* info, int r, uint16_t remaining) {
+    return __builtin_popcount(info->adj[r] & remaining);
+}
+
+static void merge_nodes(LiveInfo* info, int keep, int gone) {
+    for (int r = 0; r < 16; r++) {
+        if (info->adj[r] & (1 << gone)) {
+            info->adj[r] = (info->adj[r] & ~(1 << gone)) | (1 << keep);
+        }
+        if (info->moves[r] & (1 << gone)) {
+            info->moves[r] = (info->moves[r] & ~(1 << gone)) | (1 << keep);
+        }
+    }
+    info->adj[keep] |= info->adj[gone];
+    info->moves[keep] |= info->moves[gone];
+    info->adj[keep] &= ~(1 << keep);
+    info->moves[keep] &= ~(1 << keep);
+    info->cost[keep] += info->cost[gone];
+}
+
+static void freeze_moves(LiveInfo* info, int r) {
+    for (int m = 0; m < 16; m++)
+        info->moves[m] &= ~(1 << r);
+    info->moves[r] = 0;
+}
+
+static void graph_color(LiveInfo* info, RegAllocation* ra) {
+    int alias[16];
+    for (int r = 0; r < 16; r++)
+        alias[r] = r;
+
+    uint16_t remaining = ra->used;
+    int stack[16];
+    int stack_count = 0;
+    ra->coalesced_count = 0;
+
+    while (remaining) {
+        int progress = 0;
+
+        // simplify: pull out a low degree node that has no moves left to coalesce
+        for (int r = 0; r < 16 && !progress; r++) {
+            if ((remaining & (1 << r)) && !(info->moves[r] & remaining) &&
+                degree_in(info, r, remaining) < ra->regcount) {
+                stack[stack_count++] = r;
+                remaining &= ~(1 << r);
+                progress = 1;
+            }
+        }
+        if (progress)
+            continue;
+
+        // coalesce: merge a mov pair if the briggs test says the merged node
+        // is still guaranteed to color
+        for (int a = 0; a < 16 && !progress; a++) {
+            if (!(remaining & (1 << a)))
+                continue;
+            uint16_t partners = info->moves[a] & remaining;
+            for (int b = 0; b < 16 && !progress; b++) {
+                if (!(partners & (1 << b)))
+                    continue;
+                if (info->adj[a] & (1 << b)) {
+                    // constrained, they interfere so this mov has to stay
+                    info->moves[a] &= ~(1 << b);
+                    info->moves[b] &= ~(1 << a);
+                    progress = 1;
+                    break;
+                }
+                uint16_t neighbours = (info->adj[a] | info->adj[b]) & remaining & ~((1 << a) | (1 << b));
+                int significant = 0;
+                for (int r = 0; r < 16; r++) {
+                    if ((neighbours & (1 << r)) && degree_in(info, r, remaining) >= ra->regcount)
+                        significant++;
+                }
+                if (significant < ra->regcount) {
+                    merge_nodes(info, a, b);
+                    alias[b] = a;
+                    remaining &= ~(1 << b);
+                    ra->coalesced_count++;
+                    progress = 1;
+                }
+            }
+        }
+        if (progress)
+            continue;
+
+        // freeze: give up on the moves of a low degree node so it can simplify
+        for (int r = 0; r < 16 && !progress; r++) {
+            if ((remaining & (1 << r)) && (info->moves[r] & remaining) &&
+                degree_in(info, r, remaining) < ra->regcount) {
+                freeze_moves(info, r);
+                progress = 1;
+            }
+        }
+        if (progress)
+            continue;
+
+        // potential spill: push the cheapest node per unit of degree and hope
+        // its neighbours end up sharing colors (optimistic spilling)
+        int best = -1;
+        for (int r = 0; r < 16; r++) {
+            if (!(remaining & (1 << r)))
+                continue;
+            if (best < 0 ||
+                info->cost[r] * degree_in(info, best, remaining) < info->cost[best] * degree_in(info, r, remaining))
+                best = r;
+        }
+        freeze_moves(info, best);
+        stack[stack_count++] = best;
+        remaining &= ~(1 << best);
+    }
+
+    // select: pop nodes back and give each the first color its neighbours leave
+    int color[16];
+    for (int r = 0; r < 16; r++)
+        color[r] = -1;
+    while (stack_count) {
+        int r = stack[--stack_count];
+        uint32_t taken = 0;
+        for (int n = 0; n < 16; n++) {
+            if ((info->adj[r] & (1 << n)) && color[n] >= 0)
+                taken |= 1u << color[n];
+        }
+        uint32_t free_colors = ~taken & ((1u << ra->regcount) - 1);
+        color[r] = free_colors ? __builtin_ctz(free_colors) : -1;
+    }
+
+    for (int r = 0; r < 16; r++) {
+        if (!(ra->used & (1 << r)))
+            continue;
+        int root = r;
+        while (alias[root] != root)
+            root = alias[root];
+        ra->x86[r] = color[root] < 0 ? _x86_SPILL : u2a_regset[color[root]];
+    }
+}
+
+// allocates for cfg, replacing whatever allocation it had
+RegAllocation* regalloc_program(CFG* cfg, RegAllocMode mode) {
+    uint64_t start = now_ns();
+    if (cfg->regalloc == NULL)
+        cfg->regalloc = malloc(sizeof(RegAllocation));
+    RegAllocation* ra = cfg->regalloc;
+    memset(ra, 0, sizeof(RegAllocation));
+    ra->mode = mode;
+    for (int r = 0; r < 16; r++)
+        ra->x86[r] = _x86_SPILL;
+
+    // an explicit request for graph coloring still gets it, coalescing can
+    // remove movs even when nothing would spill
+    ra->used = used_in_cfg(cfg);
+    ra->uses_memory = memory_in_cfg(cfg);
+    ra->vector_used = vectors_in_cfg(cfg);
+    ra->regcount = REGSET_SIZE - ra->uses_memory;
+    if (mode != REGALLOC_GRAPH && __builtin_popcount(ra->used) <= ra->regcount) {
+        ra->mode = REGALLOC_IDENTITY;
+        identity_map(ra);
+    } else {
+        LiveInfo info;
+        build_live_info(cfg, &info, &ra->used);
+
+        if (mode == REGALLOC_GRAPH)
+            graph_color(&info, ra);
+        else
+            linear_scan(&info, ra);
+    }
+
+    assign_spill_slots(ra);
+    layout_frame(ra);
+    ra->time_ns = now_ns() - start;
+    return ra;
+}
+
+// one more 8 byte slot in the frame past the spill slots, for things the jit
+// wants to keep around that aren't u2 registers. returns its rsp displacement
+int32_t regalloc_frame_slot(RegAllocation* ra) {
+    int slot = ra->spill_count + ra->extra_slots++;
+    layout_frame(ra);
+    return ra->vector_count * 32 + slot * 8;
+}
+
+_x86_register regalloc_u2a_x86(RegAllocation* ra, uint32_t reg) {
+    return ra->x86[reg & 0xF];
+}
+
+// spilled registers live at [rsp + 8 * slot], past the vector slots
+int32_t regalloc_spill_disp(RegAllocation* ra, uint32_t reg) {
+    return ra->vector_count * 32 + ra->spill_slot[reg & 0xF] * 8;
+}
+
+// vector register reg lives at [rsp + 32 * slot]
+int32_t regalloc_vector_disp(RegAllocation* ra, uint32_t reg) {
+    return ra->vector_slot[reg & 0xF] * 32;
+}
+
+// prologue: save the callee saved registers the allocation hands out and make
+// room for the spill slots, both are skipped entirely when not needed
+void init_reg_spill_stack(uint8_t** jit_memory, RegAllocation* ra) {
+    for (int i = 0; i < REGSET_SIZE; i++) {
+        _x86_register reg = u2a_regset[i];
+        if ((ra->x86_used & (1 << reg)) && x86_is_callee_saved(reg))
+            emit_x86instruction(jit_memory, &__push_r64, reg, 0, 0);
+    }
+    if (ra->frame_size)
+        emit_x86instruction(jit_memory, &__sub_rm64_imm32, 0, _x86_RSP, ra->frame_size);
+}
+
+// epilogue: undo init_reg_spill_stack in reverse
+void free_reg_spill_stack(uint8_t** jit_memory, RegAllocation* ra) {
+    if (ra->frame_size)
+        emit_x86instruction(jit_memory, &__add_rm64_imm32, 0, _x86_RSP, ra->frame_size);
+    for (int i = REGSET_SIZE - 1; i >= 0; i--) {
+        _x86_register reg = u2a_regset[i];
+        if ((ra->x86_used & (1 << reg)) && x86_is_callee_saved(reg))
+            emit_x86instruction(jit_memory, &__pop_r64, reg, 0, 0);
+    }
 }
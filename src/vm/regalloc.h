@@ -1,21 +1,42 @@
 #ifndef REGALLOC_H
 #define REGALLOC_H
 
+#include "cfg.h"
 #include "x86encoding.h"
 
-_x86_register regalloc_u2a_x86(uint32_t reg);
-_x86_register getreg_u2a_x86(uint32_t reg);
+typedef enum {
+    REGALLOC_LINEAR,    // linear scan over live intervals, cheap and the default
+    REGALLOC_GRAPH,     // chaitin-briggs graph coloring, slower but spills less
+    REGALLOC_IDENTITY,  // program fits in registers, nothing to allocate
+} RegAllocMode;
 
-typedef struct {
-    int vmreg;
-    int busy;
-    int owner;
-    int dirty;
-    int lifetime;
-} _x86_regstate;
+// everything the allocator decides for one program, it hangs off the cfg
+// (cfg->regalloc) so nothing about a compilation is shared between them
+struct RegAllocation {
+    RegAllocMode mode;
+    uint16_t used;          // bitmask of u2 registers the program touches
+    _x86_register x86[16];  // home of each u2 register, _x86_SPILL if it lives on the stack
+    int spill_slot[16];     // stack slot of each spilled u2 register, -1 otherwise
+    int regcount;           // x86 registers the allocator may hand out
+    int spill_count;        // number of stack slots handed out
+    int extra_slots;        // non register slots after the spills, see regalloc_frame_slot
+    int coalesced_count;    // moves removed by coalescing (graph mode only)
+    uint16_t x86_used;      // bitmask of x86 registers handed out
+    int uses_memory;        // program has ld/st, JIT_MEMBASE is taken
+    uint16_t vector_used;   // bitmask of vector registers the program touches
+    int vector_slot[16];    // 32 byte slot of each used vector register at the bottom of the frame, -1 otherwise
+    int vector_count;       // slots handed out to vector registers
+    int frame_size;         // bytes of stack reserved below the saved registers
+    uint64_t time_ns;       // time spent allocating
+};
 
-extern _x86_regstate regstate[16];
-void init_reg_spill_stack(uint8_t** jit_memory);
-void free_reg_spill_stack(uint8_t** jit_memory);
+void init_reg_spill_stack(uint8_t** jit_memory, RegAllocation* ra);
+void free_reg_spill_stack(uint8_t** jit_memory, RegAllocation* ra);
+
+RegAllocation* regalloc_program(CFG* cfg, RegAllocMode mode);
+_x86_register regalloc_u2a_x86(RegAllocation* ra, uint32_t reg);
+int32_t regalloc_spill_disp(RegAllocation* ra, uint32_t reg);
+int32_t regalloc_frame_slot(RegAllocation* ra);
+int32_t regalloc_vector_disp(RegAllocation* ra, uint32_t reg);
 
 #endif
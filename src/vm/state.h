@@ -0,0 +1,28 @@
+#ifndef STATE_H
+#define STATE_H
+
+/*
+ * state.h
+ *
+ * Architectural state of a running u2 program as the interpreter sees it.
+ * Compiled units (see jit_unit) take a pointer to this, load what they need on
+ * entry and write back whatever is still live when they exit.
+ */
+
+#include "../common/config.h"
+#include <stdint.h>
+
+// flag bits, same positions as RFLAGS so compiled code can popf/pushf them
+#define STATE_CF (1 << 0)
+#define STATE_ZF (1 << 6)
+#define STATE_SF (1 << 7)
+#define STATE_OF (1 << 11)
+
+typedef struct {
+    uint64_t regs[16];
+    uint64_t flags;                    // as left by the last cmp
+    uint8_t* mem;                      // linear memory base
+    uint32_t vregs[16][VECTOR_LANES];  // v1-v16, indexed like regs (v16 is 0)
+} VMState;
+
+#endif
@@ -0,0 +1,186 @@
+/**
+
+    Stencil generator
+
+    Build time tool, never part of the vm. Reads
+    the object file gcc made out of stencils.c and
+    writes a header with every stencil_ function's
+    code and holes as C arrays for baseline.c.
+
+    Usage = stencilgen stencils.o stencils.h
+
+    Each function sits in its own .text.stencil_
+    section (-ffunction-sections) so its code is
+    just the section contents and its holes are
+    the relocations in the matching .rela section.
+    A jmp to hole_next at the very end is cut off,
+    the next stencil gets copied there anyway.
+
+ */
+
+#include "baseline.h"
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* hole_names[] = {
+    [HOLE_RD] = "hole_rd",         [HOLE_RS1] = "hole_rs1",       [HOLE_RS2] = "hole_rs2",
+    [HOLE_IMM_LO] = "hole_imm_lo", [HOLE_IMM_HI] = "hole_imm_hi", [HOLE_NEXT] = "hole_next",
+    [HOLE_TARGET] = "hole_target",
+};
+
+static const char* hole_kinds[] = {
+    [HOLE_RD] = "HOLE_RD",         [HOLE_RS1] = "HOLE_RS1",       [HOLE_RS2] = "HOLE_RS2",
+    [HOLE_IMM_LO] = "HOLE_IMM_LO", [HOLE_IMM_HI] = "HOLE_IMM_HI", [HOLE_NEXT] = "HOLE_NEXT",
+    [HOLE_TARGET] = "HOLE_TARGET",
+};
+
+#define HOLE_KIND_COUNT (sizeof(hole_names) / sizeof(hole_names[0]))
+
+static void die(const char* what, const char* name) {
+    fprintf(stderr, "stencilgen: %s%s%s\n", what, name ? ": " : "", name ? name : "");
+    exit(EXIT_FAILURE);
+}
+
+static int hole_kind(const char* name) {
+    for (size_t i = 0; i < HOLE_KIND_COUNT; i++) {
+        if (strcmp(name, hole_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static uint8_t* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+        die("cannot open", path);
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    uint8_t* data = malloc(*size);
+    if (fread(data, 1, *size, f) != *size)
+        die("cannot read", path);
+    fclose(f);
+    return data;
+}
+
+static void write_stencil(FILE* out, uint8_t* elf, Elf64_Shdr* sections, size_t index, const char* name) {
+    Elf64_Shdr* text = &sections[index];
+    Elf64_Ehdr* header = (Elf64_Ehdr*)elf;
+    uint8_t* code = elf + text->sh_offset;
+    size_t size = text->sh_size;
+
+    Elf64_Rela* relas = NULL;
+    size_t rela_count = 0;
+    Elf64_Sym* symbols = NULL;
+    const char* strings = NULL;
+    for (size_t i = 0; i < header->e_shnum; i++) {
+        if (sections[i].sh_type == SHT_RELA && sections[i].sh_info == index) {
+            relas = (Elf64_Rela*)(elf + sections[i].sh_offset);
+            rela_count = sections[i].sh_size / sizeof(Elf64_Rela);
+            symbols = (Elf64_Sym*)(elf + sections[sections[i].sh_link].sh_offset);
+            strings = (const char*)elf + sections[sections[sections[i].sh_link].sh_link].sh_offset;
+        }
+    }
+
+    StencilHole* holes = calloc(rela_count + 1, sizeof(StencilHole));
+    size_t hole_count = 0;
+    for (size_t i = 0; i < rela_count; i++) {
+        Elf64_Sym* symbol = &symbols[ELF64_R_SYM(relas[i].r_info)];
+        int kind = hole_kind(strings + symbol->st_name);
+        if (kind < 0)
+            die("relocation against something that isn't a hole in", name);
+
+        StencilHole* hole = &holes[hole_count++];
+        hole->offset = relas[i].r_offset;
+        hole->kind = kind;
+        hole->addend = relas[i].r_addend;
+        switch (ELF64_R_TYPE(relas[i].r_info)) {
+        case R_X86_64_32:
+        case R_X86_64_32S:
+            hole->relative = 0;
+            break;
+        case R_X86_64_PC32:
+        case R_X86_64_PLT32:
+            hole->relative = 1;
+            break;
+        default:
+            die("unsupported relocation type in", name);
+        }
+        if ((kind == HOLE_NEXT || kind == HOLE_TARGET) && !hole->relative)
+            die("absolute code address in", name);
+    }
+
+    // trailing jmp rel32 to hole_next, the stencil can just end there instead
+    for (size_t i = 0; i < hole_count; i++) {
+        if (holes[i].kind == HOLE_NEXT && holes[i].offset + 4 == size && size >= 5 && code[size - 5] == 0xE9) {
+            size -= 5;
+            holes[i] = holes[--hole_count];
+            break;
+        }
+    }
+
+    fprintf(out, "static const uint8_t %s_code[] = {", name);
+    for (size_t i = 0; i < size; i++)
+        fprintf(out, "%s0x%02X", i == 0 ? "\n    " : i % 12 ? ", " : ",\n    ", code[i]);
+    fprintf(out, "\n};\n");
+
+    if (hole_count) {
+        fprintf(out, "static const StencilHole %s_holes[] = {\n", name);
+        for (size_t i = 0; i < hole_count; i++) {
+            fprintf(out, "    {%u, %s, %d, %d},\n", holes[i].offset, hole_kinds[holes[i].kind], holes[i].relative,
+                    holes[i].addend);
+        }
+        fprintf(out, "};\n");
+        fprintf(out, "static const Stencil %s = {%s_code, %zu, %s_holes, %zu};\n\n", name, name, size, name,
+                hole_count);
+    } else {
+        fprintf(out, "static const Stencil %s = {%s_code, %zu, NULL, 0};\n\n", name, name, size);
+    }
+    free(holes);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: stencilgen stencils.o stencils.h\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t size;
+    uint8_t* elf = read_file(argv[1], &size);
+    Elf64_Ehdr* header = (Elf64_Ehdr*)elf;
+    if (size < sizeof(Elf64_Ehdr) || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+        header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_machine != EM_X86_64 || header->e_type != ET_REL) {
+        die("not an x86-64 relocatable object", argv[1]);
+    }
+
+    Elf64_Shdr* sections = (Elf64_Shdr*)(elf + header->e_shoff);
+    const char* section_names = (const char*)elf + sections[header->e_shstrndx].sh_offset;
+
+    // anything gcc put in a shared section (constants, jump tables) can't be reached from a copied stencil
+    for (size_t i = 0; i < header->e_shnum; i++) {
+        const char* name = section_names + sections[i].sh_name;
+        if ((sections[i].sh_flags & SHF_ALLOC) && sections[i].sh_size && strncmp(name, ".text.stencil_", 14) != 0)
+            die("stencils use data outside their own section", name);
+    }
+
+    FILE* out = fopen(argv[2], "w");
+    if (out == NULL)
+        die("cannot write", argv[2]);
+    fprintf(out, "// generated by stencilgen from %s, do not edit\n\n", argv[1]);
+
+    size_t count = 0;
+    for (size_t i = 0; i < header->e_shnum; i++) {
+        const char* name = section_names + sections[i].sh_name;
+        if (sections[i].sh_type != SHT_PROGBITS || strncmp(name, ".text.stencil_", 14) != 0)
+            continue;
+        write_stencil(out, elf, sections, i, name + 6);
+        count++;
+    }
+
+    fclose(out);
+    free(elf);
+    printf("stencilgen: %zu stencils\n", count);
+    return 0;
+}
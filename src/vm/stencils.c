@@ -0,0 +1,213 @@
+/**
+
+    Stencils for the baseline jit
+
+    This file is never linked into the vm. gcc
+    compiles it on its own (see STENCIL_CFLAGS in
+    the Makefile) and stencilgen cuts each
+    stencil_ function's machine code out of the
+    object file along with every relocation against
+    a hole_ symbol. Those relocations are the holes
+    baseline.c patches operands into after copying
+    a stencil.
+
+    Every stencil takes the VMState in rdi and the
+    memory base in rsi and hands both on by tail
+    calling hole_next, which turns into a jmp that
+    stencilgen drops when it is the last thing in
+    the stencil so stencils just run into each
+    other. Registers live in the VMState, the
+    patched value of a register hole is its byte
+    offset in there. The entry and exit around all
+    of this come from the regular encoder, see
+    baseline.c.
+
+    Anything that would need data outside the
+    stencil (jump tables, constants in .rodata,
+    calls into libc) can't be used here, stencilgen
+    refuses relocations against anything but holes.
+
+ */
+
+#include "state.h"
+#include <stdint.h>
+#include <string.h>
+
+extern char hole_rd[];
+extern char hole_rs1[];
+extern char hole_rs2[];
+extern char hole_imm_lo[];  // low 32 bits of the immediate
+extern char hole_imm_hi[];  // high 32 bits, only for li64
+void hole_next(VMState* state, uint8_t* mem);
+void hole_target(VMState* state, uint8_t* mem);
+
+#define REG(hole) (*(uint64_t*)((char*)state + (uintptr_t)(hole)))
+#define RD REG(hole_rd)
+#define RS1 REG(hole_rs1)
+#define RS2 REG(hole_rs2)
+// through asm so gcc always makes these a mov imm32 (zero extended for free)
+// with an absolute relocation, left to itself it likes lea from rip which would
+// make the copy depend on where it ends up
+#define HOLE32(hole) ({ uint64_t value; __asm__("movl $" #hole ", %k0" : "=r"(value)); value; })
+#define IMM32 HOLE32(hole_imm_lo)
+#define IMM64 (((uint64_t)HOLE32(hole_imm_hi) << 32) | IMM32)
+#define ADDRESS(reg) (mem + (uint32_t)(reg) + (int64_t)(int32_t)IMM32)
+
+// vector register holes are offsets into vregs instead. a register is done
+// as sse2 sized halves, no avx since the stencils are copied as they are onto
+// whatever runs them (and gcc scalarizes 256 bit compares without it)
+typedef uint32_t Half __attribute__((vector_size(16)));
+typedef int32_t SignedHalf __attribute__((vector_size(16)));
+#define VREG(hole) ((char*)state + (uintptr_t)(hole))
+#define VECTOR_STENCIL(name, expr)                                    \
+    void stencil_##name(VMState* state, uint8_t* mem) {               \
+        for (size_t h = 0; h < sizeof(state->vregs[0]); h += 16) {    \
+            Half a, b;                                                \
+            memcpy(&a, VREG(hole_rs1) + h, 16);                       \
+            memcpy(&b, VREG(hole_rs2) + h, 16);                       \
+            Half d = (expr);                                          \
+            memcpy(VREG(hole_rd) + h, &d, 16);                        \
+        }                                                             \
+        hole_next(state, mem);                                        \
+    }
+
+void stencil_mov(VMState* state, uint8_t* mem) {
+    RD = RS1;
+    hole_next(state, mem);
+}
+
+// zero extended, anything else goes through li64
+void stencil_li32(VMState* state, uint8_t* mem) {
+    RD = IMM32;
+    hole_next(state, mem);
+}
+
+void stencil_li64(VMState* state, uint8_t* mem) {
+    RD = IMM64;
+    hole_next(state, mem);
+}
+
+void stencil_ld(VMState* state, uint8_t* mem) {
+    memcpy(&RD, ADDRESS(RS1), 8);
+    hole_next(state, mem);
+}
+
+void stencil_st(VMState* state, uint8_t* mem) {
+    memcpy(ADDRESS(RS2), &RS1, 8);
+    hole_next(state, mem);
+}
+
+void stencil_add(VMState* state, uint8_t* mem) {
+    RD = RS1 + RS2;
+    hole_next(state, mem);
+}
+
+void stencil_sub(VMState* state, uint8_t* mem) {
+    RD = RS1 - RS2;
+    hole_next(state, mem);
+}
+
+void stencil_mul(VMState* state, uint8_t* mem) {
+    RD = RS1 * RS2;
+    hole_next(state, mem);
+}
+
+// idiv traps on its own for zero and INT64_MIN / -1, same as the optimizing jit
+void stencil_div(VMState* state, uint8_t* mem) {
+    int64_t a = RS1;
+    int64_t b = RS2;
+    __asm__("cqo\n\tidiv %[b]" : "+a"(a) : [b] "r"(b) : "rdx", "cc");
+    RD = a;
+    hole_next(state, mem);
+}
+
+void stencil_and(VMState* state, uint8_t* mem) {
+    RD = RS1 & RS2;
+    hole_next(state, mem);
+}
+
+void stencil_or(VMState* state, uint8_t* mem) {
+    RD = RS1 | RS2;
+    hole_next(state, mem);
+}
+
+void stencil_xor(VMState* state, uint8_t* mem) {
+    RD = RS1 ^ RS2;
+    hole_next(state, mem);
+}
+
+void stencil_not(VMState* state, uint8_t* mem) {
+    RD = ~RS1;
+    hole_next(state, mem);
+}
+
+// the count is patched in already masked to 0..63
+void stencil_shl(VMState* state, uint8_t* mem) {
+    RD = RS1 << IMM32;
+    hole_next(state, mem);
+}
+
+void stencil_shr(VMState* state, uint8_t* mem) {
+    RD = RS1 >> IMM32;
+    hole_next(state, mem);
+}
+
+// same bits an x86 cmp would leave, see op_cmp in interp.c. computing them in
+// c comes out more than twice the size
+void stencil_cmp(VMState* state, uint8_t* mem) {
+    uint64_t flags;
+    __asm__("cmp %[b], %[a]\n\tpushfq\n\tpopq %[flags]" : [flags] "=r"(flags) : [a] "r"(RS1), [b] "r"(RS2) : "cc");
+    state->flags = flags & (STATE_CF | STATE_ZF | STATE_SF | STATE_OF);
+    hole_next(state, mem);
+}
+
+void stencil_jmp(VMState* state, uint8_t* mem) {
+    hole_target(state, mem);
+}
+
+void stencil_je(VMState* state, uint8_t* mem) {
+    if (state->flags & STATE_ZF)
+        hole_target(state, mem);
+    else
+        hole_next(state, mem);
+}
+
+void stencil_jne(VMState* state, uint8_t* mem) {
+    if (!(state->flags & STATE_ZF))
+        hole_target(state, mem);
+    else
+        hole_next(state, mem);
+}
+
+void stencil_jl(VMState* state, uint8_t* mem) {
+    if (!(state->flags & STATE_SF) != !(state->flags & STATE_OF))
+        hole_target(state, mem);
+    else
+        hole_next(state, mem);
+}
+
+void stencil_jg(VMState* state, uint8_t* mem) {
+    if (!(state->flags & STATE_ZF) && !(state->flags & STATE_SF) == !(state->flags & STATE_OF))
+        hole_target(state, mem);
+    else
+        hole_next(state, mem);
+}
+
+void stencil_vld(VMState* state, uint8_t* mem) {
+    memcpy(VREG(hole_rd), ADDRESS(RS1), sizeof(state->vregs[0]));
+    hole_next(state, mem);
+}
+
+void stencil_vst(VMState* state, uint8_t* mem) {
+    memcpy(ADDRESS(RS2), VREG(hole_rs1), sizeof(state->vregs[0]));
+    hole_next(state, mem);
+}
+
+VECTOR_STENCIL(vadd, a + b)
+VECTOR_STENCIL(vsub, a - b)
+VECTOR_STENCIL(vmul, a * b)
+VECTOR_STENCIL(vand, a & b)
+VECTOR_STENCIL(vor, a | b)
+VECTOR_STENCIL(vxor, a ^ b)
+VECTOR_STENCIL(vcmpeq, (Half)(a == b))
+VECTOR_STENCIL(vcmpgt, (Half)((SignedHalf)a > (SignedHalf)b))
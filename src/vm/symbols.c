@@ -0,0 +1,371 @@
+#include "symbols.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+    Symbols for generated code
+
+    perf and gdb only see an anonymous mapping
+    where the arena is, so whoever compiles code
+    adds a symbol for every block once its bytes are
+    final and commits after each batch (a whole
+    program, a unit, a lazily compiled block).
+
+    The perf map is a line per symbol, perf reads
+    it when reporting. A jitdump also carries a copy
+    of the code so perf inject can disassemble and
+    annotate it, perf only picks the file up if the
+    process maps it executable, hence the marker
+    mapping. Timestamps are CLOCK_MONOTONIC, record
+    with perf record -k mono.
+
+    For gdb every commit becomes an in memory ELF
+    object with a NOBITS .text covering the batch
+    and a function symbol per block, linked into
+    the list gdb reads from __jit_debug_descriptor.
+    That list is one per process and shared by
+    every module that's loaded, so each JitSymbols
+    remembers its own entries and only takes those
+    out again, all under gdb_lock.
+*/
+
+// names and layout fixed by gdb, see "JIT Compilation Interface" in its manual
+typedef enum { JIT_NOACTION = 0, JIT_REGISTER_FN, JIT_UNREGISTER_FN } jit_actions_t;
+
+struct jit_code_entry {
+    struct jit_code_entry* next_entry;
+    struct jit_code_entry* prev_entry;
+    const char* symfile_addr;
+    uint64_t symfile_size;
+};
+
+struct jit_descriptor {
+    uint32_t version;
+    uint32_t action_flag;
+    struct jit_code_entry* relevant_entry;
+    struct jit_code_entry* first_entry;
+};
+
+// gdb breaks here to notice a new or removed entry
+void __attribute__((noinline)) __jit_debug_register_code(void) {
+    __asm__ volatile("");
+}
+
+struct jit_descriptor __jit_debug_descriptor = {1, JIT_NOACTION, NULL, NULL};
+
+// modules commit and go away on whatever thread they like
+static pthread_mutex_t gdb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// jitdump layout, see tools/perf/Documentation/jitdump-specification.txt in linux
+#define JITDUMP_MAGIC 0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD 0
+#define JIT_CODE_CLOSE 3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitdumpHeader;
+
+typedef struct {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+} JitdumpRecord;
+
+typedef struct {
+    JitdumpRecord record;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+} JitdumpCodeLoad;
+
+static uint64_t timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void open_jitdump(JitSymbols* symbols) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+    symbols->jitdump_fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (symbols->jitdump_fd < 0) {
+        perror(path);
+        symbols->outputs &= ~SYMBOLS_JITDUMP;
+        return;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    symbols->jitdump_marker = mmap(NULL, page, PROT_READ | PROT_EXEC, MAP_PRIVATE, symbols->jitdump_fd, 0);
+    if (symbols->jitdump_marker == MAP_FAILED) {
+        // the dump still gets written, perf just won't find it on its own
+        perror("jitdump marker");
+        symbols->jitdump_marker = NULL;
+    }
+    JitdumpHeader header = {
+        .magic = JITDUMP_MAGIC, .version = JITDUMP_VERSION, .total_size = sizeof(JitdumpHeader),
+        .elf_mach = EM_X86_64, .pid = getpid(), .timestamp = timestamp()};
+    if (write(symbols->jitdump_fd, &header, sizeof(header)) != sizeof(header))
+        perror(path);
+}
+
+static void write_jitdump(JitSymbols* symbols, JitSymbol* symbol) {
+    size_t name_size = strlen(symbol->name) + 1;
+    uint32_t total_size = sizeof(JitdumpCodeLoad) + name_size + symbol->size;
+    JitdumpCodeLoad load = {
+        .record = {.id = JIT_CODE_LOAD, .total_size = total_size, .timestamp = timestamp()},
+        .pid = getpid(), .tid = syscall(SYS_gettid), .vma = (uintptr_t)symbol->code,
+        .code_addr = (uintptr_t)symbol->code, .code_size = symbol->size, .code_index = symbols->code_index++};
+    ssize_t written = write(symbols->jitdump_fd, &load, sizeof(load));
+    written += write(symbols->jitdump_fd, symbol->name, name_size);
+    written += write(symbols->jitdump_fd, symbol->code, symbol->size);
+    if (written != (ssize_t)load.record.total_size)
+        perror("jitdump");
+}
+
+// "pc label" lines from u2asm --sym, indexed by pc. NULL with *count 0 if
+// there is no such file
+char** symbols_load_labels(const char* sym_path, size_t* count) {
+    char** labels = NULL;
+    *count = 0;
+    FILE* f = fopen(sym_path, "r");
+    if (f == NULL)
+        return NULL;
+
+    uint64_t pc;
+    char name[256];
+    while (fscanf(f, "%lu %255s", &pc, name) == 2) {
+        if (pc >= *count) {
+            size_t grown = (pc + 1) * 2;
+            labels = realloc(labels, sizeof(char*) * grown);
+            memset(labels + *count, 0, sizeof(char*) * (grown - *count));
+            *count = grown;
+        }
+        // the first label wins where several share a pc
+        if (labels[pc] == NULL)
+            labels[pc] = strdup(name);
+    }
+    fclose(f);
+    return labels;
+}
+
+void symbols_free_labels(char** labels, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        free(labels[i]);
+    free(labels);
+}
+
+// sym_path may be NULL or not exist, blocks are then named by pc only
+JitSymbols* symbols_create(int outputs, const char* sym_path) {
+    JitSymbols* symbols = calloc(1, sizeof(JitSymbols));
+    symbols->outputs = outputs;
+    symbols->jitdump_fd = -1;
+
+    if (outputs & SYMBOLS_PERF_MAP) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+        symbols->perf_map = fopen(path, "w");
+        if (symbols->perf_map == NULL) {
+            perror(path);
+            symbols->outputs &= ~SYMBOLS_PERF_MAP;
+        }
+    }
+    if (outputs & SYMBOLS_JITDUMP)
+        open_jitdump(symbols);
+    if (sym_path)
+        symbols->labels = symbols_load_labels(sym_path, &symbols->label_count);
+    return symbols;
+}
+
+// code has to be final, the jitdump copies it right away
+void symbols_add(JitSymbols* symbols, uint8_t* code, size_t size, const char* name) {
+    if (symbols->pending_count == symbols->pending_capacity) {
+        symbols->pending_capacity = symbols->pending_capacity ? symbols->pending_capacity * 2 : 64;
+        symbols->pending = realloc(symbols->pending, sizeof(JitSymbol) * symbols->pending_capacity);
+    }
+    JitSymbol* symbol = &symbols->pending[symbols->pending_count++];
+    symbol->code = code;
+    symbol->size = size;
+    symbol->name = strdup(name);
+
+    if (symbols->outputs & SYMBOLS_PERF_MAP)
+        fprintf(symbols->perf_map, "%lx %zx %s\n", (uintptr_t)code, size, name);
+    if (symbols->outputs & SYMBOLS_JITDUMP)
+        write_jitdump(symbols, symbol);
+}
+
+// u2_<pc>, or u2_<pc>_<label> when the pc has one
+void symbols_add_block(JitSymbols* symbols, uint8_t* code, size_t size, uint64_t pc) {
+    char name[300];
+    if (pc < symbols->label_count && symbols->labels[pc])
+        snprintf(name, sizeof(name), "u2_%lu_%s", pc, symbols->labels[pc]);
+    else
+        snprintf(name, sizeof(name), "u2_%lu", pc);
+    symbols_add(symbols, code, size, name);
+}
+
+enum { GDB_NULL, GDB_TEXT, GDB_SYMTAB, GDB_STRTAB, GDB_SHSTRTAB, GDB_SECTIONS };
+
+// relocatable object with .text placed where the batch is, symbol values are
+// relative to it like in any other object
+static uint8_t* gdb_symfile(JitSymbol* batch, size_t count, size_t* size) {
+    static const char shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+    uint8_t* low = batch[0].code;
+    uint8_t* high = batch[0].code + batch[0].size;
+    size_t strtab_size = 1;
+    for (size_t i = 0; i < count; i++) {
+        if (batch[i].code < low)
+            low = batch[i].code;
+        if (batch[i].code + batch[i].size > high)
+            high = batch[i].code + batch[i].size;
+        strtab_size += strlen(batch[i].name) + 1;
+    }
+
+    size_t symtab_offset = sizeof(Elf64_Ehdr);
+    size_t strtab_offset = symtab_offset + (count + 1) * sizeof(Elf64_Sym);
+    size_t shstrtab_offset = strtab_offset + strtab_size;
+    size_t sections_offset = (shstrtab_offset + sizeof(shstrtab) + 7) & ~(size_t)7;
+    *size = sections_offset + GDB_SECTIONS * sizeof(Elf64_Shdr);
+    uint8_t* file = calloc(1, *size);
+
+    Elf64_Ehdr* header = (Elf64_Ehdr*)file;
+    memcpy(header->e_ident, ELFMAG, SELFMAG);
+    header->e_ident[EI_CLASS] = ELFCLASS64;
+    header->e_ident[EI_DATA] = ELFDATA2LSB;
+    header->e_ident[EI_VERSION] = EV_CURRENT;
+    header->e_type = ET_REL;
+    header->e_machine = EM_X86_64;
+    header->e_version = EV_CURRENT;
+    header->e_ehsize = sizeof(Elf64_Ehdr);
+    header->e_shoff = sections_offset;
+    header->e_shentsize = sizeof(Elf64_Shdr);
+    header->e_shnum = GDB_SECTIONS;
+    header->e_shstrndx = GDB_SHSTRTAB;
+
+    Elf64_Sym* symtab = (Elf64_Sym*)(file + symtab_offset);
+    char* strtab = (char*)file + strtab_offset;
+    size_t name = 1;
+    for (size_t i = 0; i < count; i++) {
+        symtab[i + 1] = (Elf64_Sym){
+            .st_name = name, .st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC), .st_shndx = GDB_TEXT,
+            .st_value = batch[i].code - low, .st_size = batch[i].size};
+        strcpy(strtab + name, batch[i].name);
+        name += strlen(batch[i].name) + 1;
+    }
+    memcpy(file + shstrtab_offset, shstrtab, sizeof(shstrtab));
+
+    Elf64_Shdr* sections = (Elf64_Shdr*)(file + sections_offset);
+    sections[GDB_TEXT] = (Elf64_Shdr){
+        .sh_name = 1, .sh_type = SHT_NOBITS, .sh_flags = SHF_ALLOC | SHF_EXECINSTR, .sh_addr = (uintptr_t)low,
+        .sh_size = high - low, .sh_addralign = 1};
+    sections[GDB_SYMTAB] = (Elf64_Shdr){
+        .sh_name = 7, .sh_type = SHT_SYMTAB, .sh_offset = symtab_offset, .sh_size = (count + 1) * sizeof(Elf64_Sym),
+        .sh_link = GDB_STRTAB, .sh_info = 1, .sh_addralign = 8, .sh_entsize = sizeof(Elf64_Sym)};
+    sections[GDB_STRTAB] = (Elf64_Shdr){
+        .sh_name = 15, .sh_type = SHT_STRTAB, .sh_offset = strtab_offset, .sh_size = strtab_size, .sh_addralign = 1};
+    sections[GDB_SHSTRTAB] = (Elf64_Shdr){
+        .sh_name = 23, .sh_type = SHT_STRTAB, .sh_offset = shstrtab_offset, .sh_size = sizeof(shstrtab),
+        .sh_addralign = 1};
+    return file;
+}
+
+static void gdb_register(JitSymbols* symbols) {
+    struct jit_code_entry* entry = calloc(1, sizeof(struct jit_code_entry));
+    size_t size;
+    entry->symfile_addr = (const char*)gdb_symfile(symbols->pending, symbols->pending_count, &size);
+    entry->symfile_size = size;
+    if (symbols->gdb_entry_count == symbols->gdb_entry_capacity) {
+        symbols->gdb_entry_capacity = symbols->gdb_entry_capacity ? symbols->gdb_entry_capacity * 2 : 8;
+        symbols->gdb_entries =
+            realloc(symbols->gdb_entries, sizeof(struct jit_code_entry*) * symbols->gdb_entry_capacity);
+    }
+    symbols->gdb_entries[symbols->gdb_entry_count++] = entry;
+
+    pthread_mutex_lock(&gdb_lock);
+    entry->next_entry = __jit_debug_descriptor.first_entry;
+    if (entry->next_entry)
+        entry->next_entry->prev_entry = entry;
+    __jit_debug_descriptor.first_entry = entry;
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+    __jit_debug_register_code();
+    pthread_mutex_unlock(&gdb_lock);
+}
+
+// takes out only what this JitSymbols registered, other modules' entries stay
+static void gdb_unregister(JitSymbols* symbols) {
+    pthread_mutex_lock(&gdb_lock);
+    for (size_t i = 0; i < symbols->gdb_entry_count; i++) {
+        struct jit_code_entry* entry = symbols->gdb_entries[i];
+        if (entry->prev_entry)
+            entry->prev_entry->next_entry = entry->next_entry;
+        else
+            __jit_debug_descriptor.first_entry = entry->next_entry;
+        if (entry->next_entry)
+            entry->next_entry->prev_entry = entry->prev_entry;
+        __jit_debug_descriptor.relevant_entry = entry;
+        __jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+        __jit_debug_register_code();
+    }
+    pthread_mutex_unlock(&gdb_lock);
+
+    for (size_t i = 0; i < symbols->gdb_entry_count; i++) {
+        free((void*)symbols->gdb_entries[i]->symfile_addr);
+        free(symbols->gdb_entries[i]);
+    }
+    free(symbols->gdb_entries);
+}
+
+// publish everything added since the last commit
+void symbols_commit(JitSymbols* symbols) {
+    if (symbols->pending_count == 0)
+        return;
+    if (symbols->outputs & SYMBOLS_PERF_MAP)
+        fflush(symbols->perf_map);
+    if (symbols->outputs & SYMBOLS_GDB)
+        gdb_register(symbols);
+
+    for (size_t i = 0; i < symbols->pending_count; i++)
+        free(symbols->pending[i].name);
+    symbols->pending_count = 0;
+}
+
+// unregisters from gdb too, the code is about to go away with the arena
+void symbols_free(JitSymbols* symbols) {
+    if (symbols == NULL)
+        return;
+    symbols_commit(symbols);
+    gdb_unregister(symbols);
+
+    if (symbols->perf_map)
+        fclose(symbols->perf_map);
+    if (symbols->jitdump_fd >= 0) {
+        JitdumpRecord close_record = {
+            .id = JIT_CODE_CLOSE, .total_size = sizeof(close_record), .timestamp = timestamp()};
+        if (write(symbols->jitdump_fd, &close_record, sizeof(close_record)) != sizeof(close_record))
+            perror("jitdump");
+        if (symbols->jitdump_marker)
+            munmap(symbols->jitdump_marker, sysconf(_SC_PAGESIZE));
+        close(symbols->jitdump_fd);
+    }
+    symbols_free_labels(symbols->labels, symbols->label_count);
+    free(symbols->pending);
+    free(symbols);
+}
@@ -0,0 +1,58 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+/*
+ * symbols.h
+ *
+ * Tells profilers and debuggers what the code in the arena is. Every compiled
+ * block is named after the pc of its first instruction (in words, the way
+ * u2asm counts them, not the block's index) and its source label when there
+ * is a .sym file from u2asm --sym, and published through whichever of these
+ * are turned on: a perf map, a perf jitdump and the GDB JIT interface.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SYMBOLS_PERF_MAP (1 << 0)  // /tmp/perf-<pid>.map
+#define SYMBOLS_JITDUMP (1 << 1)   // /tmp/jit-<pid>.dump, for perf inject --jit
+#define SYMBOLS_GDB (1 << 2)       // __jit_debug_register_code
+
+typedef struct {
+    uint8_t* code;
+    size_t size;
+    char* name;
+} JitSymbol;
+
+struct jit_code_entry;
+
+typedef struct JitSymbols {
+    int outputs;  // SYMBOLS_* bits
+    FILE* perf_map;
+    int jitdump_fd;
+    void* jitdump_marker;  // mapping of the dump perf looks for
+    uint64_t code_index;
+
+    char** labels;  // source label of each pc, NULL where there is none
+    size_t label_count;
+
+    JitSymbol* pending;  // added since the last symbols_commit
+    size_t pending_count;
+    size_t pending_capacity;
+
+    struct jit_code_entry** gdb_entries;  // registered by this JitSymbols, other modules have their own
+    size_t gdb_entry_count;
+    size_t gdb_entry_capacity;
+} JitSymbols;
+
+JitSymbols* symbols_create(int outputs, const char* sym_path);
+void symbols_add(JitSymbols* symbols, uint8_t* code, size_t size, const char* name);
+void symbols_add_block(JitSymbols* symbols, uint8_t* code, size_t size, uint64_t pc);
+void symbols_commit(JitSymbols* symbols);
+void symbols_free(JitSymbols* symbols);
+
+char** symbols_load_labels(const char* sym_path, size_t* count);
+void symbols_free_labels(char** labels, size_t count);
+
+#endif
@@ -0,0 +1,182 @@
+#include "u2vm.h"
+#include "../common/config.h"
+#include "arena.h"
+#include "cfg.h"
+#include "decode.h"
+#include "memory.h"
+#include "regalloc.h"
+#include "state.h"
+#include "x86jit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+    libu2vm
+
+    A module is the whole program compiled as
+    units (see jit_unit), one per entry point,
+    each entered with a VMState. The interpreter
+    uses units for a hot part of a program, here
+    every unit holds every block and only ever
+    leaves at the end of the program, at which
+    point it writes back every register the
+    program touches. That's what compiling with
+    all 16 registers observed at the exit gets:
+    liveness keeps every last write around and
+    the unit exit stores them all.
+
+    An entry point that nothing jumps to is in
+    the middle of some block, so entry points are
+    made leaders before the cfg is built. Units
+    are all compiled at load, so a call only ever
+    reads the module and any number of them can
+    run at once.
+*/
+
+struct U2Module {
+    ParsedArray* parsed;
+    JumpTable* jt;
+    LeaderSet* ls;
+    CFG* cfg;
+    CodeArena* arena;
+    VMMemory* memory;
+    JitUnit* units;  // code entered at each block, NULL unless it's an entry point
+};
+
+// index of the instruction at pc, parsed->count if there's none
+static size_t index_at_pc(ParsedArray* parsed, uint64_t pc) {
+    size_t lo = 0;
+    size_t hi = parsed->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (parsed->instructions[mid]->pc < pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < parsed->count && parsed->instructions[lo]->pc == pc ? lo : parsed->count;
+}
+
+// block starting at pc, cfg->count if none does
+static size_t block_at_pc(CFG* cfg, uint64_t pc) {
+    size_t lo = 0;
+    size_t hi = cfg->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->nodes[mid]->instructions[0]->pc < pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < cfg->count && cfg->nodes[lo]->instructions[0]->pc == pc ? lo : cfg->count;
+}
+
+// NULL with a message on stderr if the bytecode is bad or an entry point
+// isn't the pc of an instruction
+U2Module* u2vm_load(const void* bytecode, size_t size, const U2Options* options) {
+    static const U2Options defaults = {0};
+    if (options == NULL)
+        options = &defaults;
+    if (size < sizeof(uint32_t)) {
+        fprintf(stderr, "u2vm: no instructions to load\n");
+        return NULL;
+    }
+
+    U2Module* module = calloc(1, sizeof(U2Module));
+    FILE* f = fmemopen((void*)bytecode, size, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "u2vm: could not read bytecode from memory\n");
+        free(module);
+        return NULL;
+    }
+    module->parsed = decode_bytecode(f);
+    fclose(f);
+    if (module->parsed == NULL || (module->jt = jumptable_from_parsed_array(module->parsed)) == NULL) {
+        u2vm_free(module);
+        return NULL;
+    }
+
+    module->ls = generate_leaders(module->parsed, module->jt);
+    for (size_t i = 0; i < options->entry_count; i++) {
+        size_t index = index_at_pc(module->parsed, options->entry[i]);
+        if (index == module->parsed->count) {
+            fprintf(stderr, "u2vm: entry point %lu isn't the pc of an instruction\n", options->entry[i]);
+            u2vm_free(module);
+            return NULL;
+        }
+        insert_leader(module->ls, index);
+    }
+    CFG* cfg = module->cfg = build_cfg(module->parsed, module->jt, module->ls);
+    compute_liveness(cfg, 0xFFFF);
+    RegAllocation* ra = regalloc_program(cfg, options->regalloc_graph ? REGALLOC_GRAPH : REGALLOC_LINEAR);
+    int32_t state_disp = regalloc_frame_slot(ra);
+
+    module->arena = arena_create(ARENA_DEFAULT_RESERVE, 0);
+    module->memory = memory_create(options->memory_size ? options->memory_size : MEMORY_DEFAULT_SIZE);
+    if (module->arena == NULL || module->memory == NULL) {
+        fprintf(stderr, "u2vm: could not reserve memory for a module\n");
+        u2vm_free(module);
+        return NULL;
+    }
+
+    JitOptions jit_options = {.block_align = 1, .loop_align = 16, .threads = 1};
+    jit_options.avx2 = __builtin_cpu_supports("avx2");
+    uint8_t* in_region = malloc(cfg->count);
+    memset(in_region, 1, cfg->count);
+    module->units = calloc(cfg->count, sizeof(JitUnit));
+    module->units[0] = jit_unit(&module->arena->advance, cfg, in_region, 0, state_disp, &jit_options);
+    for (size_t i = 0; i < options->entry_count; i++) {
+        size_t b = block_at_pc(cfg, options->entry[i]);
+        if (module->units[b] == NULL)
+            module->units[b] = jit_unit(&module->arena->advance, cfg, in_region, b, state_disp, &jit_options);
+    }
+    arena_seal(module->arena);
+    free(in_region);
+    return module;
+}
+
+// regs holds U2VM_REGS registers, see U2VM_REG. 0 once the program ran to the
+// end, the trap signal if it trapped (regs are left as they were) and -1 if
+// pc isn't an entry point
+int u2vm_call(U2Module* module, uint64_t pc, uint64_t* regs, U2Trap* trap) {
+    CFG* cfg = module->cfg;
+    size_t b = block_at_pc(cfg, pc);
+    if (b == cfg->count || module->units[b] == NULL) {
+        fprintf(stderr, "u2vm: %lu isn't an entry point\n", pc);
+        return -1;
+    }
+
+    VMState state = {.mem = module->memory->base};
+    memcpy(state.regs, regs, sizeof(state.regs));
+    MemoryTrap memory_trap;
+    memory_run(module->memory, (RunEntry)module->units[b], &state, &memory_trap);
+    if (trap) {
+        trap->signal = memory_trap.signal;
+        trap->offset = memory_trap.offset;
+    }
+    if (memory_trap.signal)
+        return memory_trap.signal;
+    memcpy(regs, state.regs, sizeof(state.regs));
+    return 0;
+}
+
+// the module's linear memory, address 0 of u2 code is the first byte
+uint8_t* u2vm_memory(U2Module* module, size_t* size) {
+    if (size)
+        *size = module->memory->size;
+    return module->memory->base;
+}
+
+void u2vm_free(U2Module* module) {
+    if (module == NULL)
+        return;
+    arena_free(module->arena);
+    memory_free(module->memory);
+    free(module->units);
+    free_cfg(module->cfg);
+    free_leader_set(module->ls);
+    free_jump_table(module->jt);
+    free_parsed_array(module->parsed);
+    free(module);
+}
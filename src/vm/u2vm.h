@@ -0,0 +1,63 @@
+#ifndef U2VM_H
+#define U2VM_H
+
+/*
+ * u2vm.h
+ *
+ * libu2vm, the vm as a library: compile a program once, call it as often as
+ * needed. This is the only header an embedder needs.
+ *
+ *     U2Module* module = u2vm_load(bytecode, size, NULL);
+ *     uint64_t regs[U2VM_REGS] = {0};
+ *     regs[U2VM_REG(2)] = 41;
+ *     if (u2vm_call(module, 0, regs, NULL) == 0)
+ *         printf("%lu\n", regs[U2VM_REG(1)]);
+ *     u2vm_free(module);
+ *
+ * A call starts at an entry point with the registers it is given and leaves
+ * the registers the program ended with in the same array, registers the
+ * program never writes come back as they went in. Vector registers start at 0
+ * every call and nothing of them comes back. Every module has its own linear
+ * memory, which persists from one call to the next.
+ *
+ * Any number of threads can load and call at once, nothing is shared between
+ * modules. Calls into the same module share its memory, overlapping ones see
+ * each other's stores the way threads would.
+ *
+ * Traps are caught with SIGSEGV and SIGFPE handlers installed on the first
+ * call and left in place. Any SIGSEGV or SIGFPE that isn't a u2 trap goes on to
+ * the handler that was installed before that first call, so install yours
+ * first (or chain to the previous one if you install it later).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the only symbols libu2vm.so exports, the rest is built with -fvisibility=hidden
+#define U2VM_API __attribute__((visibility("default")))
+
+#define U2VM_REGS 16
+
+// index of rn in a register array. r16 is encoded as 0, so it's regs[0]
+#define U2VM_REG(n) ((n) & 15)
+
+typedef struct U2Module U2Module;
+
+typedef struct {
+    int regalloc_graph;     // chaitin-briggs instead of linear scan
+    size_t memory_size;     // bytes of linear memory, 0 for the vm default (16MiB)
+    const uint64_t* entry;  // pcs (in words, see u2asm --sym) u2vm_call can
+    size_t entry_count;     // start at besides 0, which always can
+} U2Options;
+
+typedef struct {
+    int signal;      // SIGSEGV for ld/st out of bounds, SIGFPE for division
+    int64_t offset;  // faulting address relative to the start of memory (SIGSEGV only)
+} U2Trap;
+
+U2VM_API U2Module* u2vm_load(const void* bytecode, size_t size, const U2Options* options);
+U2VM_API int u2vm_call(U2Module* module, uint64_t pc, uint64_t* regs, U2Trap* trap);
+U2VM_API uint8_t* u2vm_memory(U2Module* module, size_t* size);
+U2VM_API void u2vm_free(U2Module* module);
+
+#endif
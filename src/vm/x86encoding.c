@@ -10,6 +10,7 @@
  */
 
 #include "x86encoding.h"
+#include "arena.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,22 +24,245 @@
 
 _x86_encoding __mov_r32_imm32 = {.opcode = 0xB8, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 4, .reg_in_opcode = 1};
 
-_x86_encoding __mov_r64_imm64 = {.opcode = 0xB8, .opcode_ext = -1, .needs_rex_w = 1, .imm_size = 8, .reg_in_opcode = 1};
+_x86_encoding __mov_r64_imm64 = {
+    .opcode = 0xB8, .opcode_ext = -1, .needs_rex_w = 1, .imm_size = 8, .reg_in_opcode = 1, .shorter = &__mov_r32_imm32};
 
 _x86_encoding __mov_rm64_r64 = {.opcode = 0x89, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
 
+_x86_encoding __mov_r64_rm64 = {.opcode = 0x8B, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __mov_rm64_imm32 = {.opcode = 0xC7, .opcode_ext = 0, .needs_rex_w = 1, .imm_size = 4, .imm_signed = 1};
+
+_x86_encoding __add_rm64_imm32 = {
+    .opcode = 0x81, .opcode_ext = 0, .needs_rex_w = 1, .imm_size = 4, .imm_signed = 1, .shorter = &__add_rm64_imm8};
+
+_x86_encoding __add_rm64_imm8 = {.opcode = 0x83, .opcode_ext = 0, .needs_rex_w = 1, .imm_size = 1, .imm_signed = 1};
+
+_x86_encoding __sub_rm64_imm32 = {
+    .opcode = 0x81, .opcode_ext = 5, .needs_rex_w = 1, .imm_size = 4, .imm_signed = 1, .shorter = &__sub_rm64_imm8};
+
+_x86_encoding __sub_rm64_imm8 = {.opcode = 0x83, .opcode_ext = 5, .needs_rex_w = 1, .imm_size = 1, .imm_signed = 1};
+
+_x86_encoding __and_rm64_imm32 = {
+    .opcode = 0x81, .opcode_ext = 4, .needs_rex_w = 1, .imm_size = 4, .imm_signed = 1, .shorter = &__and_rm64_imm8};
+
+_x86_encoding __add_rm64_r64 = {.opcode = 0x01, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __add_r64_rm64 = {.opcode = 0x03, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __sub_rm64_r64 = {.opcode = 0x29, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __sub_r64_rm64 = {.opcode = 0x2B, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __and_rm64_r64 = {.opcode = 0x21, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __and_r64_rm64 = {.opcode = 0x23, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __or_rm64_r64 = {.opcode = 0x09, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __or_r64_rm64 = {.opcode = 0x0B, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __xor_rm64_r64 = {.opcode = 0x31, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __xor_r64_rm64 = {.opcode = 0x33, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __xor_rm32_r32 = {.opcode = 0x31, .opcode_ext = -2, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __imul_r64_rm64 = {.escape = 0x0F, .opcode = 0xAF, .opcode_ext = -2, .needs_rex_w = 1};
+
+_x86_encoding __not_rm64 = {.opcode = 0xF7, .opcode_ext = 2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __neg_rm64 = {.opcode = 0xF7, .opcode_ext = 3, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __idiv_rm64 = {.opcode = 0xF7, .opcode_ext = 7, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __cqo = {.opcode = 0x99, .opcode_ext = -1, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __lea_r64_m = {.opcode = 0x8D, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __shl_rm64_imm8 = {.opcode = 0xC1, .opcode_ext = 4, .needs_rex_w = 1, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __shr_rm64_imm8 = {.opcode = 0xC1, .opcode_ext = 5, .needs_rex_w = 1, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __mov_rm32_r32 = {.opcode = 0x89, .opcode_ext = -2, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __mov_r32_rm32 = {.opcode = 0x8B, .opcode_ext = -2, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __push_rm64 = {.opcode = 0xFF, .opcode_ext = 6, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __pop_rm64 = {.opcode = 0x8F, .opcode_ext = 0, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __cmp_rm64_r64 = {.opcode = 0x39, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __cmp_r64_rm64 = {.opcode = 0x3B, .opcode_ext = -2, .needs_rex_w = 1, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __jmp_rel32 = {.opcode = 0xE9, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 4, .reg_in_opcode = 0};
+
+_x86_encoding __je_rel32 = {.escape = 0x0F, .opcode = 0x84, .opcode_ext = -1, .imm_size = 4};
+
+_x86_encoding __jne_rel32 = {.escape = 0x0F, .opcode = 0x85, .opcode_ext = -1, .imm_size = 4};
+
+_x86_encoding __jl_rel32 = {.escape = 0x0F, .opcode = 0x8C, .opcode_ext = -1, .imm_size = 4};
+
+_x86_encoding __jg_rel32 = {.escape = 0x0F, .opcode = 0x8F, .opcode_ext = -1, .imm_size = 4};
+
+_x86_encoding __jge_rel32 = {.escape = 0x0F, .opcode = 0x8D, .opcode_ext = -1, .imm_size = 4};
+
+_x86_encoding __jle_rel32 = {.escape = 0x0F, .opcode = 0x8E, .opcode_ext = -1, .imm_size = 4};
+
+_x86_encoding __jmp_rel8 = {.opcode = 0xEB, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __je_rel8 = {.opcode = 0x74, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __jne_rel8 = {.opcode = 0x75, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __jl_rel8 = {.opcode = 0x7C, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __jg_rel8 = {.opcode = 0x7F, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __jge_rel8 = {.opcode = 0x7D, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __jle_rel8 = {.opcode = 0x7E, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 1, .reg_in_opcode = 0};
+
+_x86_encoding __pushf = {.opcode = 0x9C, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __popf = {.opcode = 0x9D, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __push_r64 = {.opcode = 0x50, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 1};
+
+_x86_encoding __pop_r64 = {.opcode = 0x58, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 1};
+
+_x86_encoding __push_imm32 = {
+    .opcode = 0x68, .opcode_ext = -1, .imm_size = 4, .imm_signed = 1, .shorter = &__push_imm8};
+
+_x86_encoding __push_imm8 = {.opcode = 0x6A, .opcode_ext = -1, .imm_size = 1, .imm_signed = 1};
+
+_x86_encoding __and_rm64_imm8 = {.opcode = 0x83, .opcode_ext = 4, .needs_rex_w = 1, .imm_size = 1, .imm_signed = 1};
+
+_x86_encoding __call_rm64 = {.opcode = 0xFF, .opcode_ext = 2, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __jmp_rm64 = {.opcode = 0xFF, .opcode_ext = 4, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __call_rel32 = {.opcode = 0xE8, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 4, .reg_in_opcode = 0};
+
+_x86_encoding __cmp_rm64_imm8 = {.opcode = 0x83, .opcode_ext = 7, .needs_rex_w = 1, .imm_size = 1, .imm_signed = 1};
+
+// only al/cl/dl/bl as reg, the others need a rex prefix this doesn't emit
+_x86_encoding __mov_rm8_r8 = {.opcode = 0x88, .opcode_ext = -2, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
+
+_x86_encoding __syscall = {.escape = 0x0F, .opcode = 0x05, .opcode_ext = -1, .imm_size = 0};
+
 _x86_encoding __ret = {.opcode = 0xC3, .opcode_ext = -1, .needs_rex_w = 0, .imm_size = 0, .reg_in_opcode = 0};
 
+/*
+    SIMD
+
+    Registers are numbered like the general purpose
+    ones, reg 0 is xmm0/ymm0. The sse forms are
+    two address (x op= xm), the vex ones take their
+    first source in vvvv and only ever get a memory
+    operand here, see emit_x86instruction_vex.
+*/
+
+_x86_encoding __movdqu_x_xm = {.prefix = 0xF3, .escape = 0x0F, .opcode = 0x6F, .opcode_ext = -2};
+
+_x86_encoding __movdqu_xm_x = {.prefix = 0xF3, .escape = 0x0F, .opcode = 0x7F, .opcode_ext = -2};
+
+_x86_encoding __paddd_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0xFE, .opcode_ext = -2};
+
+_x86_encoding __psubd_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0xFA, .opcode_ext = -2};
+
+_x86_encoding __pmuludq_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0xF4, .opcode_ext = -2};
+
+_x86_encoding __pand_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0xDB, .opcode_ext = -2};
+
+_x86_encoding __por_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0xEB, .opcode_ext = -2};
+
+_x86_encoding __pxor_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0xEF, .opcode_ext = -2};
+
+_x86_encoding __pcmpeqd_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0x76, .opcode_ext = -2};
+
+_x86_encoding __pcmpgtd_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0x66, .opcode_ext = -2};
+
+_x86_encoding __pshufd_x_xm_imm8 = {.prefix = 0x66, .escape = 0x0F, .opcode = 0x70, .opcode_ext = -2, .imm_size = 1};
+
+_x86_encoding __punpckldq_x_xm = {.prefix = 0x66, .escape = 0x0F, .opcode = 0x62, .opcode_ext = -2};
+
+_x86_encoding __vmovdqu_y_ym = {.prefix = 0xF3, .escape = 0x0F, .vex = 256, .opcode = 0x6F, .opcode_ext = -2};
+
+_x86_encoding __vmovdqu_ym_y = {.prefix = 0xF3, .escape = 0x0F, .vex = 256, .opcode = 0x7F, .opcode_ext = -2};
+
+_x86_encoding __vpaddd_y_y_ym = {.prefix = 0x66, .escape = 0x0F, .vex = 256, .opcode = 0xFE, .opcode_ext = -2};
+
+_x86_encoding __vpsubd_y_y_ym = {.prefix = 0x66, .escape = 0x0F, .vex = 256, .opcode = 0xFA, .opcode_ext = -2};
+
+_x86_encoding __vpmulld_y_y_ym = {
+    .prefix = 0x66, .escape = 0x0F, .escape2 = 0x38, .vex = 256, .opcode = 0x40, .opcode_ext = -2};
+
+_x86_encoding __vpand_y_y_ym = {.prefix = 0x66, .escape = 0x0F, .vex = 256, .opcode = 0xDB, .opcode_ext = -2};
+
+_x86_encoding __vpor_y_y_ym = {.prefix = 0x66, .escape = 0x0F, .vex = 256, .opcode = 0xEB, .opcode_ext = -2};
+
+_x86_encoding __vpxor_y_y_ym = {.prefix = 0x66, .escape = 0x0F, .vex = 256, .opcode = 0xEF, .opcode_ext = -2};
+
+_x86_encoding __vpcmpeqd_y_y_ym = {.prefix = 0x66, .escape = 0x0F, .vex = 256, .opcode = 0x76, .opcode_ext = -2};
+
+_x86_encoding __vpcmpgtd_y_y_ym = {.prefix = 0x66, .escape = 0x0F, .vex = 256, .opcode = 0x66, .opcode_ext = -2};
+
+_x86_encoding __vzeroupper = {.escape = 0x0F, .vex = 128, .opcode = 0x77, .opcode_ext = -1};
+
+static char* x86_register_names[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+char* x86_register_name(_x86_register reg) {
+    if (reg < _x86_RAX || reg > _x86_R15)
+        return "spill";
+    return x86_register_names[reg];
+}
+
+// sysv: whoever we hand these back to expects them untouched
+int x86_is_callee_saved(_x86_register reg) {
+    return reg == _x86_RBX || reg == _x86_RBP || (reg >= _x86_R12 && reg <= _x86_R15);
+}
+
 void emit_byte(uint8_t** jit_memory, uint8_t byte) {
+    if (*jit_memory == ((CodeArena*)jit_memory)->committed)
+        arena_ensure(jit_memory, 1);
     *(*jit_memory)++ = byte;
 }
 
-void emit_rex(uint8_t** jit_memory, uint32_t w, uint32_t reg, uint32_t rm) {
+// recommended multi byte nops, one instruction each so padding that gets
+// executed costs a single decode slot
+static const uint8_t nops[9][9] = {
+    {0x90},
+    {0x66, 0x90},
+    {0x0F, 0x1F, 0x00},
+    {0x0F, 0x1F, 0x40, 0x00},
+    {0x0F, 0x1F, 0x44, 0x00, 0x00},
+    {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+    {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+    {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+};
+
+void emit_x86nop(uint8_t** jit_memory, size_t size) {
+    while (size) {
+        size_t n = size > 9 ? 9 : size;
+        for (size_t i = 0; i < n; i++)
+            emit_byte(jit_memory, nops[n - 1][i]);
+        size -= n;
+    }
+}
+
+void emit_rex(uint8_t** jit_memory, uint32_t w, uint32_t reg, uint32_t index, uint32_t rm) {
     uint8_t rex = REX_BASE;
     if (w)
         rex |= REX_W;  // 64-bit
     if (reg & 8)
         rex |= REX_R;  // R
+    if (index & 8)
+        rex |= REX_X;  // X
     if (rm & 8)
         rex |= REX_B;  // B
     if (rex != REX_BASE)
@@ -50,15 +274,87 @@ void emit_modrm(uint8_t** jit_memory, uint8_t mod, uint8_t reg, uint8_t rm) {
     emit_byte(jit_memory, modrm);
 }
 
+// VEX.pp for a mandatory prefix
+static uint8_t vex_pp(uint8_t prefix) {
+    switch (prefix) {
+    case 0x66:
+        return 1;
+    case 0xF3:
+        return 2;
+    case 0xF2:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+// everything before the modrm: prefixes, rex or vex, escapes and the opcode.
+// vvvv is the extra source of vex encodings, anything else ignores it
+static void emit_opcode(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t index, uint32_t rm,
+                        uint32_t vvvv) {
+    if (encoding->vex) {
+        // R, X, B and vvvv are stored inverted
+        uint8_t tail = (uint8_t)((~vvvv & 15) << 3 | (encoding->vex == 256) << 2 | vex_pp(encoding->prefix));
+        if (!encoding->needs_rex_w && !encoding->escape2 && !(index & 8) && !(rm & 8)) {
+            emit_byte(jit_memory, 0xC5);
+            emit_byte(jit_memory, (uint8_t)((~reg & 8) << 4 | tail));
+        } else {
+            emit_byte(jit_memory, 0xC4);
+            uint8_t map = encoding->escape2 == 0x38 ? 2 : 1;
+            emit_byte(jit_memory, (uint8_t)((~reg & 8) << 4 | (~index & 8) << 3 | (~rm & 8) << 2 | map));
+            emit_byte(jit_memory, (uint8_t)((encoding->needs_rex_w ? 0x80 : 0) | tail));
+        }
+        emit_byte(jit_memory, encoding->opcode);
+        return;
+    }
+
+    // a mandatory prefix goes before rex, anything between them voids the rex
+    if (encoding->prefix)
+        emit_byte(jit_memory, encoding->prefix);
+    if (encoding->needs_rex_w || reg >= _x86_R8 || index >= _x86_R8 || rm >= _x86_R8)
+        emit_rex(jit_memory, encoding->needs_rex_w, reg, index, rm);
+    if (encoding->escape)
+        emit_byte(jit_memory, encoding->escape);
+    if (encoding->escape2)
+        emit_byte(jit_memory, encoding->escape2);
+    emit_byte(jit_memory, encoding->opcode);
+}
+
+// whether imm survives being cut down to the encoding's immediate and extended
+// back to 64 bits
+static int imm_fits(_x86_encoding* encoding, uint64_t imm) {
+    if (encoding->imm_size >= 8)
+        return 1;
+    int bits = encoding->imm_size * 8;
+    if (encoding->imm_signed) {
+        int64_t value = (int64_t)imm;
+        return value >= -(INT64_C(1) << (bits - 1)) && value < (INT64_C(1) << (bits - 1));
+    }
+    return imm < (UINT64_C(1) << bits);
+}
+
+// follow the chain of shorter forms as far as imm allows, every emit goes
+// through this so callers just name the widest form
+_x86_encoding* x86_shortest_encoding(_x86_encoding* encoding, uint64_t imm) {
+    while (encoding->shorter && imm_fits(encoding->shorter, imm))
+        encoding = encoding->shorter;
+    return encoding;
+}
+
 void emit_x86instruction(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t rm, uint64_t imm) {
-    if (encoding->needs_rex_w || reg >= _x86_R8 || rm >= _x86_R8) {
-        emit_rex(jit_memory, encoding->needs_rex_w, reg, rm);
+    encoding = x86_shortest_encoding(encoding, imm);
+    if (encoding->reg_in_opcode) {
+        // register encoded in the opcode is extended by REX.B, not REX.R
+        rm = reg;
+        reg = 0;
     }
 
     if (encoding->reg_in_opcode) {
-        emit_byte(jit_memory, encoding->opcode | (reg & 7));
+        if (encoding->needs_rex_w || rm >= _x86_R8)
+            emit_rex(jit_memory, encoding->needs_rex_w, 0, 0, rm);
+        emit_byte(jit_memory, encoding->opcode | (rm & 7));
     } else {
-        emit_byte(jit_memory, encoding->opcode);
+        emit_opcode(jit_memory, encoding, reg, 0, rm, 0);
     }
 
     if (encoding->opcode_ext >= 0) {
@@ -71,3 +367,64 @@ void emit_x86instruction(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t
         emit_byte(jit_memory, (imm >> (i * 8)) & 0xFF);
     }
 }
+
+// modrm (and sib) for a memory operand [base + index + disp], index < 0 for
+// none. disp is left off entirely when it is 0 and the base allows it, and
+// takes a single sign extended byte when it fits
+static void emit_mem_operand(uint8_t** jit_memory, uint32_t reg, uint32_t base, int index, int32_t disp) {
+    // rbp and r13 with mod 00 mean rip/absolute, they always need a displacement
+    uint8_t mod;
+    if (disp == 0 && (base & 7) != _x86_RBP)
+        mod = 0b00;
+    else if (disp >= INT8_MIN && disp <= INT8_MAX)
+        mod = 0b01;
+    else
+        mod = 0b10;
+
+    if (index >= 0) {
+        emit_modrm(jit_memory, mod, reg & 7, 0b100);
+        emit_byte(jit_memory, (uint8_t)(((index & 7) << 3) | (base & 7)));  // sib, scale 1
+    } else {
+        emit_modrm(jit_memory, mod, reg & 7, base & 7);
+        if ((base & 7) == _x86_RSP) {
+            // rsp and r12 as rm mean "sib follows", sib of 0x24 is just [base]
+            emit_byte(jit_memory, 0x24);
+        }
+    }
+
+    if (mod == 0b01) {
+        emit_byte(jit_memory, (uint8_t)disp);
+    } else if (mod == 0b10) {
+        for (int i = 0; i < 4; i++) {
+            emit_byte(jit_memory, ((uint32_t)disp >> (i * 8)) & 0xFF);
+        }
+    }
+}
+
+// same as emit_x86instruction but rm is the memory operand [base + index + disp]
+void emit_x86instruction_sib(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t base, int index,
+                             int32_t disp, uint64_t imm) {
+    encoding = x86_shortest_encoding(encoding, imm);
+    if (encoding->opcode_ext >= 0)
+        reg = encoding->opcode_ext;
+
+    emit_opcode(jit_memory, encoding, reg, index >= 0 ? (uint32_t)index : 0, base, 0);
+    emit_mem_operand(jit_memory, reg, base, index, disp);
+
+    for (int i = 0; i < encoding->imm_size; i++) {
+        emit_byte(jit_memory, (imm >> (i * 8)) & 0xFF);
+    }
+}
+
+// same as emit_x86instruction but rm is the memory operand [base + disp]
+void emit_x86instruction_mem(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t base, int32_t disp,
+                             uint64_t imm) {
+    emit_x86instruction_sib(jit_memory, encoding, reg, base, -1, disp, imm);
+}
+
+// vex three operand form, reg = vvvv op [base + index + disp]. index < 0 for none
+void emit_x86instruction_vex(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t vvvv, uint32_t base,
+                             int index, int32_t disp) {
+    emit_opcode(jit_memory, encoding, reg, index >= 0 ? (uint32_t)index : 0, base, vvvv);
+    emit_mem_operand(jit_memory, reg, base, index, disp);
+}
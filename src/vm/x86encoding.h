@@ -1,6 +1,7 @@
 #ifndef X86ENCODING_H
 #define X86ENCODING_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define REX_BASE 0x40
@@ -29,20 +30,118 @@ typedef enum {
     _x86_R15 = 15
 } _x86_register;
 
-typedef struct {
+typedef struct _x86_encoding {
+    uint8_t prefix;   // mandatory 0x66/0xF3 of sse instructions (VEX.pp with vex), 0 for none
+    uint8_t escape;   // 0x0F for two byte opcodes, 0 otherwise
+    uint8_t escape2;  // 0x38 for three byte opcodes, 0 otherwise
+    int vex;          // 128 or 256 for VEX encoded xmm/ymm instructions, 0 for legacy
     uint8_t opcode;
     int opcode_ext;  // -2: reg/rm, -1: none, else modrm /digit
     int needs_rex_w;
-    uint8_t imm_size;   // number of bytes to append
-    int reg_in_opcode;  // stupid shit like b8+rd
+    uint8_t imm_size;               // number of bytes to append
+    int imm_signed;                 // imm is sign extended to the operand size
+    int reg_in_opcode;              // stupid shit like b8+rd
+    struct _x86_encoding* shorter;  // same instruction with a smaller imm, used whenever it fits
 } _x86_encoding;
 
 void emit_byte(uint8_t** jit_memory, uint8_t byte);
+void emit_x86nop(uint8_t** jit_memory, size_t size);
 void emit_x86instruction(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t rm, uint64_t imm);
+void emit_x86instruction_mem(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t base, int32_t disp,
+                             uint64_t imm);
+void emit_x86instruction_sib(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t base, int index,
+                             int32_t disp, uint64_t imm);
+void emit_x86instruction_vex(uint8_t** jit_memory, _x86_encoding* encoding, uint32_t reg, uint32_t vvvv, uint32_t base,
+                             int index, int32_t disp);
+char* x86_register_name(_x86_register reg);
+int x86_is_callee_saved(_x86_register reg);
+_x86_encoding* x86_shortest_encoding(_x86_encoding* encoding, uint64_t imm);
 
 extern _x86_encoding __mov_r64_imm64;
 extern _x86_encoding __mov_r32_imm32;
 extern _x86_encoding __mov_rm64_r64;
+extern _x86_encoding __mov_r64_rm64;
+extern _x86_encoding __mov_rm64_imm32;
+extern _x86_encoding __add_rm64_imm32;
+extern _x86_encoding __add_rm64_imm8;
+extern _x86_encoding __sub_rm64_imm32;
+extern _x86_encoding __sub_rm64_imm8;
+extern _x86_encoding __and_rm64_imm32;
+extern _x86_encoding __add_rm64_r64;
+extern _x86_encoding __add_r64_rm64;
+extern _x86_encoding __sub_rm64_r64;
+extern _x86_encoding __sub_r64_rm64;
+extern _x86_encoding __and_rm64_r64;
+extern _x86_encoding __and_r64_rm64;
+extern _x86_encoding __or_rm64_r64;
+extern _x86_encoding __or_r64_rm64;
+extern _x86_encoding __xor_rm64_r64;
+extern _x86_encoding __xor_r64_rm64;
+extern _x86_encoding __xor_rm32_r32;
+extern _x86_encoding __imul_r64_rm64;
+extern _x86_encoding __not_rm64;
+extern _x86_encoding __neg_rm64;
+extern _x86_encoding __idiv_rm64;
+extern _x86_encoding __cqo;
+extern _x86_encoding __lea_r64_m;
+extern _x86_encoding __shl_rm64_imm8;
+extern _x86_encoding __shr_rm64_imm8;
+extern _x86_encoding __mov_rm32_r32;
+extern _x86_encoding __mov_r32_rm32;
+extern _x86_encoding __push_rm64;
+extern _x86_encoding __pop_rm64;
+extern _x86_encoding __cmp_rm64_r64;
+extern _x86_encoding __cmp_r64_rm64;
+extern _x86_encoding __jmp_rel32;
+extern _x86_encoding __je_rel32;
+extern _x86_encoding __jne_rel32;
+extern _x86_encoding __jl_rel32;
+extern _x86_encoding __jg_rel32;
+extern _x86_encoding __jge_rel32;
+extern _x86_encoding __jle_rel32;
+extern _x86_encoding __jmp_rel8;
+extern _x86_encoding __je_rel8;
+extern _x86_encoding __jne_rel8;
+extern _x86_encoding __jl_rel8;
+extern _x86_encoding __jg_rel8;
+extern _x86_encoding __jge_rel8;
+extern _x86_encoding __jle_rel8;
+extern _x86_encoding __pushf;
+extern _x86_encoding __popf;
+extern _x86_encoding __push_r64;
+extern _x86_encoding __pop_r64;
+extern _x86_encoding __push_imm32;
+extern _x86_encoding __push_imm8;
+extern _x86_encoding __and_rm64_imm8;
+extern _x86_encoding __call_rm64;
+extern _x86_encoding __jmp_rm64;
+extern _x86_encoding __call_rel32;
+extern _x86_encoding __cmp_rm64_imm8;
+extern _x86_encoding __mov_rm8_r8;
+extern _x86_encoding __syscall;
 extern _x86_encoding __ret;
+extern _x86_encoding __movdqu_x_xm;
+extern _x86_encoding __movdqu_xm_x;
+extern _x86_encoding __paddd_x_xm;
+extern _x86_encoding __psubd_x_xm;
+extern _x86_encoding __pmuludq_x_xm;
+extern _x86_encoding __pand_x_xm;
+extern _x86_encoding __por_x_xm;
+extern _x86_encoding __pxor_x_xm;
+extern _x86_encoding __pcmpeqd_x_xm;
+extern _x86_encoding __pcmpgtd_x_xm;
+extern _x86_encoding __pshufd_x_xm_imm8;
+extern _x86_encoding __punpckldq_x_xm;
+extern _x86_encoding __vmovdqu_y_ym;
+extern _x86_encoding __vmovdqu_ym_y;
+extern _x86_encoding __vpaddd_y_y_ym;
+extern _x86_encoding __vpsubd_y_y_ym;
+extern _x86_encoding __vpmulld_y_y_ym;
+extern _x86_encoding __vpand_y_y_ym;
+extern _x86_encoding __vpor_y_y_ym;
+extern _x86_encoding __vpxor_y_y_ym;
+extern _x86_encoding __vpcmpeqd_y_y_ym;
+extern _x86_encoding __vpcmpgtd_y_y_ym;
+extern _x86_encoding __vzeroupper;
 
 #endif
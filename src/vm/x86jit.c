@@ -11,194 +11,1548 @@
  */
 
 #include "x86jit.h"
+#include "../common/config.h"
 #include "../common/instruction.h"
 #include "regalloc.h"
+#include "state.h"
 #include "x86encoding.h"
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
     To convert u2 bytecode to x86 all u2 registers
     r1-r16 must be mapped to valid (and
     non-destructive) x86 registers. Spill registers
     are handled as memory instead of registers.
+
+    Spilled registers live in the stack frame set up
+    by init_jit, anything that needs to pass through
+    a register on the way uses JIT_SCRATCH which the
+    allocator never hands out.
 */
 
 void emit_x86ret(uint8_t** jit_memory) {
     emit_x86instruction(jit_memory, &__ret, 0, 0, 0);
 }
 
-void emit_x86ret_reg(uint8_t** jit_memory, uint32_t rd) {
-    int dst = regalloc_u2a_x86(rd - 1);
-    emit_x86instruction(jit_memory, &__mov_rm64_r64, dst, 0, 0);
-    emit_x86instruction(jit_memory, &__ret, dst, 0, 0);
+void emit_x86ret_reg(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd) {
+    int src = regalloc_u2a_x86(ra, rd);
+    if (!(ra->used & (1 << rd))) {
+        // program never touched the register, return 0 instead of garbage
+        emit_x86instruction(jit_memory, &__mov_r32_imm32, _x86_RAX, 0, 0);
+    } else if (src == _x86_SPILL) {
+        emit_spill_load(jit_memory, ra, _x86_RAX, rd);
+    } else if (src != _x86_RAX) {
+        emit_x86instruction(jit_memory, &__mov_rm64_r64, src, _x86_RAX, 0);
+    }
+    free_jit(jit_memory, ra);
+    emit_x86instruction(jit_memory, &__ret, 0, 0, 0);
+}
+
+void emit_spill_load(uint8_t** jit_memory, RegAllocation* ra, _x86_register dst, uint32_t reg) {
+    emit_x86instruction_mem(jit_memory, &__mov_r64_rm64, dst, _x86_RSP, regalloc_spill_disp(ra, reg), 0);
 }
 
-void emit_mov(uint8_t** jit_memory, uint32_t rd, uint32_t rs1) {
-    int dst = regalloc_u2a_x86(rd);
-    int src = regalloc_u2a_x86(rs1);
+void emit_spill_store(uint8_t** jit_memory, RegAllocation* ra, uint32_t reg, _x86_register src) {
+    emit_x86instruction_mem(jit_memory, &__mov_rm64_r64, src, _x86_RSP, regalloc_spill_disp(ra, reg), 0);
+}
 
-    // genius optimization
-    if (dst == src)
+void emit_mov(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1) {
+    int dst = regalloc_u2a_x86(ra, rd);
+    int src = regalloc_u2a_x86(ra, rs1);
+
+    // genius optimization (also what coalescing in regalloc.c is aiming for)
+    if (rd == rs1 || (dst == src && dst != _x86_SPILL))
         return;
 
-    // register to register
     if (dst != _x86_SPILL && src != _x86_SPILL) {
-        emit_x86instruction(jit_memory, &__mov_rm64_r64, dst, src, 0);
+        // register to register
+        emit_x86instruction(jit_memory, &__mov_rm64_r64, src, dst, 0);
+    } else if (dst == _x86_SPILL && src != _x86_SPILL) {
+        emit_spill_store(jit_memory, ra, rd, src);
+    } else if (dst != _x86_SPILL && src == _x86_SPILL) {
+        emit_spill_load(jit_memory, ra, dst, rs1);
     } else {
-        printf("TODO: implement this lol\n");
-        exit(EXIT_FAILURE);
+        // memory to memory goes through the scratch register
+        emit_spill_load(jit_memory, ra, JIT_SCRATCH, rs1);
+        emit_spill_store(jit_memory, ra, rd, JIT_SCRATCH);
     }
-
-    // TODO: implement spill
 }
 
-void emit_li(uint8_t** jit_memory, uint32_t rd, uint64_t imm) {
-    int dst = regalloc_u2a_x86(rd);
+void emit_li(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint64_t imm) {
+    int dst = regalloc_u2a_x86(ra, rd);
 
     if (dst != _x86_SPILL) {
         if (imm <= UINT32_MAX) {
             // 32bit load imm
             emit_x86instruction(jit_memory, &__mov_r32_imm32, dst, 0, imm);
+        } else if ((int64_t)imm < 0 && (int64_t)imm >= INT32_MIN) {
+            // small negative, sign extended imm32 beats movabs
+            emit_x86instruction(jit_memory, &__mov_rm64_imm32, 0, dst, imm);
         } else {
             // 64bit load imm
             emit_x86instruction(jit_memory, &__mov_r64_imm64, dst, 0, imm);
         }
+    } else if ((int64_t)imm >= INT32_MIN && (int64_t)imm <= INT32_MAX) {
+        // sign extended 32bit imm straight into the stack slot
+        emit_x86instruction_mem(jit_memory, &__mov_rm64_imm32, 0, _x86_RSP, regalloc_spill_disp(ra, rd), imm);
     } else {
-        printf("TODO: implement this aswell\n");
-        exit(EXIT_FAILURE);
+        emit_x86instruction(jit_memory, &__mov_r64_imm64, JIT_SCRATCH, 0, imm);
+        emit_spill_store(jit_memory, ra, rd, JIT_SCRATCH);
+    }
+}
+
+/**
+    Memory accesses go to JIT_MEMBASE + zext32(reg) +
+    sext32(imm) with no bounds check, memory.c makes
+    sure everything that can reach is either real
+    memory or a guard page. The 32bit mov into the
+    scratch register is what does the zero extension.
+*/
+
+// JIT_SCRATCH = low 32 bits of rs
+static void emit_mem_index(uint8_t** jit_memory, RegAllocation* ra, uint32_t rs) {
+    int src = regalloc_u2a_x86(ra, rs);
+    if (src == _x86_SPILL) {
+        emit_x86instruction_mem(jit_memory, &__mov_r32_rm32, JIT_SCRATCH, _x86_RSP, regalloc_spill_disp(ra, rs), 0);
+    } else {
+        emit_x86instruction(jit_memory, &__mov_rm32_r32, src, JIT_SCRATCH, 0);
+    }
+}
+
+void emit_ld(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint64_t imm) {
+    int dst = regalloc_u2a_x86(ra, rd);
+    emit_mem_index(jit_memory, ra, rs1);
+
+    if (dst != _x86_SPILL) {
+        emit_x86instruction_sib(jit_memory, &__mov_r64_rm64, dst, JIT_MEMBASE, JIT_SCRATCH, (int32_t)imm, 0);
+    } else {
+        emit_x86instruction_sib(jit_memory, &__mov_r64_rm64, JIT_SCRATCH, JIT_MEMBASE, JIT_SCRATCH, (int32_t)imm, 0);
+        emit_spill_store(jit_memory, ra, rd, JIT_SCRATCH);
+    }
+}
+
+// st rs1 rs2 imm stores rs1 at rs2 + imm
+void emit_st(uint8_t** jit_memory, RegAllocation* ra, uint32_t rs1, uint32_t rs2, uint64_t imm) {
+    int src = regalloc_u2a_x86(ra, rs1);
+    emit_mem_index(jit_memory, ra, rs2);
+
+    if (src != _x86_SPILL) {
+        emit_x86instruction_sib(jit_memory, &__mov_rm64_r64, src, JIT_MEMBASE, JIT_SCRATCH, (int32_t)imm, 0);
+    } else {
+        // the scratch register is busy with the address, go memory to memory
+        // through the stack instead (push computes its address before moving rsp)
+        emit_x86instruction_mem(jit_memory, &__push_rm64, 0, _x86_RSP, regalloc_spill_disp(ra, rs1), 0);
+        emit_x86instruction_sib(jit_memory, &__pop_rm64, 0, JIT_MEMBASE, JIT_SCRATCH, (int32_t)imm, 0);
+    }
+}
+
+/**
+    u2 arithmetic is three address (rd = rs1 op rs2)
+    and x86 is two address (rd op= rs2), so the
+    whole game here is picking an operand order that
+    doesn't need a copy. Roughly what gcc does:
+
+    rd == rs1         op rd, rs2
+    rd == rs2         op rd, rs1 if op commutes
+    otherwise         mov rd, rs1; op rd, rs2
+                      (or lea for add)
+
+    Operands that live in a stack slot are used as
+    the memory operand directly where x86 lets us,
+    otherwise they pass through JIT_SCRATCH.
+*/
+
+typedef struct {
+    _x86_encoding* rm_r;  // op r/m64, r64 (NULL if there is none)
+    _x86_encoding* r_rm;  // op r64, r/m64
+    int commutative;
+} AluOp;
+
+static AluOp alu_add = {&__add_rm64_r64, &__add_r64_rm64, 1};
+static AluOp alu_sub = {&__sub_rm64_r64, &__sub_r64_rm64, 0};
+static AluOp alu_mul = {NULL, &__imul_r64_rm64, 1};
+static AluOp alu_and = {&__and_rm64_r64, &__and_r64_rm64, 1};
+static AluOp alu_or = {&__or_rm64_r64, &__or_r64_rm64, 1};
+static AluOp alu_xor = {&__xor_rm64_r64, &__xor_r64_rm64, 1};
+
+// do two u2 registers share a home (the allocator may give the same x86
+// register to registers that are never live at the same time)
+static int same_home(RegAllocation* ra, uint32_t a, uint32_t b) {
+    int x = regalloc_u2a_x86(ra, a);
+    return a == b || (x != _x86_SPILL && x == regalloc_u2a_x86(ra, b));
+}
+
+// op reg, rs where rs may live in a stack slot
+static void emit_op_src(uint8_t** jit_memory, RegAllocation* ra, _x86_encoding* encoding, _x86_register reg,
+                        uint32_t rs) {
+    int src = regalloc_u2a_x86(ra, rs);
+    if (src == _x86_SPILL) {
+        emit_x86instruction_mem(jit_memory, encoding, reg, _x86_RSP, regalloc_spill_disp(ra, rs), 0);
+    } else {
+        emit_x86instruction(jit_memory, encoding, reg, src, 0);
+    }
+}
+
+// op rd where rd may live in a stack slot, for the single operand /digit forms
+static void emit_op_dst(uint8_t** jit_memory, RegAllocation* ra, _x86_encoding* encoding, uint32_t rd, uint64_t imm) {
+    int dst = regalloc_u2a_x86(ra, rd);
+    if (dst == _x86_SPILL) {
+        emit_x86instruction_mem(jit_memory, encoding, 0, _x86_RSP, regalloc_spill_disp(ra, rd), imm);
+    } else {
+        emit_x86instruction(jit_memory, encoding, 0, dst, imm);
+    }
+}
+
+// mov reg, rs unless it's already there
+static void emit_load(uint8_t** jit_memory, RegAllocation* ra, _x86_register reg, uint32_t rs) {
+    int src = regalloc_u2a_x86(ra, rs);
+    if (src == _x86_SPILL) {
+        emit_spill_load(jit_memory, ra, reg, rs);
+    } else if (src != (int)reg) {
+        emit_x86instruction(jit_memory, &__mov_rm64_r64, src, reg, 0);
     }
 }
 
-void emit_ld(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint64_t imm) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)imm;
+static void emit_zero(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd) {
+    int dst = regalloc_u2a_x86(ra, rd);
+    if (dst == _x86_SPILL) {
+        emit_x86instruction_mem(jit_memory, &__mov_rm64_imm32, 0, _x86_RSP, regalloc_spill_disp(ra, rd), 0);
+    } else {
+        // 32bit xor zero extends and is the shortest way to clear a register
+        emit_x86instruction(jit_memory, &__xor_rm32_r32, dst, dst, 0);
+    }
+}
+
+static void emit_alu(uint8_t** jit_memory, RegAllocation* ra, AluOp* op, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    int dst = regalloc_u2a_x86(ra, rd);
+
+    if (op->commutative && !same_home(ra, rd, rs1) && same_home(ra, rd, rs2)) {
+        uint32_t tmp = rs1;
+        rs1 = rs2;
+        rs2 = tmp;
+    }
+
+    if (same_home(ra, rd, rs1)) {
+        int src = regalloc_u2a_x86(ra, rs2);
+        if (dst != _x86_SPILL) {
+            emit_op_src(jit_memory, ra, op->r_rm, dst, rs2);
+            return;
+        }
+        if (op->rm_r && src != _x86_SPILL) {
+            // read modify write straight into the stack slot
+            emit_x86instruction_mem(jit_memory, op->rm_r, src, _x86_RSP, regalloc_spill_disp(ra, rd), 0);
+            return;
+        }
+    } else if (same_home(ra, rd, rs2)) {
+        // only sub gets here, rd = rs1 - rd is -rd + rs1
+        if (dst != _x86_SPILL) {
+            emit_x86instruction(jit_memory, &__neg_rm64, 0, dst, 0);
+            emit_op_src(jit_memory, ra, &__add_r64_rm64, dst, rs1);
+            return;
+        }
+    } else if (dst != _x86_SPILL) {
+        emit_load(jit_memory, ra, dst, rs1);
+        emit_op_src(jit_memory, ra, op->r_rm, dst, rs2);
+        return;
+    }
+
+    // spilled destination, compute in the scratch register and store once
+    emit_load(jit_memory, ra, JIT_SCRATCH, rs1);
+    emit_op_src(jit_memory, ra, op->r_rm, JIT_SCRATCH, rs2);
+    emit_spill_store(jit_memory, ra, rd, JIT_SCRATCH);
 }
 
-void emit_st(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint64_t imm) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)imm;
+// rd = op rs1 for the single operand forms (not, shifts)
+static void emit_unary(uint8_t** jit_memory, RegAllocation* ra, _x86_encoding* encoding, uint32_t rd, uint32_t rs1,
+                       uint64_t imm) {
+    int dst = regalloc_u2a_x86(ra, rd);
+
+    if (dst != _x86_SPILL) {
+        emit_load(jit_memory, ra, dst, rs1);
+        emit_x86instruction(jit_memory, encoding, 0, dst, imm);
+    } else if (same_home(ra, rd, rs1)) {
+        emit_op_dst(jit_memory, ra, encoding, rd, imm);
+    } else {
+        emit_load(jit_memory, ra, JIT_SCRATCH, rs1);
+        emit_x86instruction(jit_memory, encoding, 0, JIT_SCRATCH, imm);
+        emit_spill_store(jit_memory, ra, rd, JIT_SCRATCH);
+    }
 }
 
-void emit_add(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint32_t rs2) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)rs2;
+void emit_add(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    int dst = regalloc_u2a_x86(ra, rd);
+    int a = regalloc_u2a_x86(ra, rs1);
+    int b = regalloc_u2a_x86(ra, rs2);
+
+    if (dst != _x86_SPILL && a != _x86_SPILL && b != _x86_SPILL && !same_home(ra, rd, rs1) && !same_home(ra, rd, rs2)) {
+        // lea doesn't touch its sources so no copy is needed
+        if ((a & 7) == _x86_RBP) {
+            // rbp/r13 as a base needs a displacement, as an index it doesn't
+            int tmp = a;
+            a = b;
+            b = tmp;
+        }
+        emit_x86instruction_sib(jit_memory, &__lea_r64_m, dst, a, b, 0, 0);
+        return;
+    }
+    emit_alu(jit_memory, ra, &alu_add, rd, rs1, rs2);
 }
 
-void emit_sub(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint32_t rs2) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)rs2;
+void emit_sub(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    if (same_home(ra, rs1, rs2)) {
+        emit_zero(jit_memory, ra, rd);
+        return;
+    }
+    emit_alu(jit_memory, ra, &alu_sub, rd, rs1, rs2);
 }
 
-void emit_mul(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint32_t rs2) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)rs2;
+void emit_mul(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    emit_alu(jit_memory, ra, &alu_mul, rd, rs1, rs2);
 }
 
-void emit_div(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint32_t rs2) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)rs2;
+void emit_div(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    // idiv wants the dividend in rdx:rax and leaves the quotient in rax,
+    // both get saved around it if the allocator handed them out
+    int dst = regalloc_u2a_x86(ra, rd);
+    int save_rax = (ra->x86_used & (1 << _x86_RAX)) && dst != _x86_RAX;
+    int save_rdx = (ra->x86_used & (1 << _x86_RDX)) && dst != _x86_RDX;
+    int32_t bias = 8 * (save_rax + save_rdx);  // pushes move spill slots away from rsp
+
+    emit_load(jit_memory, ra, JIT_SCRATCH, rs2);
+    if (save_rax)
+        emit_x86instruction(jit_memory, &__push_r64, _x86_RAX, 0, 0);
+    if (save_rdx)
+        emit_x86instruction(jit_memory, &__push_r64, _x86_RDX, 0, 0);
+
+    if (regalloc_u2a_x86(ra, rs1) == _x86_SPILL) {
+        int32_t disp = regalloc_spill_disp(ra, rs1) + bias;
+        emit_x86instruction_mem(jit_memory, &__mov_r64_rm64, _x86_RAX, _x86_RSP, disp, 0);
+    } else {
+        emit_load(jit_memory, ra, _x86_RAX, rs1);
+    }
+    emit_x86instruction(jit_memory, &__cqo, 0, 0, 0);
+    emit_x86instruction(jit_memory, &__idiv_rm64, 0, JIT_SCRATCH, 0);
+
+    if (dst == _x86_SPILL) {
+        emit_x86instruction_mem(jit_memory, &__mov_rm64_r64, _x86_RAX, _x86_RSP, regalloc_spill_disp(ra, rd) + bias, 0);
+    } else if (dst != _x86_RAX) {
+        emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RAX, dst, 0);
+    }
+
+    if (save_rdx)
+        emit_x86instruction(jit_memory, &__pop_r64, _x86_RDX, 0, 0);
+    if (save_rax)
+        emit_x86instruction(jit_memory, &__pop_r64, _x86_RAX, 0, 0);
 }
 
-void emit_and(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint32_t rs2) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)rs2;
+void emit_and(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    if (same_home(ra, rs1, rs2)) {
+        emit_mov(jit_memory, ra, rd, rs1);
+        return;
+    }
+    emit_alu(jit_memory, ra, &alu_and, rd, rs1, rs2);
 }
 
-void emit_or(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint32_t rs2) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)rs2;
+void emit_or(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    if (same_home(ra, rs1, rs2)) {
+        emit_mov(jit_memory, ra, rd, rs1);
+        return;
+    }
+    emit_alu(jit_memory, ra, &alu_or, rd, rs1, rs2);
 }
 
-void emit_xor(uint8_t** jit_memory, uint32_t rd, uint32_t rs1, uint32_t rs2) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
-    (void)rs2;
+void emit_xor(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    if (same_home(ra, rs1, rs2)) {
+        emit_zero(jit_memory, ra, rd);
+        return;
+    }
+    emit_alu(jit_memory, ra, &alu_xor, rd, rs1, rs2);
 }
 
-void emit_not(uint8_t** jit_memory, uint32_t rd, uint32_t rs1) {
-    // TODO
-    (void)jit_memory;
-    (void)rd;
-    (void)rs1;
+void emit_not(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1) {
+    emit_unary(jit_memory, ra, &__not_rm64, rd, rs1, 0);
 }
 
-void init_jit(uint8_t** jit_memory) {
-    init_reg_spill_stack(jit_memory);
+void emit_shl(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint64_t imm) {
+    if ((imm & 63) == 0) {
+        emit_mov(jit_memory, ra, rd, rs1);
+        return;
+    }
+    emit_unary(jit_memory, ra, &__shl_rm64_imm8, rd, rs1, imm & 63);
 }
 
-void free_jit(uint8_t** jit_memory) {
-    free_reg_spill_stack(jit_memory);
+void emit_shr(uint8_t** jit_memory, RegAllocation* ra, uint32_t rd, uint32_t rs1, uint64_t imm) {
+    if ((imm & 63) == 0) {
+        emit_mov(jit_memory, ra, rd, rs1);
+        return;
+    }
+    emit_unary(jit_memory, ra, &__shr_rm64_imm8, rd, rs1, imm & 63);
 }
 
-void emit_jit(uint8_t** jit_memory, uint32_t opcode, uint32_t rd, uint32_t rs1, uint32_t rs2, uint64_t imm) {
+// the flags cmp leaves behind are read by the next conditional jump, nothing
+// that can run in between (mov, li, ld, st, nops) touches them
+void emit_cmp(uint8_t** jit_memory, RegAllocation* ra, uint32_t rs1, uint32_t rs2) {
+    int a = regalloc_u2a_x86(ra, rs1);
+    int b = regalloc_u2a_x86(ra, rs2);
+
+    if (a != _x86_SPILL) {
+        emit_op_src(jit_memory, ra, &__cmp_r64_rm64, a, rs2);
+    } else if (b != _x86_SPILL) {
+        emit_x86instruction_mem(jit_memory, &__cmp_rm64_r64, b, _x86_RSP, regalloc_spill_disp(ra, rs1), 0);
+    } else {
+        emit_spill_load(jit_memory, ra, JIT_SCRATCH, rs1);
+        emit_op_src(jit_memory, ra, &__cmp_r64_rm64, JIT_SCRATCH, rs2);
+    }
+}
+
+/**
+    Vector registers
+
+    Vectors never get an x86 register. Every one
+    the program touches has a 32 byte slot at the
+    bottom of the frame (see regalloc.c), a vector
+    instruction loads its operands from there into
+    xmm0-3 (ymm0 with avx2) and stores the result
+    straight back. Nothing is left in a vector
+    register between instructions, so calling into
+    C (the lazy trampoline) has nothing to save.
+
+    sse2 does a vector as two halves. It has no
+    32 bit lane multiply either, vmul multiplies
+    the even and odd lanes separately with pmuludq
+    and puts the low halves back together. Nothing
+    here touches the flags.
+*/
+
+static _x86_encoding* sse_vector_ops[] = {
+    [U2_VADD - U2_VADD] = &__paddd_x_xm,    [U2_VSUB - U2_VADD] = &__psubd_x_xm,
+    [U2_VAND - U2_VADD] = &__pand_x_xm,     [U2_VOR - U2_VADD] = &__por_x_xm,
+    [U2_VXOR - U2_VADD] = &__pxor_x_xm,     [U2_VCMPEQ - U2_VADD] = &__pcmpeqd_x_xm,
+    [U2_VCMPGT - U2_VADD] = &__pcmpgtd_x_xm,
+};
+
+static _x86_encoding* avx2_vector_ops[] = {
+    [U2_VADD - U2_VADD] = &__vpaddd_y_y_ym,    [U2_VSUB - U2_VADD] = &__vpsubd_y_y_ym,
+    [U2_VMUL - U2_VADD] = &__vpmulld_y_y_ym,   [U2_VAND - U2_VADD] = &__vpand_y_y_ym,
+    [U2_VOR - U2_VADD] = &__vpor_y_y_ym,       [U2_VXOR - U2_VADD] = &__vpxor_y_y_ym,
+    [U2_VCMPEQ - U2_VADD] = &__vpcmpeqd_y_y_ym, [U2_VCMPGT - U2_VADD] = &__vpcmpgtd_y_y_ym,
+};
+
+// 32 bytes from [src + src_index + src_disp] to [dst + dst_index + dst_disp]
+static void emit_vector_copy(uint8_t** jit_memory, int avx2, uint32_t dst, int dst_index, int32_t dst_disp,
+                             uint32_t src, int src_index, int32_t src_disp) {
+    _x86_encoding* load = avx2 ? &__vmovdqu_y_ym : &__movdqu_x_xm;
+    _x86_encoding* store = avx2 ? &__vmovdqu_ym_y : &__movdqu_xm_x;
+    for (int32_t h = 0; h < 32; h += avx2 ? 32 : 16) {
+        emit_x86instruction_sib(jit_memory, load, 0, src, src_index, src_disp + h, 0);
+        emit_x86instruction_sib(jit_memory, store, 0, dst, dst_index, dst_disp + h, 0);
+    }
+}
+
+// the address of a vector load or store, the second sse half is at disp + 16
+// so that has to fit too
+static int32_t emit_vector_address(uint8_t** jit_memory, RegAllocation* ra, uint32_t rs, uint64_t imm) {
+    emit_mem_index(jit_memory, ra, rs);
+    if ((int32_t)imm <= INT32_MAX - 16)
+        return (int32_t)imm;
+    emit_x86instruction_mem(jit_memory, &__lea_r64_m, JIT_SCRATCH, JIT_SCRATCH, (int32_t)imm, 0);
+    return 0;
+}
+
+void emit_vld(uint8_t** jit_memory, RegAllocation* ra, int avx2, uint32_t rd, uint32_t rs1, uint64_t imm) {
+    int32_t disp = emit_vector_address(jit_memory, ra, rs1, imm);
+    emit_vector_copy(jit_memory, avx2, _x86_RSP, -1, regalloc_vector_disp(ra, rd), JIT_MEMBASE, JIT_SCRATCH, disp);
+}
+
+// vst rs1 rs2 imm stores vector rs1 at rs2 + imm
+void emit_vst(uint8_t** jit_memory, RegAllocation* ra, int avx2, uint32_t rs1, uint32_t rs2, uint64_t imm) {
+    int32_t disp = emit_vector_address(jit_memory, ra, rs2, imm);
+    emit_vector_copy(jit_memory, avx2, JIT_MEMBASE, JIT_SCRATCH, disp, _x86_RSP, -1, regalloc_vector_disp(ra, rs1));
+}
+
+// xmm0 = low 32 bits of each lane of xmm0 * xmm1, clobbers xmm2 and xmm3. the
+// odd lanes are shuffled down to even ones, both pairs multiplied to 64 bits
+// and the low halves shuffled to the bottom and interleaved back together
+static void emit_sse_mul(uint8_t** jit_memory) {
+    emit_x86instruction(jit_memory, &__pshufd_x_xm_imm8, 2, 0, 0xF5);
+    emit_x86instruction(jit_memory, &__pshufd_x_xm_imm8, 3, 1, 0xF5);
+    emit_x86instruction(jit_memory, &__pmuludq_x_xm, 0, 1, 0);
+    emit_x86instruction(jit_memory, &__pmuludq_x_xm, 2, 3, 0);
+    emit_x86instruction(jit_memory, &__pshufd_x_xm_imm8, 0, 0, 0x08);
+    emit_x86instruction(jit_memory, &__pshufd_x_xm_imm8, 2, 2, 0x08);
+    emit_x86instruction(jit_memory, &__punpckldq_x_xm, 0, 2, 0);
+}
+
+void emit_vector_op(uint8_t** jit_memory, RegAllocation* ra, int avx2, uint32_t opcode, uint32_t rd, uint32_t rs1,
+                    uint32_t rs2) {
+    int32_t d = regalloc_vector_disp(ra, rd);
+    int32_t a = regalloc_vector_disp(ra, rs1);
+    int32_t b = regalloc_vector_disp(ra, rs2);
+
+    if (avx2) {
+        emit_x86instruction_mem(jit_memory, &__vmovdqu_y_ym, 0, _x86_RSP, a, 0);
+        emit_x86instruction_vex(jit_memory, avx2_vector_ops[opcode - U2_VADD], 0, 0, _x86_RSP, -1, b);
+        emit_x86instruction_mem(jit_memory, &__vmovdqu_ym_y, 0, _x86_RSP, d, 0);
+        return;
+    }
+
+    for (int32_t h = 0; h < 32; h += 16) {
+        emit_x86instruction_mem(jit_memory, &__movdqu_x_xm, 0, _x86_RSP, a + h, 0);
+        emit_x86instruction_mem(jit_memory, &__movdqu_x_xm, 1, _x86_RSP, b + h, 0);
+        if (opcode == U2_VMUL)
+            emit_sse_mul(jit_memory);
+        else
+            emit_x86instruction(jit_memory, sse_vector_ops[opcode - U2_VADD], 0, 1, 0);
+        emit_x86instruction_mem(jit_memory, &__movdqu_xm_x, 0, _x86_RSP, d + h, 0);
+    }
+}
+
+// going back to C with the upper halves of the ymm registers dirty makes any
+// sse it runs pay for it
+static void emit_vector_leave(uint8_t** jit_memory, RegAllocation* ra, JitOptions* options) {
+    if (options->avx2 && ra->vector_used)
+        emit_x86instruction(jit_memory, &__vzeroupper, 0, 0, 0);
+}
+
+void init_jit(uint8_t** jit_memory, RegAllocation* ra) {
+    init_reg_spill_stack(jit_memory, ra);
+}
+
+void free_jit(uint8_t** jit_memory, RegAllocation* ra) {
+    free_reg_spill_stack(jit_memory, ra);
+}
+
+void emit_jit(uint8_t** jit_memory, RegAllocation* ra, uint32_t opcode, uint32_t rd, uint32_t rs1, uint32_t rs2,
+              uint64_t imm, JitOptions* options) {
     Opcode op = (Opcode)opcode;
     switch (op) {
     // TODO: modularly enum opcodes based on common instruction.h
     case U2_MOV:
-        emit_mov(jit_memory, rd, rs1);
+        emit_mov(jit_memory, ra, rd, rs1);
         break;
     case U2_LI:
-        emit_li(jit_memory, rd, imm);
+        emit_li(jit_memory, ra, rd, imm);
         break;
     case U2_LD:
-        emit_ld(jit_memory, rd, rs1, imm);
+        emit_ld(jit_memory, ra, rd, rs1, imm);
         break;
     case U2_ST:
-        emit_st(jit_memory, rd, rs1, imm);
+        emit_st(jit_memory, ra, rs1, rs2, imm);
         break;
     case U2_ADD:
-        emit_add(jit_memory, rd, rs1, rs2);
+        emit_add(jit_memory, ra, rd, rs1, rs2);
         break;
     case U2_SUB:
-        emit_sub(jit_memory, rd, rs1, rs2);
+        emit_sub(jit_memory, ra, rd, rs1, rs2);
         break;
     case U2_MUL:
-        emit_mul(jit_memory, rd, rs1, rs2);
+        emit_mul(jit_memory, ra, rd, rs1, rs2);
         break;
     case U2_DIV:
-        emit_div(jit_memory, rd, rs1, rs2);
+        emit_div(jit_memory, ra, rd, rs1, rs2);
         break;
     case U2_AND:
-        emit_and(jit_memory, rd, rs1, rs2);
+        emit_and(jit_memory, ra, rd, rs1, rs2);
         break;
     case U2_OR:
-        emit_or(jit_memory, rd, rs1, rs2);
+        emit_or(jit_memory, ra, rd, rs1, rs2);
         break;
     case U2_XOR:
-        emit_xor(jit_memory, rd, rs1, rs2);
+        emit_xor(jit_memory, ra, rd, rs1, rs2);
         break;
     case U2_NOT:
-        emit_not(jit_memory, rd, rs1);
+        emit_not(jit_memory, ra, rd, rs1);
+        break;
+    case U2_CMP:
+        emit_cmp(jit_memory, ra, rs1, rs2);
+        break;
+    case U2_SHL:
+        emit_shl(jit_memory, ra, rd, rs1, imm);
+        break;
+    case U2_SHR:
+        emit_shr(jit_memory, ra, rd, rs1, imm);
+        break;
+    case U2_VLD:
+        emit_vld(jit_memory, ra, options->avx2, rd, rs1, imm);
+        break;
+    case U2_VST:
+        emit_vst(jit_memory, ra, options->avx2, rs1, rs2, imm);
+        break;
+    case U2_VADD:
+    case U2_VSUB:
+    case U2_VMUL:
+    case U2_VAND:
+    case U2_VOR:
+    case U2_VXOR:
+    case U2_VCMPEQ:
+    case U2_VCMPGT:
+        emit_vector_op(jit_memory, ra, options->avx2, op, rd, rs1, rs2);
         break;
     default:
         printf("Instruction %u (%s) not implemented yet!\n", op, instruction_from_id(op));
         exit(EXIT_FAILURE);
     }
 }
+
+/**
+    Region compilation
+
+    Blocks are laid out in program order so the
+    fallthrough of a block is almost always the
+    next one. Jumps are emitted as rel32 with a
+    zero displacement and patched (and shrunk where
+    they can be) once every block has an address.
+    Anything outside the region
+    (including the end of the program) gets an exit
+    stub, which is always index cfg->count for the
+    end and the target block index otherwise.
+
+    A whole program region is entered with the
+    memory base and returns r1. A unit is entered
+    with a VMState*, loads the registers live into
+    its entry block, and stores whatever is live
+    into the block it exits to before returning
+    that block's index (cfg->count for the end).
+*/
+
+typedef struct {
+    CFG* cfg;
+    uint8_t* in_region;  // per block, NULL for every block
+    size_t entry;        // block execution starts at
+    int unit;            // VMState calling convention
+    int32_t state_disp;  // frame slot holding the VMState* (units only)
+} JitRegion;
+
+struct BranchFixup {
+    uint8_t* patch;   // rel32 to fill in, relative to patch + 4
+    size_t target;    // block index, cfg->count for the exit
+    uint32_t opcode;  // u2 jump it came from, picks the rel8 form
+};
+
+typedef struct {
+    uint8_t* at;       // where the nops start
+    size_t alignment;  // what they pad up to
+    size_t size;       // bytes of nops
+} AlignPad;
+
+// everything in a stretch of code that depends on where things end up
+typedef struct {
+    BranchFixup* fixups;
+    size_t count;
+    size_t capacity;
+    AlignPad* pads;
+    size_t pad_count;
+    size_t pad_capacity;
+    PcMark* marks;  // where each instruction starts, only kept when profiling
+    size_t mark_count;
+    size_t mark_capacity;
+    int marking;
+} FixupList;
+
+static void add_fixup(FixupList* list, uint8_t* patch, size_t target, uint32_t opcode) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->fixups = realloc(list->fixups, sizeof(BranchFixup) * list->capacity);
+    }
+    list->fixups[list->count++] = (BranchFixup){patch, target, opcode};
+}
+
+static void add_pad(FixupList* list, uint8_t* at, size_t alignment, size_t size) {
+    if (list->pad_count == list->pad_capacity) {
+        list->pad_capacity = list->pad_capacity ? list->pad_capacity * 2 : 16;
+        list->pads = realloc(list->pads, sizeof(AlignPad) * list->pad_capacity);
+    }
+    list->pads[list->pad_count++] = (AlignPad){at, alignment, size};
+}
+
+static void add_mark(FixupList* list, uint8_t* code, uint64_t pc) {
+    if (list->mark_count == list->mark_capacity) {
+        list->mark_capacity = list->mark_capacity ? list->mark_capacity * 2 : 64;
+        list->marks = realloc(list->marks, sizeof(PcMark) * list->mark_capacity);
+    }
+    list->marks[list->mark_count++] = (PcMark){.code = code, .pc = pc};
+}
+
+static void free_fixups(FixupList* list) {
+    free(list->fixups);
+    free(list->pads);
+    free(list->marks);
+}
+
+// hand the marks over once the code they point into won't move anymore
+static void publish_marks(JitProfile* profile, FixupList* list) {
+    for (size_t i = 0; i < list->mark_count; i++)
+        profile_mark(profile, list->marks[i].code, list->marks[i].pc);
+}
+
+// conditions u2 has no jump for, they only come from inverting one it does
+#define JIT_JGE 0x100
+#define JIT_JLE 0x101
+
+static uint32_t invert_jump(uint32_t opcode) {
+    switch (opcode) {
+    case U2_JE:
+        return U2_JNE;
+    case U2_JNE:
+        return U2_JE;
+    case U2_JL:
+        return JIT_JGE;
+    case U2_JG:
+        return JIT_JLE;
+    case JIT_JGE:
+        return U2_JL;
+    default:
+        return U2_JG;
+    }
+}
+
+static _x86_encoding* jump_encoding(uint32_t opcode) {
+    switch (opcode) {
+    case U2_JE:
+        return &__je_rel32;
+    case U2_JNE:
+        return &__jne_rel32;
+    case U2_JL:
+        return &__jl_rel32;
+    case U2_JG:
+        return &__jg_rel32;
+    case JIT_JGE:
+        return &__jge_rel32;
+    case JIT_JLE:
+        return &__jle_rel32;
+    default:
+        return &__jmp_rel32;
+    }
+}
+
+static _x86_encoding* short_jump_encoding(uint32_t opcode) {
+    switch (opcode) {
+    case U2_JE:
+        return &__je_rel8;
+    case U2_JNE:
+        return &__jne_rel8;
+    case U2_JL:
+        return &__jl_rel8;
+    case U2_JG:
+        return &__jg_rel8;
+    case JIT_JGE:
+        return &__jge_rel8;
+    case JIT_JLE:
+        return &__jle_rel8;
+    default:
+        return &__jmp_rel8;
+    }
+}
+
+// bytes of the rel32 form, jcc has the 0x0F escape
+static size_t jump_size(uint32_t opcode) {
+    return opcode == U2_JMP ? 5 : 6;
+}
+
+static void emit_jump(uint8_t** jit_memory, FixupList* fixups, uint32_t opcode, size_t target) {
+    emit_x86instruction(jit_memory, jump_encoding(opcode), 0, 0, 0);
+    add_fixup(fixups, *jit_memory - 4, target, opcode);
+}
+
+// pad with nops up to the next multiple of alignment (a power of two). the
+// padding is recorded in pads (if given) so relax_branches can redo it
+static void emit_align(uint8_t** jit_memory, size_t alignment, FixupList* pads) {
+    if (alignment <= 1)
+        return;
+    size_t size = -(uintptr_t)*jit_memory & (alignment - 1);
+    if (pads)
+        add_pad(pads, *jit_memory, alignment, size);
+    emit_x86nop(jit_memory, size);
+}
+
+// a block some later block jumps back to
+static int is_loop_header(BasicBlock* bb) {
+    for (size_t i = 0; i < bb->incoming_count; i++) {
+        if (is_back_edge(bb->incoming[i], bb))
+            return 1;
+    }
+    return 0;
+}
+
+static size_t block_id(CFG* cfg, BasicBlock* bb) {
+    return bb ? bb->index : cfg->count;
+}
+
+// with a profile, a loop header only gets loop_align if the loop ran at least
+// this many times, padding in front of a loop that hardly runs is just bytes
+#define JIT_HOT_LOOP 64
+
+// what the block at bb should be aligned to. blocks a profile says never ran
+// aren't aligned at all
+static size_t block_alignment(CFG* cfg, BasicBlock* bb, JitOptions* options) {
+    if (cfg->profile == NULL)
+        return is_loop_header(bb) ? options->loop_align : options->block_align;
+    uint64_t count = cfg->profile[bb->index];
+    if (count == 0)
+        return 1;
+    return is_loop_header(bb) && count >= JIT_HOT_LOOP ? options->loop_align : options->block_align;
+}
+
+// the blocks with in_region set (all of them for NULL) in the order they are
+// laid out, followed by cfg->count for the exit. that's program order, except
+// that blocks a profile says never ran go after the rest, out of the way of
+// the code that does run. returns how many blocks there are
+static size_t layout_order(CFG* cfg, uint8_t* in_region, size_t* order) {
+    size_t count = 0;
+    for (int cold = 0; cold < 2; cold++) {
+        for (size_t i = 0; i < cfg->count; i++) {
+            int is_cold = cfg->profile && cfg->profile[i] == 0;
+            if ((in_region == NULL || in_region[i]) && is_cold == cold)
+                order[count++] = i;
+        }
+    }
+    order[count] = cfg->count;
+    return count;
+}
+
+// the profile says the branch ending bb falls through more often than not
+static int fallthrough_likelier(CFG* cfg, BasicBlock* bb) {
+    if (cfg->profile == NULL)
+        return 0;
+    uint64_t entries = cfg->profile[bb->index];
+    uint64_t not_taken = cfg->profile[cfg->count + bb->index];
+    return not_taken > entries - not_taken;
+}
+
+// add one to *counter. r11 holds the address since it may be anywhere, the
+// flags only need saving around the add if anything still reads them
+static void emit_count(uint8_t** jit_memory, uint64_t* counter, int flags_live) {
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, JIT_SCRATCH, 0, (uintptr_t)counter);
+    if (flags_live)
+        emit_x86instruction(jit_memory, &__pushf, 0, 0, 0);
+    emit_x86instruction_mem(jit_memory, &__add_rm64_imm8, 0, JIT_SCRATCH, 0, 1);
+    if (flags_live)
+        emit_x86instruction(jit_memory, &__popf, 0, 0, 0);
+}
+
+// compile one block, jumps out of it are left for the caller to patch. next
+// is whatever gets emitted right after the block
+static void jit_block(uint8_t** jit_memory, CFG* cfg, BasicBlock* bb, size_t next, FixupList* fixups,
+                      JitOptions* options) {
+    // a jump is always last and emitted below with whatever it turns into
+    for (size_t i = 0; i < bb->instructions_count; i++) {
+        ParsedInstruction* pi = bb->instructions[i];
+        if (fixups->marking)
+            add_mark(fixups, *jit_memory, pi->pc);
+        if (i == 0 && options->counters)
+            emit_count(jit_memory, &options->counters[bb->index], bb->flags_live_in);
+        if (!is_jump__(pi->opcode))
+            emit_jit(jit_memory, cfg->regalloc, pi->opcode, pi->rd, pi->rs1, pi->rs2, pi->imm, options);
+    }
+
+    uint32_t opcode = bb->instructions[bb->instructions_count - 1]->opcode;
+    size_t target = block_id(cfg, bb->target);
+    size_t fallthrough = block_id(cfg, bb->fallthrough);
+    if (opcode == U2_JMP) {
+        emit_jump(jit_memory, fixups, U2_JMP, target);
+        return;
+    }
+
+    // when counting the branch stays as written, the counter after it is only
+    // reached when it wasn't taken
+    if (is_jump_conditional__(opcode) && options->counters) {
+        emit_jump(jit_memory, fixups, opcode, target);
+        int flags_live = bb->fallthrough && bb->fallthrough->flags_live_in;
+        emit_count(jit_memory, &options->counters[cfg->count + bb->index], flags_live);
+    } else if (is_jump_conditional__(opcode)) {
+        // polarity: the first branch should go wherever control is more
+        // likely to go, unless the other side comes next and needs no jump
+        if (fallthrough == next || (target != next && !fallthrough_likelier(cfg, bb))) {
+            emit_jump(jit_memory, fixups, opcode, target);
+        } else {
+            emit_jump(jit_memory, fixups, invert_jump(opcode), fallthrough);
+            fallthrough = target;
+        }
+    }
+
+    // falling through into anything but the next block needs a real jump
+    if (fallthrough != next)
+        emit_jump(jit_memory, fixups, U2_JMP, fallthrough);
+}
+
+// copy u2 register r between its home and [JIT_SCRATCH + 8r] in a VMState
+static void emit_state_transfer(uint8_t** jit_memory, RegAllocation* ra, uint32_t r, int store) {
+    int32_t state_disp = offsetof(VMState, regs) + 8 * r;
+    int home = regalloc_u2a_x86(ra, r);
+
+    if (home != _x86_SPILL) {
+        _x86_encoding* encoding = store ? &__mov_rm64_r64 : &__mov_r64_rm64;
+        emit_x86instruction_mem(jit_memory, encoding, home, JIT_SCRATCH, state_disp, 0);
+    } else if (store) {
+        // memory to memory without a free register, push/pop can do that
+        emit_x86instruction_mem(jit_memory, &__push_rm64, 0, _x86_RSP, regalloc_spill_disp(ra, r), 0);
+        emit_x86instruction_mem(jit_memory, &__pop_rm64, 0, JIT_SCRATCH, state_disp, 0);
+    } else {
+        // pop computes an rsp based address after popping so this lands right
+        emit_x86instruction_mem(jit_memory, &__push_rm64, 0, JIT_SCRATCH, state_disp, 0);
+        emit_x86instruction_mem(jit_memory, &__pop_rm64, 0, _x86_RSP, regalloc_spill_disp(ra, r), 0);
+    }
+}
+
+static void emit_unit_entry(uint8_t** jit_memory, JitRegion* region, JitOptions* options) {
+    RegAllocation* ra = region->cfg->regalloc;
+    BasicBlock* entry = region->cfg->nodes[region->entry];
+    uint16_t live = entry->live_in & ra->used;
+
+    emit_x86instruction_mem(jit_memory, &__mov_rm64_r64, _x86_RDI, _x86_RSP, region->state_disp, 0);
+    emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RDI, JIT_SCRATCH, 0);
+    if (ra->uses_memory) {
+        int32_t mem_disp = offsetof(VMState, mem);
+        emit_x86instruction_mem(jit_memory, &__mov_r64_rm64, JIT_MEMBASE, JIT_SCRATCH, mem_disp, 0);
+    }
+    for (uint32_t r = 0; r < 16; r++) {
+        if (live & (1 << r))
+            emit_state_transfer(jit_memory, ra, r, 0);
+    }
+    // no liveness for vectors, all of them come along
+    for (uint32_t r = 0; r < 16; r++) {
+        if (ra->vector_used & (1 << r))
+            emit_vector_copy(jit_memory, options->avx2, _x86_RSP, -1, regalloc_vector_disp(ra, r), JIT_SCRATCH, -1,
+                             offsetof(VMState, vregs) + sizeof(((VMState*)0)->vregs[0]) * r);
+    }
+    if (entry->flags_live_in) {
+        emit_x86instruction_mem(jit_memory, &__push_rm64, 0, JIT_SCRATCH, offsetof(VMState, flags), 0);
+        emit_x86instruction(jit_memory, &__popf, 0, 0, 0);
+    }
+}
+
+static void emit_unit_exit(uint8_t** jit_memory, JitRegion* region, size_t target, JitOptions* options) {
+    CFG* cfg = region->cfg;
+    RegAllocation* ra = cfg->regalloc;
+    uint16_t live = target < cfg->count ? cfg->nodes[target]->live_in : cfg->exit_live;
+    live &= ra->used;
+
+    emit_x86instruction_mem(jit_memory, &__mov_r64_rm64, JIT_SCRATCH, _x86_RSP, region->state_disp, 0);
+    for (uint32_t r = 0; r < 16; r++) {
+        if (live & (1 << r))
+            emit_state_transfer(jit_memory, ra, r, 1);
+        if (ra->vector_used & (1 << r))
+            emit_vector_copy(jit_memory, options->avx2, JIT_SCRATCH, -1,
+                             offsetof(VMState, vregs) + sizeof(((VMState*)0)->vregs[0]) * r, _x86_RSP, -1,
+                             regalloc_vector_disp(ra, r));
+    }
+    if (target < cfg->count && cfg->nodes[target]->flags_live_in) {
+        emit_x86instruction(jit_memory, &__pushf, 0, 0, 0);
+        emit_x86instruction_mem(jit_memory, &__pop_rm64, 0, JIT_SCRATCH, offsetof(VMState, flags), 0);
+    }
+    emit_x86instruction(jit_memory, &__mov_r32_imm32, _x86_RAX, 0, target);
+    emit_vector_leave(jit_memory, ra, options);
+    free_jit(jit_memory, ra);
+    emit_x86ret(jit_memory);
+}
+
+// a whole program is entered with the memory base as the first argument
+static void emit_program_entry(uint8_t** jit_memory, CFG* cfg) {
+    RegAllocation* ra = cfg->regalloc;
+    if (ra->uses_memory)
+        emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RDI, JIT_MEMBASE, 0);
+
+    // registers are 0 until written, only the ones read before that need it.
+    // vectors have no liveness, every one starts out zeroed
+    uint16_t entry_live = cfg->count ? cfg->nodes[0]->live_in : 0;
+    for (uint32_t r = 0; r < 16; r++) {
+        if (entry_live & (1 << r))
+            emit_zero(jit_memory, ra, r);
+        for (int32_t q = 0; (ra->vector_used & (1 << r)) && q < 32; q += 8)
+            emit_x86instruction_mem(jit_memory, &__mov_rm64_imm32, 0, _x86_RSP, regalloc_vector_disp(ra, r) + q, 0);
+    }
+}
+
+static void patch_rel32(uint8_t* patch, uint8_t* to) {
+    int32_t rel = (int32_t)(to - (patch + 4));
+    for (int b = 0; b < 4; b++)
+        patch[b] = ((uint32_t)rel >> (b * 8)) & 0xFF;
+}
+
+/**
+    Branch relaxation
+
+    Every branch is first emitted in its rel32 form
+    since targets usually aren't known yet. Once
+    they are, any branch whose displacement fits in
+    a byte is shrunk to the 2 byte rel8 form, which
+    moves everything after it closer and can let
+    more branches fit, so this repeats until nothing
+    changes. Shrinking can also grow an alignment
+    pad and push a branch back out of range, those
+    go back to rel32 for good so it terminates.
+
+    Nothing only ever moves backwards (every pad
+    ends on the same boundary or an earlier one), so
+    the final code is rewritten in place front to
+    back without ever overwriting bytes that still
+    have to be read.
+*/
+
+typedef struct {
+    uint8_t* at;          // address as first emitted
+    size_t old_size;
+    size_t size;          // size in the current layout
+    uint8_t* new_at;      // address in the current layout
+    BranchFixup* branch;  // NULL for padding
+    AlignPad* pad;
+    int locked;           // had to grow back, stays rel32
+} RelaxItem;
+
+// by address. a pad that came out empty can share its address with the branch
+// right after it (a loop header that's only a jmp), the pad goes first
+static int relax_item_cmp(const void* a, const void* b) {
+    const RelaxItem* x = a;
+    const RelaxItem* y = b;
+    if (x->at != y->at)
+        return x->at < y->at ? -1 : 1;
+    return (y->pad != NULL) - (x->pad != NULL);
+}
+
+// where an address as first emitted ends up in the current layout. shift[k]
+// is how much the first k items shrank in total
+static uint8_t* relax_map(RelaxItem* items, size_t* shift, size_t count, uint8_t* old) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        // an empty pad shares its address with the code it aligns, which goes
+        // after it however much the pad grows. a pad with bytes in it starts
+        // where the code before it ends
+        if (items[mid].at < old || (items[mid].at == old && items[mid].pad && items[mid].old_size == 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return old - shift[lo];
+}
+
+static int fits_rel8(int64_t disp) {
+    return disp >= INT8_MIN && disp <= INT8_MAX;
+}
+
+// shrink and patch every branch in fixups. labels give the target of each and
+// are moved along with the code, and so are the marks in fixups. the code runs
+// from start to *jit_memory, which is moved back by however much it shrank
+static void relax_branches(uint8_t** jit_memory, uint8_t* start, FixupList* fixups, uint8_t** label,
+                           size_t label_count) {
+    size_t count = fixups->count + fixups->pad_count;
+    RelaxItem* items = calloc(count, sizeof(RelaxItem));
+    size_t* shift = malloc(sizeof(size_t) * (count + 1));
+
+    for (size_t i = 0; i < fixups->count; i++) {
+        BranchFixup* branch = &fixups->fixups[i];
+        size_t size = jump_size(branch->opcode);
+        items[i] = (RelaxItem){.at = branch->patch + 4 - size, .old_size = size, .size = size, .branch = branch};
+    }
+    for (size_t i = 0; i < fixups->pad_count; i++) {
+        AlignPad* pad = &fixups->pads[i];
+        items[fixups->count + i] = (RelaxItem){.at = pad->at, .old_size = pad->size, .size = pad->size, .pad = pad};
+    }
+    qsort(items, count, sizeof(RelaxItem), relax_item_cmp);
+
+    for (int changed = 1; changed;) {
+        changed = 0;
+
+        // lay everything out with the current sizes
+        shift[0] = 0;
+        for (size_t i = 0; i < count; i++) {
+            RelaxItem* item = &items[i];
+            item->new_at = item->at - shift[i];
+            if (item->pad)
+                item->size = -(uintptr_t)item->new_at & (item->pad->alignment - 1);
+            shift[i + 1] = shift[i] + item->old_size - item->size;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            RelaxItem* item = &items[i];
+            if (item->branch == NULL)
+                continue;
+            uint8_t* target = relax_map(items, shift, count, label[item->branch->target]);
+            int fits = fits_rel8(target - (item->new_at + 2));
+            if (item->size == 2 && !fits) {
+                item->size = item->old_size;
+                item->locked = 1;
+                changed = 1;
+            } else if (item->size != 2 && !item->locked && fits) {
+                item->size = 2;
+                changed = 1;
+            }
+        }
+    }
+
+    // rewrite front to back, see above for why this is safe in place
+    uint8_t* end = *jit_memory;
+    uint8_t* read = start;
+    *jit_memory = start;
+    for (size_t i = 0; i < count; i++) {
+        RelaxItem* item = &items[i];
+        memmove(*jit_memory, read, item->at - read);
+        *jit_memory += item->at - read;
+        read = item->at + item->old_size;
+
+        if (item->pad) {
+            emit_x86nop(jit_memory, item->size);
+        } else if (item->size == 2) {
+            uint8_t* target = relax_map(items, shift, count, label[item->branch->target]);
+            emit_x86instruction(jit_memory, short_jump_encoding(item->branch->opcode), 0, 0, 0);
+            (*jit_memory)[-1] = (uint8_t)(target - *jit_memory);
+        } else {
+            uint8_t* target = relax_map(items, shift, count, label[item->branch->target]);
+            emit_x86instruction(jit_memory, jump_encoding(item->branch->opcode), 0, 0, 0);
+            patch_rel32(*jit_memory - 4, target);
+        }
+    }
+    memmove(*jit_memory, read, end - read);
+    *jit_memory += end - read;
+
+    for (size_t i = 0; i < label_count; i++) {
+        if (label[i])
+            label[i] = relax_map(items, shift, count, label[i]);
+    }
+    for (size_t i = 0; i < fixups->mark_count; i++)
+        fixups->marks[i].code = relax_map(items, shift, count, fixups->marks[i].code);
+
+    free(shift);
+    free(items);
+}
+
+// one symbol per block in layout order, each running up to the next one, plus
+// whatever comes before the first and after the last
+static void add_symbols(JitSymbols* symbols, CFG* cfg, int unit, size_t* order, size_t count, uint8_t** label,
+                        uint8_t* start, uint8_t* end) {
+    uint8_t* first = label[order[0]];
+    symbols_add(symbols, start, first - start, unit ? "u2_unit_entry" : "u2_entry");
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* code = label[order[i]];
+        symbols_add_block(symbols, code, label[order[i + 1]] - code, cfg->nodes[order[i]]->instructions[0]->pc);
+    }
+    symbols_add(symbols, label[cfg->count], end - label[cfg->count], unit ? "u2_unit_exit" : "u2_exit");
+    symbols_commit(symbols);
+}
+
+static uint8_t* jit_region(uint8_t** jit_memory, JitRegion* region, JitOptions* options) {
+    CFG* cfg = region->cfg;
+    uint8_t* start = *jit_memory;
+    uint8_t** label = calloc(cfg->count + 1, sizeof(uint8_t*));
+    FixupList fixups = {.marking = options->profile != NULL};
+
+    init_jit(jit_memory, cfg->regalloc);
+    if (region->unit) {
+        emit_unit_entry(jit_memory, region, options);
+    } else {
+        emit_program_entry(jit_memory, cfg);
+    }
+
+    size_t* order = malloc(sizeof(size_t) * (cfg->count + 1));
+    size_t order_count = layout_order(cfg, region->in_region, order);
+
+    if (order_count && order[0] != region->entry)
+        emit_jump(jit_memory, &fixups, U2_JMP, region->entry);
+
+    for (size_t i = 0; i < order_count; i++) {
+        BasicBlock* bb = cfg->nodes[order[i]];
+        emit_align(jit_memory, block_alignment(cfg, bb, options), &fixups);
+        label[order[i]] = *jit_memory;
+        jit_block(jit_memory, cfg, bb, order[i + 1], &fixups, options);
+    }
+
+    // the end of the program always comes right after the last block
+    label[cfg->count] = *jit_memory;
+    if (fixups.marking)
+        add_mark(&fixups, *jit_memory, PROFILE_NO_PC);
+    if (region->unit) {
+        emit_unit_exit(jit_memory, region, cfg->count, options);
+    } else {
+        emit_vector_leave(jit_memory, cfg->regalloc, options);
+        emit_x86ret_reg(jit_memory, cfg->regalloc, RETURN_REG);
+    }
+
+    for (size_t i = 0; i < fixups.count; i++) {
+        BranchFixup* fixup = &fixups.fixups[i];
+        if (label[fixup->target] == NULL) {
+            // leaving the region, hand the block back to the interpreter
+            label[fixup->target] = *jit_memory;
+            emit_unit_exit(jit_memory, region, fixup->target, options);
+        }
+    }
+    relax_branches(jit_memory, start, &fixups, label, cfg->count + 1);
+    if (options->symbols)
+        add_symbols(options->symbols, cfg, region->unit, order, order_count, label, start, *jit_memory);
+    if (options->profile)
+        publish_marks(options->profile, &fixups);
+
+    free(order);
+    free_fixups(&fixups);
+    free(label);
+    return start;
+}
+
+/**
+    Parallel compilation
+
+    The same layout as compiling the whole program
+    as one region, but the blocks are split into
+    chunks of blocks consecutive in layout order
+    that worker threads compile into private arenas.
+    Nothing a block emits depends on where it ends
+    up except its branches, and those are fixups
+    against block indices anyway. Once every chunk
+    is done they are copied into the real arena in
+    order and the fixups patched.
+
+    The calling thread is one of the workers, so
+    the chunks get compiled even if no other thread
+    could be started. A worker that can't get an
+    arena takes no chunks, only when nobody could is
+    the program compiled sequentially instead.
+
+    Alignment padding is recorded along with the
+    branches and redone by relax_branches once the
+    chunks are in place, the only difference from
+    the sequential layout is the padding between
+    chunks.
+*/
+
+// smallest chunk worth handing to a thread, in instructions
+#define JIT_CHUNK_MIN 1024
+
+typedef struct {
+    size_t first;        // blocks order[first] up to order[last]
+    size_t last;
+    uint8_t* code;       // in the private arena of whichever worker compiled it
+    size_t size;
+    FixupList fixups;    // patch pointers into code
+} JitChunk;
+
+typedef struct {
+    CFG* cfg;
+    JitOptions* options;
+    size_t align;          // every chunk starts on this boundary
+    size_t* order;         // layout_order of every block
+    size_t order_count;
+    JitChunk* chunks;
+    size_t chunk_count;
+    size_t next_chunk;     // taken atomically by the workers
+    size_t* block_offset;  // offset of each block into its chunk
+} JitParallel;
+
+// NULL if it couldn't reserve an arena, in which case it took no chunks
+static void* jit_worker(void* arg) {
+    JitParallel* parallel = arg;
+    CFG* cfg = parallel->cfg;
+    CodeArena* arena = arena_create(ARENA_DEFAULT_RESERVE, 0);
+    if (arena == NULL)
+        return NULL;
+    uint8_t** jit_memory = &arena->advance;
+
+    for (;;) {
+        size_t c = __atomic_fetch_add(&parallel->next_chunk, 1, __ATOMIC_RELAXED);
+        if (c >= parallel->chunk_count)
+            break;
+
+        JitChunk* chunk = &parallel->chunks[c];
+        JitOptions* options = parallel->options;
+        emit_align(jit_memory, parallel->align, NULL);
+        chunk->code = *jit_memory;
+        for (size_t i = chunk->first; i < chunk->last; i++) {
+            BasicBlock* bb = cfg->nodes[parallel->order[i]];
+            emit_align(jit_memory, block_alignment(cfg, bb, options), &chunk->fixups);
+            parallel->block_offset[bb->index] = *jit_memory - chunk->code;
+            jit_block(jit_memory, cfg, bb, parallel->order[i + 1], &chunk->fixups, options);
+        }
+        chunk->size = *jit_memory - chunk->code;
+    }
+
+    // the code is still needed until it's copied out, the caller frees it
+    return arena;
+}
+
+// -1 without touching jit_memory if not a single arena could be reserved
+static int jit_program_parallel(uint8_t** jit_memory, CFG* cfg, JitOptions* options) {
+    JitParallel parallel = {.cfg = cfg, .options = options};
+    parallel.align = options->block_align > options->loop_align ? options->block_align : options->loop_align;
+    parallel.block_offset = malloc(sizeof(size_t) * cfg->count);
+    parallel.order = malloc(sizeof(size_t) * (cfg->count + 1));
+    parallel.order_count = layout_order(cfg, NULL, parallel.order);
+
+    // split into roughly even chunks, a few per thread so a slow one can be
+    // made up for by the others
+    size_t total = 0;
+    for (size_t i = 0; i < cfg->count; i++)
+        total += cfg->nodes[i]->instructions_count;
+    size_t chunk_size = total / (options->threads * 8);
+    if (chunk_size < JIT_CHUNK_MIN)
+        chunk_size = JIT_CHUNK_MIN;
+
+    parallel.chunks = calloc(cfg->count, sizeof(JitChunk));
+    for (size_t i = 0; i < parallel.order_count;) {
+        JitChunk* chunk = &parallel.chunks[parallel.chunk_count++];
+        size_t size = 0;
+        chunk->first = i;
+        chunk->fixups.marking = options->profile != NULL;
+        while (i < parallel.order_count && size < chunk_size)
+            size += cfg->nodes[parallel.order[i++]]->instructions_count;
+        chunk->last = i;
+    }
+
+    // this thread is arenas[0], the others as many as start
+    pthread_t* workers = malloc(sizeof(pthread_t) * options->threads);
+    int started = 1;
+    while (started < options->threads && pthread_create(&workers[started], NULL, jit_worker, &parallel) == 0)
+        started++;
+    CodeArena** arenas = malloc(sizeof(CodeArena*) * started);
+    arenas[0] = jit_worker(&parallel);
+    int compiled = arenas[0] != NULL;
+    for (int t = 1; t < started; t++) {
+        pthread_join(workers[t], (void**)&arenas[t]);
+        compiled |= arenas[t] != NULL;
+    }
+    // any worker that got an arena kept taking chunks until there were none
+    if (!compiled) {
+        for (size_t c = 0; c < parallel.chunk_count; c++)
+            free_fixups(&parallel.chunks[c].fixups);
+        free(arenas);
+        free(workers);
+        free(parallel.chunks);
+        free(parallel.block_offset);
+        free(parallel.order);
+        return -1;
+    }
+
+    // link: lay the chunks out in order, moving their fixups along with them,
+    // then every block has an address
+    uint8_t** label = calloc(cfg->count + 1, sizeof(uint8_t*));
+    FixupList linked = {.marking = options->profile != NULL};
+    uint8_t* start = *jit_memory;
+    init_jit(jit_memory, cfg->regalloc);
+    emit_program_entry(jit_memory, cfg);
+    for (size_t c = 0; c < parallel.chunk_count; c++) {
+        JitChunk* chunk = &parallel.chunks[c];
+        emit_align(jit_memory, parallel.align, &linked);
+        arena_ensure(jit_memory, chunk->size);
+        memcpy(*jit_memory, chunk->code, chunk->size);
+        for (size_t i = chunk->first; i < chunk->last; i++)
+            label[parallel.order[i]] = *jit_memory + parallel.block_offset[parallel.order[i]];
+        for (size_t i = 0; i < chunk->fixups.count; i++) {
+            BranchFixup* fixup = &chunk->fixups.fixups[i];
+            add_fixup(&linked, *jit_memory + (fixup->patch - chunk->code), fixup->target, fixup->opcode);
+        }
+        for (size_t i = 0; i < chunk->fixups.pad_count; i++) {
+            AlignPad* pad = &chunk->fixups.pads[i];
+            add_pad(&linked, *jit_memory + (pad->at - chunk->code), pad->alignment, pad->size);
+        }
+        for (size_t i = 0; i < chunk->fixups.mark_count; i++) {
+            PcMark* mark = &chunk->fixups.marks[i];
+            add_mark(&linked, *jit_memory + (mark->code - chunk->code), mark->pc);
+        }
+        *jit_memory += chunk->size;
+        free_fixups(&chunk->fixups);
+    }
+
+    // the end of the program comes right after the last block, same as jit_region
+    label[cfg->count] = *jit_memory;
+    if (linked.marking)
+        add_mark(&linked, *jit_memory, PROFILE_NO_PC);
+    emit_vector_leave(jit_memory, cfg->regalloc, options);
+    emit_x86ret_reg(jit_memory, cfg->regalloc, RETURN_REG);
+    relax_branches(jit_memory, start, &linked, label, cfg->count + 1);
+    if (options->symbols)
+        add_symbols(options->symbols, cfg, 0, parallel.order, parallel.order_count, label, start, *jit_memory);
+    if (options->profile)
+        publish_marks(options->profile, &linked);
+
+    for (int t = 0; t < started; t++)
+        arena_free(arenas[t]);
+    free(arenas);
+    free(workers);
+    free_fixups(&linked);
+    free(label);
+    free(parallel.chunks);
+    free(parallel.block_offset);
+    free(parallel.order);
+    return 0;
+}
+
+void jit_program(uint8_t** jit_memory, CFG* cfg, JitOptions* options) {
+    if (options->threads > 1 && jit_program_parallel(jit_memory, cfg, options) == 0)
+        return;
+    JitRegion region = {.cfg = cfg, .in_region = NULL, .entry = 0, .unit = 0};
+    jit_region(jit_memory, &region, options);
+}
+
+// blocks with in_region set, entered at entry. the VMState* lives in the frame
+// slot at state_disp (see regalloc_frame_slot)
+JitUnit jit_unit(uint8_t** jit_memory, CFG* cfg, uint8_t* in_region, size_t entry, int32_t state_disp,
+                 JitOptions* options) {
+    JitRegion region = {
+        .cfg = cfg, .in_region = in_region, .entry = entry, .unit = 1, .state_disp = state_disp};
+    return (JitUnit)jit_region(jit_memory, &region, options);
+}
+
+/**
+    Lazy compilation
+
+    Only the entry and exit of the program are
+    compiled up front. A branch to a block that
+    hasn't been compiled yet goes to a stub of its
+    own instead, which pushes the stub's site number
+    and jumps to a shared trampoline. The trampoline
+    saves everything the call into C could clobber
+    (flags included, a cmp can be live across the
+    branch) and calls lazy_compile, which compiles
+    the block if it has to, points the branch that
+    got us here straight at it and returns where to
+    go. Each stub runs at most once.
+
+    Registers are still allocated for the whole
+    program up front so blocks can be compiled in
+    any order and still agree on where everything
+    lives.
+*/
+
+// shared by every stub, see above
+static void emit_lazy_trampoline(uint8_t** jit_memory, JitLazy* lazy) {
+    static const _x86_register saved[] = {
+        _x86_RAX, _x86_RCX, _x86_RDX, _x86_RSI, _x86_RDI, _x86_R8, _x86_R9, _x86_R10,
+    };
+    int count = sizeof(saved) / sizeof(saved[0]);
+
+    emit_x86instruction(jit_memory, &__pushf, 0, 0, 0);
+    for (int i = 0; i < count; i++)
+        emit_x86instruction(jit_memory, &__push_r64, saved[i], 0, 0);
+
+    // site number pushed by the stub, above the flags and saved registers
+    emit_x86instruction_mem(jit_memory, &__mov_r64_rm64, _x86_RSI, _x86_RSP, 8 * (count + 1), 0);
+
+    // the abi wants rsp 16 byte aligned at the call, keep the old one to restore
+    emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RSP, JIT_SCRATCH, 0);
+    emit_x86instruction(jit_memory, &__and_rm64_imm32, 0, _x86_RSP, (uint64_t)-16);
+    emit_x86instruction(jit_memory, &__push_r64, JIT_SCRATCH, 0, 0);
+    emit_x86instruction(jit_memory, &__push_r64, JIT_SCRATCH, 0, 0);
+
+    emit_vector_leave(jit_memory, lazy->cfg->regalloc, lazy->options);
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RDI, 0, (uintptr_t)lazy);
+    emit_x86instruction(jit_memory, &__mov_r64_imm64, _x86_RAX, 0, (uintptr_t)lazy_compile);
+    emit_x86instruction(jit_memory, &__call_rm64, 0, _x86_RAX, 0);
+    emit_x86instruction(jit_memory, &__mov_rm64_r64, _x86_RAX, JIT_SCRATCH, 0);
+
+    emit_x86instruction(jit_memory, &__pop_r64, _x86_RSP, 0, 0);
+    for (int i = count - 1; i >= 0; i--)
+        emit_x86instruction(jit_memory, &__pop_r64, saved[i], 0, 0);
+    emit_x86instruction(jit_memory, &__popf, 0, 0, 0);
+
+    // drop the site number, lea since add would clobber the flags just restored
+    emit_x86instruction_mem(jit_memory, &__lea_r64_m, _x86_RSP, _x86_RSP, 8, 0);
+    emit_x86instruction(jit_memory, &__jmp_rm64, 0, JIT_SCRATCH, 0);
+}
+
+// point every branch in fixups at its block, or at a new stub if it isn't
+// compiled yet
+static void lazy_link(uint8_t** jit_memory, JitLazy* lazy, FixupList* fixups) {
+    for (size_t i = 0; i < fixups->count; i++) {
+        BranchFixup* fixup = &fixups->fixups[i];
+        if (lazy->label[fixup->target]) {
+            patch_rel32(fixup->patch, lazy->label[fixup->target]);
+            continue;
+        }
+
+        if (lazy->site_count == lazy->site_capacity) {
+            lazy->site_capacity = lazy->site_capacity ? lazy->site_capacity * 2 : 16;
+            lazy->sites = realloc(lazy->sites, sizeof(BranchFixup) * lazy->site_capacity);
+        }
+        lazy->sites[lazy->site_count] = *fixup;
+
+        patch_rel32(fixup->patch, *jit_memory);
+        emit_x86instruction(jit_memory, &__push_imm32, 0, 0, lazy->site_count++);
+        emit_x86instruction(jit_memory, &__jmp_rel32, 0, 0, 0);
+        patch_rel32(*jit_memory - 4, lazy->trampoline);
+    }
+}
+
+uint8_t* lazy_compile(JitLazy* lazy, uint64_t site) {
+    CFG* cfg = lazy->cfg;
+    CodeArena* arena = lazy->arena;
+    BranchFixup branch = lazy->sites[site];  // copied, compiling can grow sites
+
+    arena_unseal(arena);
+    if (lazy->label[branch.target] == NULL) {
+        uint8_t** jit_memory = &arena->advance;
+        BasicBlock* bb = cfg->nodes[branch.target];
+        FixupList fixups = {.marking = lazy->options->profile != NULL};
+
+        emit_align(jit_memory, block_alignment(cfg, bb, lazy->options), NULL);
+        uint8_t* start = *jit_memory;
+        lazy->label[branch.target] = start;
+
+        // nothing is known to follow, so falling through always takes a jump
+        jit_block(jit_memory, cfg, bb, cfg->count + 1, &fixups, lazy->options);
+        if (fixups.marking) {
+            // the stubs lazy_link makes aren't part of the block
+            add_mark(&fixups, *jit_memory, PROFILE_NO_PC);
+            publish_marks(lazy->options->profile, &fixups);
+        }
+        lazy_link(jit_memory, lazy, &fixups);
+        lazy->compiled++;
+        free_fixups(&fixups);
+
+        if (lazy->options->symbols) {
+            symbols_add_block(lazy->options->symbols, start, *jit_memory - start, bb->instructions[0]->pc);
+            symbols_commit(lazy->options->symbols);
+        }
+
+        if (lazy->options->debug)
+            printf("lazy: block %zu (%zu bytes)\n", branch.target, (size_t)(*jit_memory - start));
+    }
+    patch_rel32(branch.patch, lazy->label[branch.target]);
+    arena_seal(arena);
+
+    return lazy->label[branch.target];
+}
+
+// emits the program entry and exit and leaves everything else for later.
+// registers must already be allocated, the arena is left sealed
+JitLazy* jit_lazy(CodeArena* arena, CFG* cfg, JitOptions* options) {
+    uint8_t** jit_memory = &arena->advance;
+    JitLazy* lazy = calloc(1, sizeof(JitLazy));
+    lazy->arena = arena;
+    lazy->cfg = cfg;
+    lazy->options = options;
+    lazy->label = calloc(cfg->count + 1, sizeof(uint8_t*));
+
+    FixupList fixups = {0};
+    lazy->entry = *jit_memory;
+    init_jit(jit_memory, cfg->regalloc);
+    emit_program_entry(jit_memory, cfg);
+    emit_jump(jit_memory, &fixups, U2_JMP, 0);
+
+    lazy->label[cfg->count] = *jit_memory;
+    emit_vector_leave(jit_memory, cfg->regalloc, options);
+    emit_x86ret_reg(jit_memory, cfg->regalloc, RETURN_REG);
+
+    lazy->trampoline = *jit_memory;
+    emit_lazy_trampoline(jit_memory, lazy);
+    lazy_link(jit_memory, lazy, &fixups);
+    free_fixups(&fixups);
+
+    if (options->symbols) {
+        // the stubs lazy_link just made are counted as part of the trampoline
+        symbols_add(options->symbols, lazy->entry, lazy->label[cfg->count] - lazy->entry, "u2_entry");
+        symbols_add(options->symbols, lazy->label[cfg->count], lazy->trampoline - lazy->label[cfg->count], "u2_exit");
+        symbols_add(options->symbols, lazy->trampoline, *jit_memory - lazy->trampoline, "u2_lazy_trampoline");
+        symbols_commit(options->symbols);
+    }
+
+    arena_seal(arena);
+    return lazy;
+}
+
+void jit_lazy_free(JitLazy* lazy) {
+    free(lazy->label);
+    free(lazy->sites);
+    free(lazy);
+}
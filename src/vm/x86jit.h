@@ -1,12 +1,63 @@
 #ifndef X86JIT_H
 #define X86JIT_H
 
+#include "arena.h"
+#include "cfg.h"
+#include "profile.h"
+#include "symbols.h"
+#include "x86encoding.h"
+#include <stddef.h>
 #include <stdint.h>
 
-void init_jit(uint8_t** jit_memory);
-void free_jit(uint8_t** jit_memory);
-void emit_jit(uint8_t** jit_memory, uint32_t opcode, uint32_t rd, uint32_t rs1, uint32_t rs2, uint64_t imm);
+// never allocated, free for the jit to clobber between instructions
+#define JIT_SCRATCH _x86_R11
+
+// base of linear memory for programs that use ld/st, see memory.c
+#define JIT_MEMBASE _x86_R15
+
+typedef struct {
+    size_t block_align;   // every block starts on this boundary (1 for none)
+    size_t loop_align;    // loop headers start on this boundary
+    int threads;          // compile jit_program on this many threads
+    JitSymbols* symbols;  // compiled blocks are published here, NULL for nowhere
+    JitProfile* profile;  // gets a PcMark per compiled instruction, NULL for none
+    uint64_t* counters;   // bumped by every block and branch, see counts.h
+    int debug;            // say what gets compiled as it happens (--dev)
+    int avx2;             // vector instructions as avx2, sse2 otherwise (--simd)
+} JitOptions;
+
+// compiled region entered from the interpreter, returns the block to go on at
+typedef uint64_t (*JitUnit)(void* state);
+
+typedef struct BranchFixup BranchFixup;
+
+// program compiled a block at a time as it runs, see jit_lazy
+typedef struct {
+    CodeArena* arena;
+    CFG* cfg;
+    JitOptions* options;
+    uint8_t* entry;       // called like a jit_program
+    uint8_t* trampoline;  // every stub ends up here
+    uint8_t** label;      // code of each compiled block, [count] is the exit
+    BranchFixup* sites;   // branch behind each stub
+    size_t site_count;
+    size_t site_capacity;
+    size_t compiled;      // blocks compiled so far
+} JitLazy;
+
+void jit_program(uint8_t** jit_memory, CFG* cfg, JitOptions* options);
+JitUnit jit_unit(uint8_t** jit_memory, CFG* cfg, uint8_t* in_region, size_t entry, int32_t state_disp,
+                 JitOptions* options);
+JitLazy* jit_lazy(CodeArena* arena, CFG* cfg, JitOptions* options);
+uint8_t* lazy_compile(JitLazy* lazy, uint64_t site);
+void jit_lazy_free(JitLazy* lazy);
+void init_jit(uint8_t** jit_memory, RegAllocation* ra);
+void free_jit(uint8_t** jit_memory, RegAllocation* ra);
+void emit_jit(uint8_t** jit_memory, RegAllocation* ra, uint32_t opcode, uint32_t rd, uint32_t rs1, uint32_t rs2,
+              uint64_t imm, JitOptions* options);
 void emit_x86ret(uint8_t** jit_memory);
-void emit_x86ret_reg(uint8_t** jit_memory, uint32_t reg);  // debugging
+void emit_x86ret_reg(uint8_t** jit_memory, RegAllocation* ra, uint32_t reg);  // debugging
+void emit_spill_load(uint8_t** jit_memory, RegAllocation* ra, _x86_register dst, uint32_t reg);
+void emit_spill_store(uint8_t** jit_memory, RegAllocation* ra, uint32_t reg, _x86_register src);
 
 #endif
@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+#set -euo pipefail
+
+# the goldens only see what u2vm prints while writing a file with --aot, this
+# runs what it wrote. every program here goes through the jit (the last line
+# of --dev is r1 in hex), an --aot executable and an --aot-object linked
+# against tests/aot_driver.c, and all three have to agree
+
+# fix relative paths
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR/.." || exit 1
+
+ASM_BIN="$SCRIPT_DIR/../build/u2asm"
+VM_BIN="$SCRIPT_DIR/../build/u2vm"
+TEST_DIR="$SCRIPT_DIR/src"
+OUT_DIR="$SCRIPT_DIR/../build/aot"
+CC="${CC:-gcc}"
+
+# no traps (the executable has no handler) and nothing but the default flags
+PROGRAMS="aot alu branch imm loop memory spill"
+
+echo "=== Running aot tests ==="
+
+mkdir -p "$OUT_DIR"
+failures=0
+
+for base in $PROGRAMS; do
+    u2b="$OUT_DIR/$base.u2b"
+    exe="$OUT_DIR/$base"
+    obj="$OUT_DIR/$base.o"
+    driver="$OUT_DIR/${base}_driver"
+
+    echo "--- $base ---"
+    $ASM_BIN "$TEST_DIR/$base.u2a" "$u2b" > /dev/null
+    jit=$($VM_BIN --dev "$u2b" 2> /dev/null | tail -n 1)
+
+    $VM_BIN --aot="$exe" "$u2b" > /dev/null
+    executable=$("$exe")
+    status=$?
+    if [ "$status" -ne 0 ] || [ "$executable" != "$jit" ]; then
+        echo "!!! --aot executable for $base exited $status with '$executable', the jit got '$jit' !!!"
+        failures=$((failures+1))
+    fi
+
+    $VM_BIN --aot-object="$obj" "$u2b" > /dev/null
+    if ! $CC $CFLAGS "$SCRIPT_DIR/aot_driver.c" "$obj" -o "$driver"; then
+        echo "!!! --aot-object for $base doesn't link !!!"
+        failures=$((failures+1))
+        continue
+    fi
+    object=$("$driver")
+    status=$?
+    if [ "$status" -ne 0 ] || [ "$object" != "$jit" ]; then
+        echo "!!! --aot-object for $base exited $status with '$object', the jit got '$jit' !!!"
+        failures=$((failures+1))
+    fi
+done
+
+if [ "$failures" -eq 0 ]; then
+    echo "[-] All aot tests passed!"
+else
+    echo "!!! $failures aot tests failed. !!!"
+    exit 1
+fi
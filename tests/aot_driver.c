@@ -0,0 +1,43 @@
+/**
+
+    --aot-object driver
+
+    Links against what u2vm --aot-object wrote and
+    calls u2_program the way aot.h says to: memory
+    inside the same guard pages memory.c reserves.
+    Prints r1 in hex like the --aot executable so
+    tests/aot.sh can compare the two with the jit.
+    Called twice to check the program doesn't keep
+    anything between calls but what is in memory.
+
+ */
+
+#include "../src/vm/memory.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+uint64_t u2_program(uint8_t* mem);
+
+int main(void) {
+    uint8_t* reservation = mmap(NULL, MEMORY_GUARD_BELOW + MEMORY_GUARD_ABOVE, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    uint8_t* mem = reservation + MEMORY_GUARD_BELOW;
+    if (mprotect(mem, MEMORY_DEFAULT_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        perror("mprotect");
+        return 1;
+    }
+
+    uint64_t first = u2_program(mem);
+    uint64_t second = u2_program(mem);
+    if (first != second) {
+        printf("second call returned %lX, the first %lX\n", second, first);
+        return 1;
+    }
+    printf("%lX\n", first);
+    return 0;
+}
@@ -13,6 +13,10 @@ echo "=== Generating reference test cases ==="
 
 for src in "$TEST_DIR"/*.u2a; do
     base=$(basename "$src" .u2a)
+    # extra vm flags can be requested with a "; vmflags: ..." line in the source
+    vm_flags=$(sed -n 's/^; vmflags: //p' "$src" | head -n 1)
+    # and assembler flags with "; asmflags: ..."
+    asm_flags=$(sed -n 's/^; asmflags: //p' "$src" | head -n 1)
     ref_dir="$TEST_DIR/refs/$base.ref"
     mkdir -p "$ref_dir"
 
@@ -21,10 +25,10 @@ for src in "$TEST_DIR"/*.u2a; do
     vm_stdout="$ref_dir/$base.vm.out"
 
     echo "--- Assembling $src ---"
-    $ASM_BIN --dev "$src" "$u2b_file" > "$asm_stdout"
+    $ASM_BIN --dev $asm_flags "$src" "$u2b_file" > "$asm_stdout"
 
     echo "--- Running VM on $u2b_file ---"
-    $VM_BIN --dev "$u2b_file" > "$vm_stdout"
+    $VM_BIN --dev $vm_flags "$u2b_file" > "$vm_stdout"
 done
 
 echo "=== Reference generation complete ==="
@@ -0,0 +1,170 @@
+/**
+
+    libu2vm test
+
+    Programs are encoded by hand (see u2.txt for
+    the format) so nothing but the library is
+    involved, each check loads or calls a module
+    and compares what comes back. The same file is
+    built against the static and the shared
+    library.
+
+ */
+
+#include "../src/common/instruction.h"
+#include "../src/vm/u2vm.h"
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// one instruction word, registers by number (r16 is 16) and a 14 bit imm
+#define word(op, rd, rs1, rs2, imm) \
+    ((uint32_t)(op) << 26 | ((rd) & 15) << 22 | ((rs1) & 15) << 18 | ((rs2) & 15) << 14 | ((imm) & 0x3FFF))
+
+// r1 = r2 + (r2 - 1) + ... + 1, r3 is left at 1 and r4 at 0
+static uint32_t sum[] = {
+    word(U2_LI, 1, 0, 0, 0),   // 0
+    word(U2_LI, 3, 0, 0, 1),   // 1
+    word(U2_LI, 4, 0, 0, 0),   // 2
+    word(U2_ADD, 1, 1, 2, 0),  // 3 loop:
+    word(U2_SUB, 2, 2, 3, 0),  // 4
+    word(U2_CMP, 0, 2, 4, 0),  // 5
+    word(U2_JG, 0, 0, 0, -3),  // 6 jg loop
+};
+
+// mem[8] += r2, returns the new value in r1. entry at 1 skips the li and
+// takes the base address from the caller's r5
+static uint32_t counter[] = {
+    word(U2_LI, 5, 0, 0, 0),   // 0
+    word(U2_LD, 1, 5, 0, 8),   // 1
+    word(U2_ADD, 1, 1, 2, 0),  // 2
+    word(U2_ST, 0, 1, 5, 8),   // 3
+};
+
+// r1 = r2 through v1 += v2, which only comes out as r2 if v1 started at 0.
+// r4 is the address
+static uint32_t vector[] = {
+    word(U2_ST, 0, 2, 4, 0),
+    word(U2_VLD, 2, 4, 0, 0),
+    word(U2_VADD, 1, 1, 2, 0),
+    word(U2_VST, 0, 1, 4, 0),
+    word(U2_LD, 1, 4, 0, 0),
+};
+
+// r1 = r2 / r3
+static uint32_t divide[] = {
+    word(U2_DIV, 1, 2, 3, 0),
+};
+
+static int failures = 0;
+
+// the embedder's own SIGSEGV handler, installed before libu2vm's. a fault
+// that isn't a u2 trap has to end up here
+static sigjmp_buf own_env;
+static volatile sig_atomic_t own_faults = 0;
+
+static void own_handler(int sig) {
+    (void)sig;
+    own_faults++;
+    siglongjmp(own_env, 1);
+}
+
+static void check(int ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+int main(void) {
+    struct sigaction action = {.sa_handler = own_handler};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+
+    // compiled once, called with different inputs
+    U2Module* module = u2vm_load(sum, sizeof(sum), NULL);
+    check(module != NULL, "sum loads");
+    for (uint64_t n = 1; n <= 100; n++) {
+        uint64_t regs[U2VM_REGS] = {0};
+        regs[U2VM_REG(2)] = n;
+        regs[U2VM_REG(9)] = 0xDEAD;
+        regs[U2VM_REG(16)] = 0xBEEF;
+        int ok = u2vm_call(module, 0, regs, NULL) == 0;
+        ok = ok && regs[U2VM_REG(1)] == n * (n + 1) / 2 && regs[U2VM_REG(2)] == 0;
+        ok = ok && regs[U2VM_REG(3)] == 1 && regs[U2VM_REG(4)] == 0;
+        ok = ok && regs[U2VM_REG(9)] == 0xDEAD && regs[U2VM_REG(16)] == 0xBEEF;
+        check(ok, "sum of 1..n, untouched registers come back as they went in");
+    }
+    uint64_t regs[U2VM_REGS] = {0};
+    check(u2vm_call(module, 3, regs, NULL) == -1, "pc that isn't an entry point is refused");
+    u2vm_free(module);
+
+    // memory outlives a call, entry points other than 0
+    uint64_t entry = 1;
+    U2Options options = {.entry = &entry, .entry_count = 1, .regalloc_graph = 1};
+    module = u2vm_load(counter, sizeof(counter), &options);
+    check(module != NULL, "counter loads");
+    for (uint64_t i = 1; i <= 10; i++) {
+        memset(regs, 0, sizeof(regs));
+        regs[U2VM_REG(2)] = i;
+        check(u2vm_call(module, 0, regs, NULL) == 0 && regs[U2VM_REG(1)] == i * (i + 1) / 2, "memory persists");
+    }
+    memset(regs, 0, sizeof(regs));
+    regs[U2VM_REG(5)] = 0;
+    check(u2vm_call(module, 1, regs, NULL) == 0 && regs[U2VM_REG(1)] == 55, "call at an entry point");
+    size_t size;
+    uint8_t* memory = u2vm_memory(module, &size);
+    check(size >= 16 && *(uint64_t*)(memory + 8) == 55, "memory is readable from outside");
+    memset(regs, 0, sizeof(regs));
+    regs[U2VM_REG(5)] = 1 << 30;
+    U2Trap trap;
+    check(u2vm_call(module, 1, regs, &trap) == SIGSEGV && trap.offset == (1 << 30) + 8, "out of bounds traps");
+    u2vm_free(module);
+
+    // vector registers don't outlive a call
+    module = u2vm_load(vector, sizeof(vector), NULL);
+    for (uint64_t i = 1; i <= 3; i++) {
+        memset(regs, 0, sizeof(regs));
+        regs[U2VM_REG(2)] = i;
+        check(u2vm_call(module, 0, regs, NULL) == 0 && regs[U2VM_REG(1)] == i, "vectors start at 0 every call");
+    }
+    u2vm_free(module);
+
+    // a trap leaves the module usable
+    module = u2vm_load(divide, sizeof(divide), NULL);
+    memset(regs, 0, sizeof(regs));
+    regs[U2VM_REG(2)] = 7;
+    check(u2vm_call(module, 0, regs, &trap) == SIGFPE && trap.signal == SIGFPE, "division by zero traps");
+    regs[U2VM_REG(3)] = 2;
+    check(u2vm_call(module, 0, regs, NULL) == 0 && regs[U2VM_REG(1)] == 3, "and the next call still works");
+    u2vm_free(module);
+
+    // a fault outside any module goes to the handler that was there before,
+    // and traps still work after it
+    volatile uint8_t* page = mmap(NULL, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sigsetjmp(own_env, 1) == 0)
+        page[0] = 1;
+    check(own_faults == 1, "a fault that isn't a trap reaches the embedder's handler");
+    munmap((void*)page, 4096);
+    module = u2vm_load(counter, sizeof(counter), &options);
+    memset(regs, 0, sizeof(regs));
+    regs[U2VM_REG(5)] = 1 << 30;
+    check(u2vm_call(module, 1, regs, NULL) == SIGSEGV && own_faults == 1, "and a trap still doesn't");
+    u2vm_free(module);
+
+    // bad input is an error, not an exit
+    uint32_t bad_jump[] = {word(U2_JMP, 0, 0, 0, 100)};
+    check(u2vm_load(bad_jump, sizeof(bad_jump), NULL) == NULL, "jump out of the program is refused");
+    check(u2vm_load(sum, 0, NULL) == NULL, "empty bytecode is refused");
+    entry = 100;
+    check(u2vm_load(sum, sizeof(sum), &options) == NULL, "entry point outside the program is refused");
+
+    if (failures) {
+        printf("%d libu2vm checks failed\n", failures);
+        return 1;
+    }
+    printf("All libu2vm checks passed\n");
+    return 0;
+}
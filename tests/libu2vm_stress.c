@@ -0,0 +1,125 @@
+/**
+
+    libu2vm stress test
+
+    Every thread loads, calls and frees programs
+    of its own over and over, all at the same time.
+    The programs differ in how many registers they
+    keep alive (so some get an identity mapping and
+    some spill), whether they use memory and which
+    allocator they ask for. Anything one
+    compilation leaks into another shows up as a
+    wrong sum. Every so often a call divides by
+    zero instead, traps are per thread too.
+
+ */
+
+#include "../src/common/instruction.h"
+#include "../src/vm/u2vm.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+
+#define THREADS 8
+#define ROUNDS 200
+#define MAX_WORDS 64
+
+#define word(op, rd, rs1, rs2, imm) \
+    ((uint32_t)(op) << 26 | ((rd) & 15) << 22 | ((rs1) & 15) << 18 | ((rs2) & 15) << 14 | ((imm) & 0x3FFF))
+
+// r5 .. r(4+k) start at value(j) and go up by one every iteration, r1 sums
+// them all up on the way. r2 counts the iterations down, r3 is 1 and r4 is 0.
+// with memory the sum takes a round trip through mem[8]
+static size_t build(uint32_t* code, int k, int memory, int seed) {
+    size_t n = 0;
+    code[n++] = word(U2_LI, 1, 0, 0, 0);
+    code[n++] = word(U2_LI, 3, 0, 0, 1);
+    code[n++] = word(U2_LI, 4, 0, 0, 0);
+    for (int j = 0; j < k; j++)
+        code[n++] = word(U2_LI, 5 + j, 0, 0, seed + 7 * j);
+
+    size_t loop = n;
+    for (int j = 0; j < k; j++) {
+        code[n++] = word(U2_ADD, 1, 1, 5 + j, 0);
+        code[n++] = word(U2_ADD, 5 + j, 5 + j, 3, 0);
+    }
+    code[n++] = word(U2_SUB, 2, 2, 3, 0);
+    code[n++] = word(U2_CMP, 0, 2, 4, 0);
+    code[n] = word(U2_JG, 0, 0, 0, (int32_t)loop - (int32_t)n);
+    n++;
+
+    if (memory) {
+        code[n++] = word(U2_ST, 0, 1, 4, 8);
+        code[n++] = word(U2_LI, 1, 0, 0, 0);
+        code[n++] = word(U2_LD, 1, 4, 0, 8);
+    }
+    return n;
+}
+
+static void* worker(void* arg) {
+    long t = (long)arg;
+    long failures = 0;
+    uint32_t code[MAX_WORDS];
+
+    for (int i = 0; i < ROUNDS; i++) {
+        int k = 1 + (t * 5 + i) % 12;
+        int memory = (t + i) % 3 == 0;
+        int seed = (int)(t * 100 + i);
+        uint64_t n = 1 + (t * 31 + i * 7) % 50;
+
+        size_t words = build(code, k, memory, seed);
+        U2Options options = {.regalloc_graph = (i + t) & 1, .memory_size = 4096};
+        U2Module* module = u2vm_load(code, words * sizeof(uint32_t), &options);
+        if (module == NULL) {
+            failures++;
+            continue;
+        }
+
+        uint64_t regs[U2VM_REGS] = {0};
+        regs[U2VM_REG(2)] = n;
+        uint64_t sum = 0;
+        for (int j = 0; j < k; j++)
+            sum += n * (uint64_t)(seed + 7 * j) + n * (n - 1) / 2;
+        int last = 4 + k;
+
+        if (u2vm_call(module, 0, regs, NULL) != 0 || regs[U2VM_REG(1)] != sum ||
+            regs[U2VM_REG(last)] != (uint64_t)(seed + 7 * (k - 1)) + n) {
+            printf("FAIL: thread %ld round %d (k=%d memory=%d graph=%d): r1=%lu want %lu\n", t, i, k, memory,
+                   options.regalloc_graph, regs[U2VM_REG(1)], sum);
+            failures++;
+        }
+
+        if (i % 10 == 0) {
+            // r3 is 1 at the end, r4 is 0
+            uint32_t divide = word(U2_DIV, 1, 3, 4, 0);
+            U2Module* trapping = u2vm_load(&divide, sizeof(divide), NULL);
+            if (u2vm_call(trapping, 0, regs, NULL) != SIGFPE) {
+                printf("FAIL: thread %ld round %d: division by zero didn't trap\n", t, i);
+                failures++;
+            }
+            u2vm_free(trapping);
+        }
+        u2vm_free(module);
+    }
+    return (void*)failures;
+}
+
+int main(void) {
+    pthread_t threads[THREADS];
+    for (long t = 0; t < THREADS; t++)
+        pthread_create(&threads[t], NULL, worker, (void*)t);
+
+    long failures = 0;
+    for (int t = 0; t < THREADS; t++) {
+        void* result;
+        pthread_join(threads[t], &result);
+        failures += (long)result;
+    }
+
+    if (failures) {
+        printf("%ld of %d parallel compilations went wrong\n", failures, THREADS * ROUNDS);
+        return 1;
+    }
+    printf("All %d parallel compilations passed\n", THREADS * ROUNDS);
+    return 0;
+}
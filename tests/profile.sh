@@ -0,0 +1,66 @@
+#!/usr/bin/env bash
+#set -euo pipefail
+
+# the profile goes to stderr, which the goldens don't look at and which isn't
+# the same twice anyway. this checks what has to hold whatever the sample
+# counts: a header, the hot loop's label owning nearly all of the samples
+# under every jit, and samples in the interpreter counted as outside compiled
+# code (PROFILE_NO_PC) rather than pinned on some block
+
+# fix relative paths
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR/.." || exit 1
+
+ASM_BIN="$SCRIPT_DIR/../build/u2asm"
+VM_BIN="$SCRIPT_DIR/../build/u2vm"
+OUT_DIR="$SCRIPT_DIR/../build/profile"
+SRC="$SCRIPT_DIR/src/profile.u2a"
+
+echo "=== Running profile tests ==="
+
+mkdir -p "$OUT_DIR"
+failures=0
+
+fail() {
+    echo "!!! $1 !!!"
+    echo "$profile"
+    failures=$((failures+1))
+}
+
+# --sym so samples can be grouped by label
+$ASM_BIN --sym "$SRC" "$OUT_DIR/profile.u2b" > /dev/null
+
+for flags in "" "--lazy" "--baseline" "--jit-threads=4"; do
+    echo "--- profile.u2a ${flags:-(default jit)} ---"
+    profile=$($VM_BIN --profile-sample $flags "$OUT_DIR/profile.u2b" 2>&1 > /dev/null)
+    total=$(echo "$profile" | sed -n 's/^profile: \([0-9]*\) samples every 1000 us, [0-9]* outside compiled code$/\1/p')
+    hot=$(echo "$profile" | awk '$3 == "hot" && NF == 3 {print $1}')
+    if [ -z "$total" ]; then
+        fail "no profile header with $flags"
+    elif [ "$total" -lt 10 ]; then
+        fail "only $total samples with $flags, the loop runs for long enough to get more"
+    elif [ -z "$hot" ] || [ $((hot * 10)) -lt $((total * 9)) ]; then
+        fail "hot has ${hot:-no} samples of $total with $flags"
+    fi
+done
+
+# never promoted, everything runs in the interpreter. a tenth of the loop is
+# plenty there
+echo "--- profile.u2a (interpreter only) ---"
+sed 's/^li r2 200000000$/li r2 20000000/' "$SRC" > "$OUT_DIR/interp.u2a"
+$ASM_BIN --sym "$OUT_DIR/interp.u2a" "$OUT_DIR/interp.u2b" > /dev/null
+profile=$($VM_BIN --profile-sample --tiered --hot-threshold=0 --osr-threshold=0 "$OUT_DIR/interp.u2b" 2>&1 > /dev/null)
+counts=$(echo "$profile" | sed -n 's/^profile: \([0-9]*\) samples every 1000 us, \([0-9]*\) outside compiled code$/\1 \2/p')
+read -r total outside <<< "$counts"
+if [ -z "$total" ] || [ "$total" -eq 0 ] || [ "$total" != "$outside" ]; then
+    fail "interpreter samples weren't all outside compiled code"
+elif echo "$profile" | grep -q " hot$"; then
+    fail "interpreter samples were put on a block"
+fi
+
+if [ "$failures" -eq 0 ]; then
+    echo "[-] All profile tests passed!"
+else
+    echo "!!! $failures profile tests failed. !!!"
+    exit 1
+fi
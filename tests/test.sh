@@ -15,6 +15,10 @@ failures=0
 
 for src in "$TEST_DIR"/*.u2a; do
     base=$(basename "$src" .u2a)
+    # extra vm flags can be requested with a "; vmflags: ..." line in the source
+    vm_flags=$(sed -n 's/^; vmflags: //p' "$src" | head -n 1)
+    # and assembler flags with "; asmflags: ..."
+    asm_flags=$(sed -n 's/^; asmflags: //p' "$src" | head -n 1)
     ref_dir="$TEST_DIR/refs/$base.ref"
 
     u2b_file="$ref_dir/$base.u2b.out"
@@ -26,7 +30,7 @@ for src in "$TEST_DIR"/*.u2a; do
     tmp_vm="$TEST_DIR/$base.tmp.vm.out"
 
     echo "--- Assembling $src ---"
-    $ASM_BIN --dev "$src" "$tmp_u2b" > "$tmp_asm"
+    $ASM_BIN --dev $asm_flags "$src" "$tmp_u2b" > "$tmp_asm"
 
     echo "--- Checking assembler output ---"
     if ! cmp -s "$tmp_u2b" "$u2b_file"; then
@@ -42,7 +46,7 @@ for src in "$TEST_DIR"/*.u2a; do
     fi
 
     echo "--- Running VM ---"
-    $VM_BIN --dev "$tmp_u2b" > "$tmp_vm"
+    $VM_BIN --dev $vm_flags "$tmp_u2b" > "$tmp_vm"
 
     if ! cmp -s "$tmp_vm" "$vm_stdout"; then
         echo "!!! VM stdout mismatch for $base !!!"
@@ -0,0 +1,164 @@
+/**
+
+    Encoder test table
+
+    Every case is emitted on its own and compared
+    against the bytes an assembler produces for
+    the same instruction (GNU as, intel syntax, see
+    the text of each case). The encoder is supposed
+    to pick the shortest form on its own, so cases
+    name the widest encoding and expect the short
+    one back where it applies.
+
+ */
+
+#include "../src/vm/arena.h"
+#include "../src/vm/x86encoding.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef enum {
+    FORM_REG,  // emit_x86instruction, rm is a register
+    FORM_MEM,  // emit_x86instruction_sib, rm is [rm + index + disp]
+    FORM_VEX,  // emit_x86instruction_vex, same memory operand and imm is vvvv
+} EncodingForm;
+
+typedef struct {
+    char* text;
+    _x86_encoding* encoding;
+    EncodingForm form;
+    uint32_t reg;
+    uint32_t rm;
+    int index;  // -1 for none
+    int32_t disp;
+    uint64_t imm;
+    uint8_t bytes[16];
+    size_t length;
+} EncodingCase;
+
+#define NONE -1
+
+// the bytes and how many there are
+#define BYTES(...) {__VA_ARGS__}, sizeof((uint8_t[]){__VA_ARGS__})
+
+static EncodingCase cases[] = {
+    // register direct
+    {"mov rax, rbx", &__mov_rm64_r64, FORM_REG, _x86_RBX, _x86_RAX, NONE, 0, 0, BYTES(0x48, 0x89, 0xD8)},
+    {"imul rdx, r9", &__imul_r64_rm64, FORM_REG, _x86_RDX, _x86_R9, NONE, 0, 0, BYTES(0x49, 0x0F, 0xAF, 0xD1)},
+    {"shl r8, 3", &__shl_rm64_imm8, FORM_REG, 0, _x86_R8, NONE, 0, 3, BYTES(0x49, 0xC1, 0xE0, 0x03)},
+
+    // memory operands, disp0/disp8/disp32 and the rsp/r12 and rbp/r13 special cases
+    {"mov r11, [rsp+8]", &__mov_r64_rm64, FORM_MEM, _x86_R11, _x86_RSP, NONE, 8, 0,
+     BYTES(0x4C, 0x8B, 0x5C, 0x24, 0x08)},
+    {"mov [rsp+0x200], rax", &__mov_rm64_r64, FORM_MEM, _x86_RAX, _x86_RSP, NONE, 0x200, 0,
+     BYTES(0x48, 0x89, 0x84, 0x24, 0x00, 0x02, 0x00, 0x00)},
+    {"mov rax, [rbp]", &__mov_r64_rm64, FORM_MEM, _x86_RAX, _x86_RBP, NONE, 0, 0, BYTES(0x48, 0x8B, 0x45, 0x00)},
+    {"mov rax, [r13]", &__mov_r64_rm64, FORM_MEM, _x86_RAX, _x86_R13, NONE, 0, 0, BYTES(0x49, 0x8B, 0x45, 0x00)},
+    {"mov rax, [r12]", &__mov_r64_rm64, FORM_MEM, _x86_RAX, _x86_R12, NONE, 0, 0, BYTES(0x49, 0x8B, 0x04, 0x24)},
+    {"push qword [r11+8]", &__push_rm64, FORM_MEM, 0, _x86_R11, NONE, 8, 0, BYTES(0x41, 0xFF, 0x73, 0x08)},
+    {"pop qword [rsp]", &__pop_rm64, FORM_MEM, 0, _x86_RSP, NONE, 0, 0, BYTES(0x8F, 0x04, 0x24)},
+
+    // sib
+    {"mov rcx, [r15+r11+16]", &__mov_r64_rm64, FORM_MEM, _x86_RCX, _x86_R15, _x86_R11, 16, 0,
+     BYTES(0x4B, 0x8B, 0x4C, 0x1F, 0x10)},
+    {"mov rcx, [r15+r11-200]", &__mov_r64_rm64, FORM_MEM, _x86_RCX, _x86_R15, _x86_R11, -200, 0,
+     BYTES(0x4B, 0x8B, 0x8C, 0x1F, 0x38, 0xFF, 0xFF, 0xFF)},
+    {"lea rax, [rbx+rcx]", &__lea_r64_m, FORM_MEM, _x86_RAX, _x86_RBX, _x86_RCX, 0, 0, BYTES(0x48, 0x8D, 0x04, 0x0B)},
+    {"lea r11, [rbp+r12]", &__lea_r64_m, FORM_MEM, _x86_R11, _x86_RBP, _x86_R12, 0, 0,
+     BYTES(0x4E, 0x8D, 0x5C, 0x25, 0x00)},
+
+    // immediates, the imm32 forms drop to imm8 when it fits sign extended
+    {"add rsp, 8", &__add_rm64_imm32, FORM_REG, 0, _x86_RSP, NONE, 0, 8, BYTES(0x48, 0x83, 0xC4, 0x08)},
+    {"add rsp, 128", &__add_rm64_imm32, FORM_REG, 0, _x86_RSP, NONE, 0, 128,
+     BYTES(0x48, 0x81, 0xC4, 0x80, 0x00, 0x00, 0x00)},
+    {"sub rsp, 0x1000", &__sub_rm64_imm32, FORM_REG, 0, _x86_RSP, NONE, 0, 0x1000,
+     BYTES(0x48, 0x81, 0xEC, 0x00, 0x10, 0x00, 0x00)},
+    {"sub rsp, -128", &__sub_rm64_imm32, FORM_REG, 0, _x86_RSP, NONE, 0, (uint64_t)-128, BYTES(0x48, 0x83, 0xEC, 0x80)},
+    {"and rsp, -16", &__and_rm64_imm32, FORM_REG, 0, _x86_RSP, NONE, 0, (uint64_t)-16, BYTES(0x48, 0x83, 0xE4, 0xF0)},
+    {"push 5", &__push_imm32, FORM_REG, 0, 0, NONE, 0, 5, BYTES(0x6A, 0x05)},
+    {"push 0x1000", &__push_imm32, FORM_REG, 0, 0, NONE, 0, 0x1000, BYTES(0x68, 0x00, 0x10, 0x00, 0x00)},
+    {"mov qword [rsp+16], -1", &__mov_rm64_imm32, FORM_MEM, 0, _x86_RSP, NONE, 16, (uint64_t)-1,
+     BYTES(0x48, 0xC7, 0x44, 0x24, 0x10, 0xFF, 0xFF, 0xFF, 0xFF)},
+
+    // movabs only when the value doesn't fit a zero extended imm32
+    {"mov eax, 0x1234", &__mov_r64_imm64, FORM_REG, _x86_RAX, 0, NONE, 0, 0x1234, BYTES(0xB8, 0x34, 0x12, 0x00, 0x00)},
+    {"mov r10d, 0xffffffff", &__mov_r64_imm64, FORM_REG, _x86_R10, 0, NONE, 0, 0xFFFFFFFF,
+     BYTES(0x41, 0xBA, 0xFF, 0xFF, 0xFF, 0xFF)},
+    {"movabs r9, 0x123456789", &__mov_r64_imm64, FORM_REG, _x86_R9, 0, NONE, 0, 0x123456789,
+     BYTES(0x49, 0xB9, 0x89, 0x67, 0x45, 0x23, 0x01, 0x00, 0x00, 0x00)},
+
+    // branches keep their width, relaxation picks it (see x86jit.c)
+    {"je rel32", &__je_rel32, FORM_REG, 0, 0, NONE, 0, 0, BYTES(0x0F, 0x84, 0x00, 0x00, 0x00, 0x00)},
+    {"jmp rel8", &__jmp_rel8, FORM_REG, 0, 0, NONE, 0, 0, BYTES(0xEB, 0x00)},
+    {"jge rel32", &__jge_rel32, FORM_REG, 0, 0, NONE, 0, 0, BYTES(0x0F, 0x8D, 0x00, 0x00, 0x00, 0x00)},
+    {"jle rel8", &__jle_rel8, FORM_REG, 0, 0, NONE, 0, 0, BYTES(0x7E, 0x00)},
+
+    // aot runtime stub, see aot.c
+    {"call rel32", &__call_rel32, FORM_REG, 0, 0, NONE, 0, 0x10, BYTES(0xE8, 0x10, 0x00, 0x00, 0x00)},
+    {"cmp rdx, 10", &__cmp_rm64_imm8, FORM_REG, 0, _x86_RDX, NONE, 0, 10, BYTES(0x48, 0x83, 0xFA, 0x0A)},
+    {"mov [rdi-1], al", &__mov_rm8_r8, FORM_MEM, _x86_RAX, _x86_RDI, NONE, -1, 0, BYTES(0x88, 0x47, 0xFF)},
+    {"syscall", &__syscall, FORM_REG, 0, 0, NONE, 0, 0, BYTES(0x0F, 0x05)},
+
+    // vector instructions, mandatory prefixes go before rex
+    {"movdqu xmm1, [rsp+0x40]", &__movdqu_x_xm, FORM_MEM, 1, _x86_RSP, NONE, 0x40, 0,
+     BYTES(0xF3, 0x0F, 0x6F, 0x4C, 0x24, 0x40)},
+    {"movdqu [r15+r11+16], xmm0", &__movdqu_xm_x, FORM_MEM, 0, _x86_R15, _x86_R11, 16, 0,
+     BYTES(0xF3, 0x43, 0x0F, 0x7F, 0x44, 0x1F, 0x10)},
+    {"paddd xmm0, xmm1", &__paddd_x_xm, FORM_REG, 0, 1, NONE, 0, 0, BYTES(0x66, 0x0F, 0xFE, 0xC1)},
+    {"pmuludq xmm2, xmm3", &__pmuludq_x_xm, FORM_REG, 2, 3, NONE, 0, 0, BYTES(0x66, 0x0F, 0xF4, 0xD3)},
+    {"pshufd xmm2, xmm0, 0xf5", &__pshufd_x_xm_imm8, FORM_REG, 2, 0, NONE, 0, 0xF5,
+     BYTES(0x66, 0x0F, 0x70, 0xD0, 0xF5)},
+    {"pcmpgtd xmm0, xmm1", &__pcmpgtd_x_xm, FORM_REG, 0, 1, NONE, 0, 0, BYTES(0x66, 0x0F, 0x66, 0xC1)},
+
+    // vex, two bytes unless it needs X, B or the 0f38 map
+    {"vmovdqu ymm0, [rsp+0x20]", &__vmovdqu_y_ym, FORM_MEM, 0, _x86_RSP, NONE, 0x20, 0,
+     BYTES(0xC5, 0xFE, 0x6F, 0x44, 0x24, 0x20)},
+    {"vmovdqu [r15+r11-8], ymm0", &__vmovdqu_ym_y, FORM_MEM, 0, _x86_R15, _x86_R11, -8, 0,
+     BYTES(0xC4, 0x81, 0x7E, 0x7F, 0x44, 0x1F, 0xF8)},
+    {"vpaddd ymm0, ymm0, [rsp+0x40]", &__vpaddd_y_y_ym, FORM_VEX, 0, _x86_RSP, NONE, 0x40, 0,
+     BYTES(0xC5, 0xFD, 0xFE, 0x44, 0x24, 0x40)},
+    {"vpmulld ymm0, ymm0, [rsp]", &__vpmulld_y_y_ym, FORM_VEX, 0, _x86_RSP, NONE, 0, 0,
+     BYTES(0xC4, 0xE2, 0x7D, 0x40, 0x04, 0x24)},
+    {"vpcmpgtd ymm0, ymm0, [rsp+0x200]", &__vpcmpgtd_y_y_ym, FORM_VEX, 0, _x86_RSP, NONE, 0x200, 0,
+     BYTES(0xC5, 0xFD, 0x66, 0x84, 0x24, 0x00, 0x02, 0x00, 0x00)},
+    {"vzeroupper", &__vzeroupper, FORM_REG, 0, 0, NONE, 0, 0, BYTES(0xC5, 0xF8, 0x77)},
+};
+
+int main(void) {
+    CodeArena* arena = arena_create(ARENA_CHUNK, 0);
+    size_t count = sizeof(cases) / sizeof(cases[0]);
+    size_t failures = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        EncodingCase* c = &cases[i];
+        arena->advance = arena->base;
+        if (c->form == FORM_REG) {
+            emit_x86instruction(&arena->advance, c->encoding, c->reg, c->rm, c->imm);
+        } else if (c->form == FORM_MEM) {
+            emit_x86instruction_sib(&arena->advance, c->encoding, c->reg, c->rm, c->index, c->disp, c->imm);
+        } else {
+            emit_x86instruction_vex(&arena->advance, c->encoding, c->reg, c->imm, c->rm, c->index, c->disp);
+        }
+
+        size_t length = arena->advance - arena->base;
+        if (length == c->length && memcmp(arena->base, c->bytes, length) == 0)
+            continue;
+
+        failures++;
+        printf("!!! %s:\n    expected", c->text);
+        for (size_t b = 0; b < c->length; b++)
+            printf(" %02X", c->bytes[b]);
+        printf("\n    got     ");
+        for (size_t b = 0; b < length; b++)
+            printf(" %02X", arena->base[b]);
+        printf("\n");
+    }
+
+    arena_free(arena);
+    if (failures) {
+        printf("!!! %zu of %zu encodings wrong !!!\n", failures, count);
+        return 1;
+    }
+    printf("[-] All %zu encodings match!\n", count);
+    return 0;
+}